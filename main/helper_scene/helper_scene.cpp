@@ -5,27 +5,26 @@
 using namespace vcl;
 
 
-GLFWwindow* create_window(const std::string& window_title)
+GLFWwindow* create_window(const std::string& window_title, int width, int height, bool visible)
 {
     const int opengl_version_major = 3;
     const int opengl_version_minor = 3;
-    const int window_width  = 1280;
-    const int window_height = 1000;
 
-    GLFWwindow* window = vcl::glfw_create_window(window_width, window_height, window_title, opengl_version_major, opengl_version_minor);
+    glfwWindowHint(GLFW_VISIBLE, visible);
+    GLFWwindow* window = vcl::glfw_create_window(width, height, window_title, opengl_version_major, opengl_version_minor);
     return window;
 }
 
 void initialize_interface(gui_structure& gui)
 {
     std::cout<<"*** Init GLFW ***"<<std::endl;
-    vcl::glfw_init();
+    vcl::glfw_init(gui.headless);
     std::cout<<"\t [OK] GLFW Initialized"<<std::endl;
 
 
     std::cout<<"*** Create window ***"<<std::endl;
     gui.window_title = "OpenGL Window";
-    gui.window = create_window(gui.window_title);
+    gui.window = create_window(gui.window_title, gui.window_width, gui.window_height, !gui.headless);
     std::cout<<"\t [OK] Window Created"<<std::endl;
 
     std::cout<<"*** Init GLAD ***"<<std::endl;
@@ -35,6 +34,7 @@ void initialize_interface(gui_structure& gui)
     std::cout<<"*** OPENGL Information ***"<<std::endl;
     std::cout<<"======================================================="<<std::endl;
     vcl::opengl_debug_print_version();
+    vcl::opengl_debug_init(reinterpret_cast<GLADloadproc>(glfwGetProcAddress), gui.opengl_debug);
     std::cout<<"======================================================="<<std::endl;
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
@@ -47,21 +47,25 @@ void load_shaders(std::map<std::string,GLuint>& shaders)
 {
     std::cout<<"*** Setup Shader ***"<<std::endl;
 
-    shaders["mesh"] = create_shader_program("scenes/shared_assets/shaders/mesh/shader.vert.glsl","scenes/shared_assets/shaders/mesh/shader.frag.glsl");
-    shaders["mesh_bf"] = create_shader_program("scenes/shared_assets/shaders/mesh_back_illumination/mesh.vert.glsl","scenes/shared_assets/shaders/mesh_back_illumination/mesh.frag.glsl");
-    shaders["wireframe"] = create_shader_program("scenes/shared_assets/shaders/wireframe/shader.vert.glsl","scenes/shared_assets/shaders/wireframe/shader.geom.glsl","scenes/shared_assets/shaders/wireframe/shader.frag.glsl");
-    shaders["wireframe_quads"] = create_shader_program("scenes/shared_assets/shaders/wireframe_quads/shader.vert.glsl","scenes/shared_assets/shaders/wireframe_quads/shader.geom.glsl","scenes/shared_assets/shaders/wireframe_quads/shader.frag.glsl");
-    shaders["curve"] = create_shader_program("scenes/shared_assets/shaders/curve/shader.vert.glsl","scenes/shared_assets/shaders/curve/shader.frag.glsl");
-    shaders["segment_im"] = create_shader_program("scenes/shared_assets/shaders/segment_immediate_mode/shader.vert.glsl","scenes/shared_assets/shaders/segment_immediate_mode/shader.frag.glsl");
-    shaders["normals"] = create_shader_program("scenes/shared_assets/shaders/normals/shader.vert.glsl","scenes/shared_assets/shaders/normals/shader.geom.glsl","scenes/shared_assets/shaders/normals/shader.frag.glsl");
-    shaders["basic_fluid"] = create_shader_program("scenes/shared_assets/shaders/basic_fluid/shader.vert.glsl","scenes/shared_assets/shaders/basic_fluid/shader.frag.glsl");
-    shaders["depth"] = create_shader_program("scenes/shared_assets/shaders/depth/shader.vert.glsl","scenes/shared_assets/shaders/depth/shader.frag.glsl");
-    shaders["thickness"] = create_shader_program("scenes/shared_assets/shaders/thickness/shader.vert.glsl","scenes/shared_assets/shaders/thickness/shader.frag.glsl");
-    shaders["render_target"] = create_shader_program("scenes/shared_assets/shaders/render_target/shader.vert.glsl","scenes/shared_assets/shaders/render_target/shader.frag.glsl");
-    shaders["blur"] = create_shader_program("scenes/shared_assets/shaders/blur/shader.vert.glsl","scenes/shared_assets/shaders/blur/shader.frag.glsl");
-    shaders["fluid_box"] = create_shader_program("scenes/shared_assets/shaders/fluid_box/shader.vert.glsl","scenes/shared_assets/shaders/fluid_box/shader.frag.glsl");
-    shaders["deform_background"] = create_shader_program("scenes/shared_assets/shaders/deform_background/shader.vert.glsl","scenes/shared_assets/shaders/deform_background/shader.frag.glsl");
-
+    // All the programs are submitted before their status is checked, the linked binaries are cached between runs
+    vcl::shader_library library;
+    library.init(reinterpret_cast<GLADloadproc>(glfwGetProcAddress));
+
+    shaders["mesh"] = library.add("scenes/shared_assets/shaders/mesh/shader.vert.glsl","scenes/shared_assets/shaders/mesh/shader.frag.glsl");
+    shaders["mesh_bf"] = library.add("scenes/shared_assets/shaders/mesh_back_illumination/mesh.vert.glsl","scenes/shared_assets/shaders/mesh_back_illumination/mesh.frag.glsl");
+    shaders["wireframe"] = library.add("scenes/shared_assets/shaders/wireframe/shader.vert.glsl","scenes/shared_assets/shaders/wireframe/shader.geom.glsl","scenes/shared_assets/shaders/wireframe/shader.frag.glsl");
+    shaders["wireframe_quads"] = library.add("scenes/shared_assets/shaders/wireframe_quads/shader.vert.glsl","scenes/shared_assets/shaders/wireframe_quads/shader.geom.glsl","scenes/shared_assets/shaders/wireframe_quads/shader.frag.glsl");
+    shaders["curve"] = library.add("scenes/shared_assets/shaders/curve/shader.vert.glsl","scenes/shared_assets/shaders/curve/shader.frag.glsl");
+    shaders["segment_im"] = library.add("scenes/shared_assets/shaders/segment_immediate_mode/shader.vert.glsl","scenes/shared_assets/shaders/segment_immediate_mode/shader.frag.glsl");
+    shaders["normals"] = library.add("scenes/shared_assets/shaders/normals/shader.vert.glsl","scenes/shared_assets/shaders/normals/shader.geom.glsl","scenes/shared_assets/shaders/normals/shader.frag.glsl");
+    shaders["basic_fluid"] = library.add("scenes/shared_assets/shaders/basic_fluid/shader.vert.glsl","scenes/shared_assets/shaders/basic_fluid/shader.frag.glsl");
+    shaders["depth"] = library.add("scenes/shared_assets/shaders/depth/shader.vert.glsl","scenes/shared_assets/shaders/depth/shader.frag.glsl");
+    shaders["thickness"] = library.add("scenes/shared_assets/shaders/thickness/shader.vert.glsl","scenes/shared_assets/shaders/thickness/shader.frag.glsl");
+    shaders["render_target"] = library.add("scenes/shared_assets/shaders/render_target/shader.vert.glsl","scenes/shared_assets/shaders/render_target/shader.frag.glsl");
+    shaders["blur"] = library.add("scenes/shared_assets/shaders/blur/shader.vert.glsl","scenes/shared_assets/shaders/blur/shader.frag.glsl");
+    shaders["fluid_box"] = library.add("scenes/shared_assets/shaders/fluid_box/shader.vert.glsl","scenes/shared_assets/shaders/fluid_box/shader.frag.glsl");
+    shaders["deform_background"] = library.add("scenes/shared_assets/shaders/deform_background/shader.vert.glsl","scenes/shared_assets/shaders/deform_background/shader.frag.glsl");
+    library.finish();
 
     std::cout<<"\t [OK] Shader loaded"<<std::endl;
 }
@@ -90,7 +94,7 @@ void clear_screen()
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glClear(GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
+    set_depth_test(true);
 }
 
 void update_fps_title(GLFWwindow* window, const std::string& title, glfw_fps_counter& fps_counter)
@@ -120,3 +124,32 @@ void gui_start_basic_structure(gui_structure& gui, scene_structure& scene)
         draw(scene.frame_worldspace, scene.camera);
 
 }
+
+offscreen_target create_offscreen_target(int width, int height)
+{
+    offscreen_target target;
+    target.width = width;
+    target.height = height;
+
+    glGenRenderbuffers(1, &target.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target.fbo);
+    vcl::set_default_framebuffer(target.fbo);
+    vcl::bind_framebuffer(0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+    if( glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE )
+    {
+        std::cerr<<"Offscreen framebuffer is not complete"<<std::endl;
+        exit(1);
+    }
+    vcl::set_viewport(0, 0, width, height);
+
+    return target;
+}
@@ -19,13 +19,34 @@ struct gui_structure
 
     bool show_frame_camera     = true;
     bool show_frame_worldspace = false;
+
+    // Runtime OpenGL error reporting, set with --gl-debug off|async|sync
+    vcl::opengl_debug_level opengl_debug = vcl::opengl_debug_level::async;
+
+    // Headless run (--headless): hidden window, the frames are rendered into an offscreen_target
+    bool headless = false;
+    int window_width  = 1280;
+    int window_height = 1000;
+};
+
+// Framebuffer standing for the window one in headless runs
+struct offscreen_target
+{
+    GLuint fbo = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int width = 0;
+    int height = 0;
 };
 
 
-GLFWwindow* create_window(const std::string& window_title);
+GLFWwindow* create_window(const std::string& window_title, int width, int height, bool visible);
 void initialize_interface(gui_structure& gui);
 void load_shaders(std::map<std::string,GLuint>& shaders);
 void setup_scene(scene_structure &scene, gui_structure& gui, const std::map<std::string,GLuint>& shaders);
 void clear_screen();
 void update_fps_title(GLFWwindow* window, const std::string& title, vcl::glfw_fps_counter& fps_counter);
 void gui_start_basic_structure(gui_structure& gui, scene_structure& scene);
+
+// Create the target and make it the default framebuffer (vcl::set_default_framebuffer)
+offscreen_target create_offscreen_target(int width, int height);
@@ -36,18 +36,96 @@ void mouse_click_callback(GLFWwindow* window, int button, int action, int mods);
 void mouse_scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void keyboard_input_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
+void interactive_loop();
+void headless_loop(int nb_frames, const std::string& output, vcl::image_encoding format);
+
 // ************************************** //
 // Start program
 // ************************************** //
 
-int main()
+int main(int argc, char** argv)
 {
 
+    // Encoding time and size of the image formats: pgm --image-benchmark [width height]
+    if (argc > 1 && std::string(argv[1]) == "--image-benchmark") {
+        vcl::image_encoding_benchmark(argc > 3 ? unsigned(std::stoi(argv[2])) : 1280u, argc > 3 ? unsigned(std::stoi(argv[3])) : 1000u, 5);
+        return 0;
+    }
+
+#ifdef INCOMPRESSIBLE_SPH
+    // Headless parameter sweep of the SPH solver: pgm --sweep [specification] [results]
+    if (argc > 1 && std::string(argv[1]) == "--sweep")
+        return run_sph_sweep(argc > 2 ? argv[2] : "sweep.txt", argc > 3 ? argv[3] : "sweep_results.csv");
+    // Comparison of the OpenCL solver with the CPU reference: pgm --compare [steps] [list|tiled|grid]
+    if (argc > 1 && std::string(argv[1]) == "--compare")
+        return run_sph_compare(argc > 2 ? std::stoi(argv[2]) : 20, 5, argc > 3 ? argv[3] : "tiled");
+#endif
 
     // ************************************** //
     // Initialization and data setup
     // ************************************** //
 
+    // Options of the interactive and headless runs
+    //   --gl-debug off|async|sync   OpenGL error reporting
+    //   --headless [frames]         render frames (default 100) offscreen and exit
+    //   --size width height         size of the window or of the offscreen frames
+    //   --output prefix             headless frames written as prefix0000.png, prefix0001.png, ...
+    //   --format png_fast|png|png_parallel|qoi|ppm   image encoding of the headless frames (vcl::image_encoding)
+    //   --set name value            parameter of the scene (scene_model::set_parameter)
+    int headless_frames = 100;
+    std::string headless_output;
+    vcl::image_encoding headless_format = vcl::image_encoding::png_fast;
+    std::vector<std::pair<std::string,std::string>> scene_parameters;
+    for (int k = 1; k < argc; ++k)
+    {
+        const std::string option = argv[k];
+        if (option == "--gl-debug" && k + 1 < argc) {
+            const std::string level = argv[++k];
+            if (level == "off")
+                gui.opengl_debug = vcl::opengl_debug_level::off;
+            else if (level == "sync")
+                gui.opengl_debug = vcl::opengl_debug_level::sync;
+            else if (level == "async")
+                gui.opengl_debug = vcl::opengl_debug_level::async;
+            else {
+                std::cerr<<"Unknown --gl-debug level \""<<level<<"\" (expected off, async or sync)"<<std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--headless") {
+            gui.headless = true;
+            if (k + 1 < argc && argv[k+1][0] != '-')
+                headless_frames = std::stoi(argv[++k]);
+        }
+        else if (option == "--size" && k + 2 < argc) {
+            gui.window_width = std::stoi(argv[++k]);
+            gui.window_height = std::stoi(argv[++k]);
+        }
+        else if (option == "--output" && k + 1 < argc)
+            headless_output = argv[++k];
+        else if (option == "--format" && k + 1 < argc) {
+            const std::string format = argv[++k];
+            if (format == "png")
+                headless_format = vcl::image_encoding::png;
+            else if (format == "png_parallel")
+                headless_format = vcl::image_encoding::png_parallel;
+            else if (format == "qoi")
+                headless_format = vcl::image_encoding::qoi;
+            else if (format == "ppm")
+                headless_format = vcl::image_encoding::ppm;
+            else if (format == "png_fast")
+                headless_format = vcl::image_encoding::png_fast;
+            else {
+                std::cerr<<"Unknown --format \""<<format<<"\" (expected png_fast, png, png_parallel, qoi or ppm)"<<std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--set" && k + 2 < argc) {
+            scene_parameters.push_back({argv[k+1], argv[k+2]});
+            k += 2;
+        }
+    }
+
     // Initialize external libraries and window
     initialize_interface(gui);
 
@@ -61,33 +139,97 @@ int main()
     load_shaders(shaders);
     setup_scene(scene, gui, shaders);
 
+    // Before setup_data, so that the simulation is built with them
+    for (const auto& parameter : scene_parameters)
+    {
+        if (!scene_current.set_parameter(parameter.first, parameter.second))
+            std::cerr<<"Unknown scene parameter "<<parameter.first<<std::endl;
+    }
+
     opengl_debug();
     std::cout<<"*** Setup Data ***"<<std::endl;
     scene_current.setup_data(shaders, scene, gui);
     std::cout<<"\t [OK] Data setup"<<std::endl;
     opengl_debug();
 
+    if (gui.headless)
+        headless_loop(headless_frames, headless_output, headless_format);
+    else
+        interactive_loop();
 
-    // ************************************** //
-    // Animation loop
-    // ************************************** //
+    std::cout<<"*** Stop GLFW loop ***"<<std::endl;
 
+    // Cleanup ImGui and GLFW
+    vcl::imgui_cleanup();
+
+    glfwDestroyWindow(gui.window);
+    glfwTerminate();
 
+    return 0;
+}
 
+// Frames rendered into an offscreen framebuffer, without gui
+void headless_loop(int nb_frames, const std::string& output, vcl::image_encoding format)
+{
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(gui.window, &width, &height);
+    create_offscreen_target(width, height);
+    vcl::frame_capture capture;
+    capture.prefix = output;
+    capture.format = format;
+
+    std::cout<<"*** Render "<<nb_frames<<" frames ("<<width<<"x"<<height<<") ***"<<std::endl;
+    for (int frame = 0; frame < nb_frames; ++frame)
+    {
+        vcl::invalidate_gl_state();
+        vcl::bind_framebuffer(0);
+        vcl::set_viewport(0, 0, width, height);
+        clear_screen(); opengl_debug();
+        vcl::bind_texture(scene.texture_white);
+
+        // The scenes build their gui within frame_draw: the frame is created, but not rendered
+        gui_start_basic_structure(gui, scene);
+        vcl::publish_camera(scene.camera); opengl_debug();
+        scene_current.frame_draw(shaders, scene, gui); opengl_debug();
+        ImGui::End();
+        ImGui::EndFrame();
+
+        if (!output.empty()) {
+            vcl::bind_framebuffer(0);
+            capture.capture(width, height);
+        }
+        vcl::opengl_debug_end_frame();
+        vcl::default_frame_arena().reset();
+    }
+    capture.finish();
+}
+
+// ************************************** //
+// Animation loop
+// ************************************** //
+
+void interactive_loop()
+{
     std::cout<<"*** Start GLFW animation loop ***"<<std::endl;
     vcl::glfw_fps_counter fps_counter;
     while( !glfwWindowShouldClose(gui.window) )
     {
         opengl_debug();
 
+        // The gui of the previous frame has changed the OpenGL state behind the state cache
+        vcl::invalidate_gl_state();
+
         // Clear all color and zbuffer information before drawing on the screen
         clear_screen();opengl_debug();
         // Set a white image texture by default
-        glBindTexture(GL_TEXTURE_2D,scene.texture_white);
+        vcl::bind_texture(scene.texture_white);
 
         // Create the basic gui structure with ImGui
         gui_start_basic_structure(gui,scene);
 
+        // Camera matrices shared by all the shaders
+        vcl::publish_camera(scene.camera); opengl_debug();
+
         // Perform computation and draw calls for each iteration loop
         scene_current.frame_draw(shaders, scene, gui); opengl_debug();
 
@@ -99,25 +241,21 @@ int main()
 
         update_fps_title(gui.window, gui.window_title, fps_counter);
 
+        vcl::opengl_debug_end_frame();
+        vcl::default_frame_arena().reset();
         glfwSwapBuffers(gui.window);
         glfwPollEvents();
         opengl_debug();
 
     }
-    std::cout<<"*** Stop GLFW loop ***"<<std::endl;
-
-    // Cleanup ImGui and GLFW
-    vcl::imgui_cleanup();
-
-    glfwDestroyWindow(gui.window);
-    glfwTerminate();
-
-    return 0;
 }
 
-void window_size_callback(GLFWwindow* /*window*/, int width, int height)
+void window_size_callback(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    // The viewport is in pixels of the framebuffer, which differ from the window coordinates on high-DPI screens
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+    vcl::set_viewport(0, 0, framebuffer_width, framebuffer_height);
     scene.camera.perspective.image_aspect = width / static_cast<float>(height);;
 }
 
@@ -29,3 +29,8 @@ void scene_base::keyboard_input(scene_structure& , GLFWwindow* , int , int , int
 {
 
 }
+
+bool scene_base::set_parameter(const std::string& , const std::string& )
+{
+    return false;
+}
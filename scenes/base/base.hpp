@@ -27,6 +27,7 @@ struct scene_base
      * - mouse_move: called every time the user move the mouse
      * - mouse_scroll: called every time the user scroll the mouse
      * - keyboard_input: called every time a key is pressed/released on the keyboard
+     * - set_parameter: called before setup_data for each parameter given on the command line
      *
      * These functions receive the following parameters
      * - shaders: A set of shaders.
@@ -42,6 +43,9 @@ struct scene_base
     void mouse_move(scene_structure& scene, GLFWwindow* window);
     void mouse_scroll(scene_structure& scene, GLFWwindow* window, float x_offset, float y_offset);
     void keyboard_input(scene_structure& scene, GLFWwindow* window, int key, int scancode, int action, int mods);
+
+    // Set a parameter of the scene from the command line (--set name value), returns false if it is unknown
+    bool set_parameter(const std::string& name, const std::string& value);
 };
 
 
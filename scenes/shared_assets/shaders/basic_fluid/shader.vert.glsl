@@ -20,10 +20,13 @@ uniform mat3 rotation = mat3(1.0,0.0,0.0, 0.0,1.0,0.0, 0.0,0.0,1.0); // user def
 uniform float scaling = 1.0;                                         // user defined scaling
 uniform vec3 scaling_axis = vec3(1.0,1.0,1.0);                       // user defined scaling
 
-// view transform
-uniform mat4 view;
-// perspective matrix
-uniform mat4 perspective;
+// camera data, shared by all the shader programs (see vcl::publish_camera)
+layout(std140, row_major) uniform camera_data
+{
+    mat4 perspective;
+    mat4 view;
+    vec3 camera_position;
+};
 
 
 
@@ -1,6 +1,7 @@
 #version 330 core
 
-// Shader use: bilateral gaussian blur on input texture
+// Shader use: one direction of a separable narrow-range bilateral blur on input texture
+// (applied horizontally then vertically, possibly several times)
 
 in struct fragment_data
 {
@@ -12,31 +13,47 @@ in struct fragment_data
 
 uniform sampler2D depth_tex_sampler;
 uniform bool isThickness;
+uniform vec2 direction = vec2(1.0, 0.0); // (1,0): horizontal pass, (0,1): vertical pass
+uniform int radius = 4;                  // number of taps on each side
+uniform float iterations = 1.0;          // number of times the two passes are applied
 
 out vec4 FragColor;
 
-int samples = 5;
-vec2 offset;
-float gauss;
-float diff; //pixel intensity difference
 float s = 0.01; //standard deviation gaussian blur
 float r = isThickness ? 1.0 : 0.08; //standard deviation amplitude falloff
 
 void main()
 {
-    vec3 depth = texture(depth_tex_sampler, fragment.texture_uv).xyz;
-    vec3 depth_color = vec3(0.0);
-    float sum = 0.0;
-    for(int i = 0; i < samples; i++){
-      for(int j = 0; j < samples; j++){
-        offset = vec2(i/(samples - 1.0) - 0.5, j/(samples - 1.0) - 0.5) * (isThickness ? 0.025 : 0.012 * (1.0-depth.x));
-        diff = length(texture(depth_tex_sampler, fragment.texture_uv + offset).xyz - depth);
-        gauss = exp(-(dot(offset, offset))/(2*s*s) - (diff * diff)/(2*r*r)) / (2*3.14 * s * r);
-        sum += gauss;
-        depth_color += texture(depth_tex_sampler, fragment.texture_uv + offset).xyz * gauss;
+    float depth = texture(depth_tex_sampler, fragment.texture_uv).x;
+    if(!isThickness && depth == 1.0){
+      FragColor = vec4(vec3(1.0), 1.0);
+      return;
+    }
+
+    // Same extent as the former 5x5 kernel, shrinking with the view depth for the fluid depth.
+    // The iterations compose, so each one covers 1/sqrt(iterations) of it.
+    float extent = (isThickness ? 0.025 : 0.012 * (1.0-depth)) / sqrt(iterations);
+    float sigma = s / sqrt(iterations);
+    vec2 tap_step = direction * extent / (2.0 * float(radius));
+
+    float sum = 1.0;
+    float depth_color = depth;
+    for(int i = -radius; i <= radius; i++){
+      if(i == 0)
+        continue;
+      vec2 offset = float(i) * tap_step;
+      float value = texture(depth_tex_sampler, fragment.texture_uv + offset).x;
+      if(!isThickness){
+        if(value == 1.0)
+          continue; // background
+        value = clamp(value, depth - 2.0*r, depth + 2.0*r); // narrow range: far taps are clamped, not averaged
       }
+      float diff = value - depth;
+      float gauss = exp(-dot(offset, offset)/(2*sigma*sigma) - (diff * diff)/(2*r*r));
+      sum += gauss;
+      depth_color += value * gauss;
     }
     depth_color /= sum;
 
-    FragColor = vec4(depth.x == 1.0 ? vec3(1.0) : vec3(depth_color), 1.0);
+    FragColor = vec4(vec3(depth_color), 1.0);
 }
@@ -16,10 +16,14 @@ uniform sampler2D depth_tex;
 
 out vec4 FragColor;
 
-uniform vec3 camera_position;
+// camera data, shared by all the shader programs (see vcl::publish_camera)
+layout(std140, row_major) uniform camera_data
+{
+    mat4 perspective;
+    mat4 view;
+    vec3 camera_position;
+};
 uniform mat3 rotation;
-uniform mat4 view;
-uniform mat4 perspective;
 
 vec3 light = vec3(0.0, 0.0, 1.0); //vec3(0.0, 0.0, -2.0);
 
@@ -9,11 +9,16 @@ in struct fragment_data
 } fragment;
 
 uniform sampler2D texture_sampler;
-uniform mat4 view;
+// camera data, shared by all the shader programs (see vcl::publish_camera)
+layout(std140, row_major) uniform camera_data
+{
+    mat4 perspective;
+    mat4 view;
+    vec3 camera_position;
+};
 
 out vec4 FragColor;
 
-uniform vec3 camera_position;
 uniform vec3 color     = vec3(1.0, 1.0, 1.0);
 uniform float color_alpha = 1.0;
 uniform float ambiant  = 0.2;
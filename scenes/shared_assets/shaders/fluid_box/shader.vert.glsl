@@ -21,10 +21,13 @@ uniform float scaling = 1.0;                                         // user def
 uniform vec3 scaling_axis = vec3(1.0,1.0,1.0);                       // user defined scaling
 
 
-// view transform
-uniform mat4 view;
-// perspective matrix
-uniform mat4 perspective;
+// camera data, shared by all the shader programs (see vcl::publish_camera)
+layout(std140, row_major) uniform camera_data
+{
+    mat4 perspective;
+    mat4 view;
+    vec3 camera_position;
+};
 
 
 
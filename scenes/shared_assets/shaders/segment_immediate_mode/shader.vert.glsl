@@ -4,10 +4,13 @@
 
 layout (location = 0) in vec4 u; //expect value in ([0,1],0,0)
 
-// view transform
-uniform mat4 view;
-// perspective matrix
-uniform mat4 perspective;
+// camera data, shared by all the shader programs (see vcl::publish_camera)
+layout(std140, row_major) uniform camera_data
+{
+    mat4 perspective;
+    mat4 view;
+    vec3 camera_position;
+};
 
 // Extremities of the segment
 uniform vec3 p1 = vec3(0.0, 0.0, 0.0);
@@ -12,16 +12,18 @@ in struct fragment_data
 
 out vec4 FragColor;
 
-uniform vec3 camera_position;
+// camera data, shared by all the shader programs (see vcl::publish_camera)
+layout(std140, row_major) uniform camera_data
+{
+    mat4 perspective;
+    mat4 view;
+    vec3 camera_position;
+};
 uniform float radius;
 
 // model transformation
 uniform mat3 rotation = mat3(1.0,0.0,0.0, 0.0,1.0,0.0, 0.0,0.0,1.0); // user defined rotation
 
-// view transform
-uniform mat4 view;
-// perspective matrix
-uniform mat4 perspective;
 
 float near = 3.0;
 float far  = 10.0;
@@ -4,111 +4,147 @@
 #include <unordered_map>
 #include <cmath>
 #include <algorithm>
+#include <cstdio>
 
 #ifdef INCOMPRESSIBLE_SPH
 using namespace vcl;
 
-// Counter used to save image on hard drive
-int counter_image = 0;
-
 void scene_model::initialize_sph()
 {
-    std::default_random_engine generator;
-    std::normal_distribution<float> normal(0,1);
+    // Mass of a particle at rest on a lattice of spacing h, unless set on the command line
+    if (sph_param.m <= 0.0f)
+        sph_param.m = sph_param.rho0*sph_param.h*sph_param.h*sph_param.h;
+    particles.resize(sph_param.nb_particles);
+
+    // Without the profiler, the queue runs without profiling (see frame_draw)
+    oclHelper.profiling = profiler.enabled;
+    oclHelper.profiler = profiler.enabled ? &profiler : NULL;
+    oclHelper.init_context(sph_param);
 
-    sph_param.m = sph_param.rho0*sph_param.h*sph_param.h*sph_param.h;
+    // Water column against the x=-1 wall, filled at rest directly on the device
+    const float wall = -1.0f + 0.3f*sph_param.h;
+    const int nb_filled = oclHelper.fill_box(sph_param, {wall, wall, wall}, {-0.2f, -wall, -wall}, 0, sph_param.nb_particles);
+    if (nb_filled < sph_param.nb_particles) {
+        // The other particles are not initialised: they are dropped
+        std::cerr << "Initial water column too small: " << nb_filled << " particles out of " << sph_param.nb_particles << std::endl;
+        sph_param.nb_particles = nb_filled;
+        oclHelper.truncate_particles(sph_param, nb_filled);
+        particles.resize(oclHelper.nb_particles);
+    }
 
-    for (size_t i = 0; i < sph_param.nb_particles; i++)
+    const std::vector<vec3> p_gpu = oclHelper.get_p();
+    for (size_t i = 0; i < particles.size(); i++)
     {
-       vec3 v = {normal(generator), normal(generator), normal(generator)};
-       particle_element particle;
-       particle.p = 0.3*v;
-       particles.push_back(particle);
+        particles[i].p = p_gpu[i];
     }
+}
 
-    oclHelper.init_context(sph_param);
+void scene_model::simulation_step(scene_structure& scene)
+{
+    // Force constant time step
+    size_t solverIterations = 5;
+    auto last_time = std::chrono::high_resolution_clock::now();
+
+    // Setting gravity direction depending on option
+    if(gui_param.world_space_gravity){
+      sph_param.gx = (scene.camera.orientation*vec3(0.0f, -100.0*sph_param.h, 0.0f)).x;
+      sph_param.gy = (scene.camera.orientation*vec3(0.0f, -100.0*sph_param.h, 0.0f)).y;
+      sph_param.gz = (scene.camera.orientation*vec3(0.0f, -100.0*sph_param.h, 0.0f)).z;
+      oclHelper.set_sph_param(sph_param);
+    }else{
+      sph_param.gx = (vec3(0.0f, -100.0*sph_param.h, 0.0f)).x;
+      sph_param.gy = (vec3(0.0f, -100.0*sph_param.h, 0.0f)).y;
+      sph_param.gz = (vec3(0.0f, -100.0*sph_param.h, 0.0f)).z;
+      oclHelper.set_sph_param(sph_param);
+    }
 
-    std::vector<vec3> v;
-    for (auto &part : particles)
-    {
-        v.push_back(part.v);
+    // Update position and velocity
+    oclHelper.befor_solver();
+
+    auto current_time = std::chrono::high_resolution_clock::now();
+    pre_solver_time = alpha_time*pre_solver_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
+    last_time = current_time;
+
+    // Find particle neighbors
+    oclHelper.make_neighboors();
+    size_t k=0;
+
+    current_time = std::chrono::high_resolution_clock::now();
+    neighboors_time = alpha_time*neighboors_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
+    last_time = current_time;
+
+    // Iteration loop adding constraints
+    while(k<solverIterations){
+      oclHelper.solver_step();
+      ++k;
     }
-    std::vector<vec3> positions;
-    for (auto &part : particles)
+
+    current_time = std::chrono::high_resolution_clock::now();
+    solver_time = alpha_time*solver_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
+    last_time = current_time;
+
+    // Re-update speed (apply vorticity and viscosity)
+    oclHelper.update_speed();
+    if (oclHelper.sleeping) {
+        oclHelper.update_sleeping();
+    }
+
+    // Merge the interior particles and split the ones close to the surface every few frames
+    if ((oclHelper.adaptive_resolution || oclHelper.nb_merged > 0) && count % 10 == 0) {
+        oclHelper.adapt_resolution(sph_param, scene.camera.camera_position());
+        particles.resize(oclHelper.nb_particles);
+    }
+
+    std::vector<vcl::vec3> p_gpu = oclHelper.get_p();
+    for (size_t i = 0; i < particles.size(); i++)
     {
-        positions.push_back(part.p);
+        particles[i].p = p_gpu[i];
     }
-    oclHelper.set_p_v(positions,v);
+    current_time = std::chrono::high_resolution_clock::now();
+    post_solver_time = alpha_time*post_solver_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
+    last_time = current_time;
+
+    oclHelper.log_pressure();
 }
 
 void scene_model::frame_draw(std::map<std::string,GLuint>& shaders, scene_structure& scene, gui_structure& gui)
 {
     auto start_func = std::chrono::high_resolution_clock::now();
+    // The kernel events are only recorded while the profiler records
+    if (profiler.enabled != oclHelper.profiling) {
+        oclHelper.set_profiler(profiler.enabled ? &profiler : NULL);
+    }
+    profiler.begin_frame();
     count++;
     if (count > 50) {
+        sph_profiler::scope simulation_scope(profiler, "simulation");
         set_gui();
 
-        // Force constant time step
-        size_t solverIterations = 5;
-        auto last_time = std::chrono::high_resolution_clock::now();
-
-        // Setting gravity direction depending on option
-        if(gui_param.world_space_gravity){
-          sph_param.gx = (scene.camera.orientation*vec3(0.0f, -100.0*sph_param.h, 0.0f)).x;
-          sph_param.gy = (scene.camera.orientation*vec3(0.0f, -100.0*sph_param.h, 0.0f)).y;
-          sph_param.gz = (scene.camera.orientation*vec3(0.0f, -100.0*sph_param.h, 0.0f)).z;
-          oclHelper.set_sph_param(sph_param);
-        }else{
-          sph_param.gx = (vec3(0.0f, -100.0*sph_param.h, 0.0f)).x;
-          sph_param.gy = (vec3(0.0f, -100.0*sph_param.h, 0.0f)).y;
-          sph_param.gz = (vec3(0.0f, -100.0*sph_param.h, 0.0f)).z;
-          oclHelper.set_sph_param(sph_param);
-        }
-
-        // Update position and velocity
-        oclHelper.befor_solver();
-
-        auto current_time = std::chrono::high_resolution_clock::now();
-        pre_solver_time = alpha_time*pre_solver_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
-        last_time = current_time;
-
-        // Find particle neighbors
-        oclHelper.make_neighboors();
-        size_t k=0;
-
-        current_time = std::chrono::high_resolution_clock::now();
-        neighboors_time = alpha_time*neighboors_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
-        last_time = current_time;
-
-        // Iteration loop adding constraints
-        while(k<solverIterations){
-          oclHelper.solver_step();
-          ++k;
-        }
-
-        current_time = std::chrono::high_resolution_clock::now();
-        solver_time = alpha_time*solver_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
-        last_time = current_time;
-
-        // Re-update speed (apply vorticity and viscosity)
-        oclHelper.update_speed();
-
-        std::vector<vcl::vec3> p_gpu = oclHelper.get_p();
-        for (size_t i = 0; i < particles.size(); i++)
-        {
-            particles[i].p = p_gpu[i];
+        // The neighbor modes benchmark runs a few steps per frame in place of the simulation, so the gui stays responsive
+        if (!oclHelper.neighbor_benchmark_step(5)) {
+            simulation_step(scene);
         }
-        current_time = std::chrono::high_resolution_clock::now();
-        post_solver_time = alpha_time*post_solver_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(current_time-last_time).count();
-        last_time = current_time;
-
-        oclHelper.log_pressure();
     }
 
     // Render the fluid
     auto befor_display = std::chrono::high_resolution_clock::now();
-    display(shaders, scene, gui);
+    {
+        sph_profiler::scope display_scope(profiler, "display");
+        display(shaders, scene, gui);
+    }
     auto after_dislplay = std::chrono::high_resolution_clock::now();
+
+    // Record the frame without the gui, the images are written one or two frames later by the encoder threads
+    if (gui_param.save_field) {
+        sph_profiler::scope capture_scope(profiler, "capture");
+        bind_render_target(0, false);
+        capture.capture(screen_width, screen_height);
+        capturing = true;
+    }
+    else if (capturing) {
+        capture.finish();
+        capturing = false;
+    }
     render_time = alpha_time*render_time + (1-alpha_time)*std::chrono::duration_cast<std::chrono::milliseconds>(after_dislplay-befor_display).count();
 
     auto end_func = std::chrono::high_resolution_clock::now();
@@ -117,6 +153,7 @@ void scene_model::frame_draw(std::map<std::string,GLuint>& shaders, scene_struct
     if (! ((count + 1) % 100)) {
         std::cout << "pre solver time: " << pre_solver_time << std::endl;
         std::cout << "neigbors time: " << neighboors_time << std::endl;
+        std::cout << "neigbors mode: " << (oclHelper.grid_neighbors ? "grid" : "list") << std::endl;
         std::cout << "neigbors sub times: " << oclHelper.nn1_time << " " << oclHelper.nn2_time << " " << oclHelper.nn3_time << std::endl;
         std::cout << "solver time: " << solver_time << std::endl;
         std::cout << "post solver time: " << post_solver_time << std::endl;
@@ -124,6 +161,15 @@ void scene_model::frame_draw(std::map<std::string,GLuint>& shaders, scene_struct
         std::cout << "total time: " << total_time << std::endl;
         std::cout << std::endl;
     }
+
+    // The kernel timestamps are read once the queue is done
+    if (profiler.enabled) {
+        clFinish(oclHelper.command_queue);
+    }
+    profiler.end_frame();
+    if (show_profiler) {
+        profiler.draw_gui();
+    }
 }
 
 void scene_model::setup_data(std::map<std::string,GLuint>& shaders, scene_structure& scene, gui_structure& gui)
@@ -146,19 +192,13 @@ void scene_model::setup_data(std::map<std::string,GLuint>& shaders, scene_struct
 
     initialize_sph();
 
-    gui_param.display_field = true;
-    gui_param.display_particles = true;
-    gui_param.save_field = false;
-    gui_param.world_space_gravity = false;
-    gui_param.advanced_shading = false;
-    gui_param.more_advanced_shading = false;
+    surface.drawable.uniform.color = {0.3f, 0.5f, 0.9f};
+    capture.prefix = "sph_frame_";
 
-    //Initializing render target framebuffers
-    oglHelper.initializeFBO(dfbo, true);
-    oglHelper.initializeFBO(rfbo, true);
-    oglHelper.initializeFBO(sdfbo, true);
-    oglHelper.initializeFBO(srfbo, true);
-    oglHelper.initializeFBO(bgfbo, false);
+    //Initializing render target framebuffers at the size of the window
+    int width, height;
+    glfwGetFramebufferSize(gui.window, &width, &height);
+    update_render_targets(width, height);
 
     //Set the texture to be shown on screen
     screenquad = mesh_drawable( mesh_primitive_quad(vec3(-1,-1,0),vec3(1,-1,0),vec3(1,1,0),vec3(-1,1,0)));
@@ -168,7 +208,16 @@ void scene_model::setup_data(std::map<std::string,GLuint>& shaders, scene_struct
 // Render fluid
 void scene_model::display(std::map<std::string,GLuint>& shaders, scene_structure& scene, gui_structure& gui)
 {
-    if(!gui_param.advanced_shading){
+    // Follow the size of the window and the resolution chosen in the gui
+    int width, height;
+    glfwGetFramebufferSize(gui.window, &width, &height);
+    if(width != screen_width || height != screen_height || resolution_level != targets_level){
+      update_render_targets(width, height);
+    }
+
+    if(gui_param.surface_mesh){
+      render_surface(shaders["mesh"], scene);
+    }else if(!gui_param.advanced_shading){
       gui_param.more_advanced_shading = false;
       basic_render(shaders["basic_fluid"], scene);
     }else if(gui_param.advanced_shading && !gui_param.more_advanced_shading){
@@ -203,27 +252,61 @@ void scene_model::display(std::map<std::string,GLuint>& shaders, scene_structure
     }
 }
 
+// (Re)create the render targets for a framebuffer of size width x height
+void scene_model::update_render_targets(int width, int height){
+  if(width <= 0 || height <= 0){
+    return; // minimized window
+  }
+  screen_width = width;
+  screen_height = height;
+  reduced_width = std::max(width >> resolution_level, 1);
+  reduced_height = std::max(height >> resolution_level, 1);
+  targets_level = resolution_level;
+
+  oglHelper.deleteFBO(dfbo);
+  oglHelper.deleteFBO(rfbo);
+  oglHelper.deleteFBO(sdfbo);
+  oglHelper.deleteFBO(srfbo);
+  oglHelper.deleteFBO(bgfbo);
+  oglHelper.deleteFBO(tmpfbo);
+  oglHelper.initializeFBO(dfbo, GL_R32F, screen_width, screen_height, true);
+  oglHelper.initializeFBO(rfbo, GL_R16F, reduced_width, reduced_height, false);
+  oglHelper.initializeFBO(sdfbo, GL_R32F, reduced_width, reduced_height, false);
+  oglHelper.initializeFBO(srfbo, GL_R16F, reduced_width, reduced_height, false);
+  oglHelper.initializeFBO(bgfbo, GL_RGB8, screen_width, screen_height, true);
+  oglHelper.initializeFBO(tmpfbo, GL_R32F, reduced_width, reduced_height, false);
+}
+
+// Bind a render target (0 for the window) and set the viewport to its size
+void scene_model::bind_render_target(GLuint id, bool reduced){
+  bind_framebuffer(id);
+  if(reduced){
+    set_viewport(0, 0, reduced_width, reduced_height);
+  }else{
+    set_viewport(0, 0, screen_width, screen_height);
+  }
+}
+
 // Handles the rendering of the cube's edges when Advanced shading option on
 void scene_model::render_cube(GLuint shader, GLuint id, scene_structure& scene, bool isBack, bool isChecker){
+  sph_profiler::scope profile_scope(profiler, "render: cube");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: cube");
   const float pi = 3.14159265f;
-  glUseProgram(shader);
+  use_program(shader);
   uniform(shader, "isBack", isBack); //opengl_debug();
   uniform(shader, "isChecker", isChecker); //opengl_debug();
   uniform(shader, "scaling", 2.0f);
-  uniform(shader,"perspective",scene.camera.perspective.matrix()); //opengl_debug();
-  uniform(shader,"view",scene.camera.view_matrix()); opengl_debug();
-  uniform(shader,"camera_position",scene.camera.camera_position()); //opengl_debug();
-  glBindVertexArray(cube.data.vao); //opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube.data.vbo_index); //opengl_debug();
-  glBindFramebuffer(GL_FRAMEBUFFER, id);
+  publish_camera(scene.camera); //opengl_debug();
+  bind_vertex_array(cube.data.vao); //opengl_debug();
+  bind_render_target(id, false);
   glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
   glClearDepth(1.0);
   if(isBack){
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   }
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glEnable(GL_DEPTH_TEST);
+  set_blend(true);
+  set_blend_function(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  set_depth_test(true);
   uniform(shader, "translation", {1, 0, 0});
   uniform(shader, "rotation", rotation_from_axis_angle_mat3({0, 1, 0}, pi/2.0f));
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug();
@@ -242,161 +325,182 @@ void scene_model::render_cube(GLuint shader, GLuint id, scene_structure& scene,
   uniform(shader, "translation", vec3(0, 0, -1));
   uniform(shader, "rotation", rotation_from_axis_angle_mat3({0, 1, 0}, pi));
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug();
-  glBindTexture(GL_TEXTURE_2D, 0);
-  glDisable(GL_DEPTH_TEST);
-  glDisable(GL_BLEND);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); //opengl_debug();
-  glBindVertexArray(0);
+  set_depth_test(false);
+  set_blend(false);
+  bind_render_target(0, false);
 }
 
 // Draw deformed background to screen
 void scene_model::draw_deformed_background(GLuint shader, scene_structure& scene){
-  glUseProgram(shader);
-  glUniform1i(glGetUniformLocation(shader, "thickness_tex"), 0);
-  glUniform1i(glGetUniformLocation(shader, "background_tex"), 1);
-  glUniform1i(glGetUniformLocation(shader, "depth_tex"), 2);
-  glActiveTexture(GL_TEXTURE0 + 0); // Texture unit 0
-  glBindTexture(GL_TEXTURE_2D, srfbo[1]);
-  glActiveTexture(GL_TEXTURE0 + 1); // Texture unit 1
-  glBindTexture(GL_TEXTURE_2D, bgfbo[1]);
-  glActiveTexture(GL_TEXTURE0 + 2); // Texture unit 2
-  glBindTexture(GL_TEXTURE_2D, sdfbo[1]);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glBindVertexArray(screenquad.data.vao); opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, screenquad.data.vbo_index); opengl_debug();
+  sph_profiler::scope profile_scope(profiler, "render: background refraction");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: background refraction");
+  use_program(shader);
+  uniform(shader, "thickness_tex", 0);
+  uniform(shader, "background_tex", 1);
+  uniform(shader, "depth_tex", 2);
+  bind_texture(srfbo[1], 0);
+  bind_texture(bgfbo[1], 1);
+  bind_texture(sdfbo[1], 2);
+  set_blend(true);
+  set_blend_function(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  bind_vertex_array(screenquad.data.vao); opengl_debug();
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); opengl_debug();
-  glBindVertexArray(0);
-  glDisable(GL_BLEND);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  set_blend(false);
 }
 
 // Basic render
 void scene_model::basic_render(GLuint shader, scene_structure& scene){
+  sph_profiler::scope profile_scope(profiler, "render: basic render");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: basic render");
   glClearDepth(1.0);
   glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   draw(borders, scene.camera);
-  glUseProgram(shader);
+  use_program(shader);
   uniform(shader, "rotation", scene.camera.orientation); opengl_debug();
   uniform(shader, "scaling", sph_param.h * 2 / 3); opengl_debug();
-  uniform(shader,"perspective",scene.camera.perspective.matrix()); opengl_debug();
-  uniform(shader,"view",scene.camera.view_matrix()); opengl_debug();
-  uniform(shader,"camera_position",scene.camera.camera_position()); opengl_debug();
+  publish_camera(scene.camera); opengl_debug();
   uniform(shader,"radius",sph_param.h); opengl_debug();
-  glBindVertexArray(billboard.data.vao); opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, billboard.data.vbo_index); opengl_debug();
-  glBindFramebuffer(GL_FRAMEBUFFER, 0); opengl_debug();
-  glEnable(GL_DEPTH_TEST); opengl_debug();
-  glDepthFunc(GL_LESS); opengl_debug();
+  bind_vertex_array(billboard.data.vao); opengl_debug();
+  bind_framebuffer(0); opengl_debug();
+  set_depth_test(true); opengl_debug();
+  set_depth_function(GL_LESS); opengl_debug();
+  const uniform_id translation(shader, "translation");
   for(size_t k=0; k<particles.size(); ++k) {
-    uniform(shader, "translation", particles[k].p); opengl_debug();
+    uniform(translation, particles[k].p); opengl_debug();
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); opengl_debug();
   }
-  glDepthFunc(GL_LESS);
-  glDisable(GL_DEPTH_TEST);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); opengl_debug();
-  glBindVertexArray(0);
+  set_depth_function(GL_LESS);
+  set_depth_test(false);
 }
 
 // Draw particle's depth/reverse depth to buffer fbo
 void scene_model::draw_depth_buffer(GLuint shader, GLuint fbo[3], scene_structure& scene){
-  glUseProgram(shader);
+  sph_profiler::scope profile_scope(profiler, "render: depth");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: depth");
+  use_program(shader);
   uniform(shader, "rotation", scene.camera.orientation); //opengl_debug();
   uniform(shader, "scaling", sph_param.h); //opengl_debug();
-  uniform(shader,"perspective",scene.camera.perspective.matrix()); //opengl_debug();
-  uniform(shader,"view",scene.camera.view_matrix()); //opengl_debug();
-  uniform(shader,"camera_position",scene.camera.camera_position()); //opengl_debug();
+  publish_camera(scene.camera); //opengl_debug();
   uniform(shader,"radius",sph_param.h); //opengl_debug();
-  glBindVertexArray(billboard.data.vao); //opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, billboard.data.vbo_index); //opengl_debug();
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+  bind_vertex_array(billboard.data.vao); //opengl_debug();
+  bind_render_target(fbo[0], false);
   glClearDepth(1.0f);
   glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glEnable(GL_DEPTH_TEST);
-  glDepthFunc(GL_LESS);
+  set_depth_test(true);
+  set_depth_function(GL_LESS);
+  const uniform_id translation(shader, "translation");
   for(size_t k=0; k<particles.size(); ++k) {
-    uniform(shader, "translation", particles[k].p); //opengl_debug();
+    uniform(translation, particles[k].p); //opengl_debug();
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug();
   }
-  glDepthFunc(GL_LESS);
-  glDisable(GL_DEPTH_TEST);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); //opengl_debug();
-  glBindVertexArray(0);
+  set_depth_function(GL_LESS);
+  set_depth_test(false);
+  bind_render_target(0, false);
 }
 
 void scene_model::draw_thickness_buffer(GLuint shader, GLuint fbo[3], scene_structure& scene){
-  glUseProgram(shader);
+  sph_profiler::scope profile_scope(profiler, "render: thickness");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: thickness");
+  use_program(shader);
   uniform(shader, "rotation", scene.camera.orientation); //opengl_debug();
   uniform(shader, "scaling", sph_param.h); //opengl_debug();
-  uniform(shader,"perspective",scene.camera.perspective.matrix()); //opengl_debug();
-  uniform(shader,"view",scene.camera.view_matrix()); //opengl_debug();
-  uniform(shader,"camera_position",scene.camera.camera_position()); //opengl_debug();
+  publish_camera(scene.camera); //opengl_debug();
   uniform(shader,"radius",sph_param.h); //opengl_debug();
-  glBindVertexArray(billboard.data.vao); //opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, billboard.data.vbo_index); //opengl_debug();
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+  bind_vertex_array(billboard.data.vao); //opengl_debug();
+  bind_render_target(fbo[0], true);
   glClearDepth(1.0f);
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  set_blend(true);
+  set_blend_function(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  const uniform_id translation(shader, "translation");
   for(size_t k=0; k<particles.size(); ++k) {
-    uniform(shader, "translation", particles[k].p); //opengl_debug();
+    uniform(translation, particles[k].p); //opengl_debug();
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug();
   }
-  glDisable(GL_BLEND);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); //opengl_debug();
-  glBindVertexArray(0);
+  set_blend(false);
+  bind_render_target(0, false);
 }
 
-// Blur source buffer and render to target buffer (bilateral gaussian blur)
+// Blur source buffer and render to target buffer (separable narrow-range bilateral blur)
+// Each iteration is a horizontal pass to tmpfbo and a vertical pass to target
 void scene_model::draw_blur_buffer(GLuint shader, GLuint source[3], GLuint target[3], mesh_drawable quad, bool isThickness){
-  glUseProgram(shader);
+  sph_profiler::scope profile_scope(profiler, "render: blur");
+  use_program(shader);
   uniform(shader, "isThickness", isThickness); //opengl_debug();
-  glBindVertexArray(quad.data.vao); //opengl_debug();
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad.data.vbo_index); //opengl_debug();
-
-  glBindFramebuffer(GL_FRAMEBUFFER, target[0]); //drawing to render target sdfbo
-  glUniform1i(glGetUniformLocation(shader, "depth_tex_sampler"), 1);
-  glActiveTexture(GL_TEXTURE0 + 1); // Texture unit 0
-  glBindTexture(GL_TEXTURE_2D, source[1]); //sending dfbo[1] as uniform sampler2D to shader
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug(); //draw quad to render target
-  glDisable(GL_BLEND);
-
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); //opengl_debug();
-  glBindVertexArray(0);
+  uniform(shader, "radius", blur_radius); //opengl_debug();
+  uniform(shader, "iterations", float(blur_iterations)); //opengl_debug();
+  bind_vertex_array(quad.data.vao); //opengl_debug();
+  uniform(shader, "depth_tex_sampler", 1);
+
+  for(int k=0; k<blur_iterations; ++k) {
+    const size_t horizontal = profiler.gpu.begin("render: blur horizontal");
+    bind_render_target(tmpfbo[0], true);
+    bind_texture(k==0 ? source[1] : target[1], 1);
+    uniform(shader, "direction", vec2(1.0f, 0.0f));
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug(); //draw quad to render target
+    profiler.gpu.end(horizontal);
+
+    const size_t vertical = profiler.gpu.begin("render: blur vertical");
+    bind_render_target(target[0], true);
+    bind_texture(tmpfbo[1], 1);
+    uniform(shader, "direction", vec2(0.0f, 1.0f));
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr); //opengl_debug();
+    profiler.gpu.end(vertical);
+  }
+
+  bind_render_target(0, false);
 }
 
 // Render result to screen
 void scene_model::render_to_screen(scene_structure& scene){
+  sph_profiler::scope profile_scope(profiler, "render: composite");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: composite");
   //draw(borders, scene.camera);
   GLuint shader = screenquad.shader; // = shaders['render target']
-  glUseProgram(shader);
+  use_program(shader);
   uniform(shader, "rotation", scene.camera.orientation); //opengl_debug();
-  uniform(shader, "view", scene.camera.view_matrix()); //opengl_debug();
-  uniform(shader,"perspective",scene.camera.perspective.matrix()); //opengl_debug();
-  uniform(shader,"camera_position",scene.camera.camera_position()); //opengl_debug();
-  glUniform1i(glGetUniformLocation(shader, "depth_tex_sampler"), 1);
-  glUniform1i(glGetUniformLocation(shader, "rev_depth_tex_sampler"), 2);
-  glActiveTexture(GL_TEXTURE0 + 1); // Texture unit 0
-  glBindTexture(GL_TEXTURE_2D, sdfbo[1]);
-  glActiveTexture(GL_TEXTURE0 + 2); // Texture unit 1
-  glBindTexture(GL_TEXTURE_2D, srfbo[1]);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  publish_camera(scene.camera); //opengl_debug();
+  uniform(shader, "depth_tex_sampler", 1);
+  uniform(shader, "rev_depth_tex_sampler", 2);
+  bind_texture(sdfbo[1], 1);
+  bind_texture(srfbo[1], 2);
+  set_blend(true);
+  set_blend_function(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   draw(screenquad, scene.camera);
-  glDisable(GL_BLEND);
+  set_blend(false);
   //draw(borders, scene.camera);
-  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Surface mesh render
+void scene_model::render_surface(GLuint shader, scene_structure& scene){
+  sph_profiler::scope profile_scope(profiler, "render: surface");
+  timer_gpu::scope gpu_scope(profiler.gpu, "render: surface");
+  glClearDepth(1.0);
+  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  set_depth_test(true);
+  draw(borders, scene.camera);
+
+  std::vector<vec3> p(particles.size());
+  for (size_t i = 0; i < particles.size(); i++)
+  {
+    p[i] = particles[i].p;
+  }
+  surface.cell_size = 0.5f*sph_param.h;
+  surface.extract(p, sph_param);
+  surface.update_drawable(shader);
+  if(surface.drawable.data.number_triangles > 0){
+    draw(surface.drawable, scene.camera);
+  }
+
+  if(gui_param.export_surface){
+    char filename[64];
+    std::snprintf(filename, sizeof(filename), "surface_%04d.obj", surface_export_count++);
+    surface.export_obj(filename);
+  }
 }
 
 void scene_model::set_gui()
@@ -410,11 +514,69 @@ void scene_model::set_gui()
     float c_min = 0.05f, c_max = 0.5f;
     ImGui::SliderScalar("viscuosity", ImGuiDataType_Float, &sph_param.c, &c_min, &c_max, "%.3f");
 
+    if (oclHelper.tiled_neighbors_available) {
+        ImGui::Checkbox("Tiled neighbor search", &oclHelper.tiled_neighbors);
+    }
+    if (oclHelper.allocate_neighbor_list) {
+        ImGui::Checkbox("Neighbor-list-free solver", &oclHelper.grid_neighbors);
+    }
+    if (oclHelper.neighbor_benchmark_running()) {
+        ImGui::Text("Benchmark: %s, step %d / %d", oclHelper.grid_neighbors ? "grid" : "list", int(oclHelper.neighbor_benchmark.nb_done), int(oclHelper.neighbor_benchmark.nb_steps));
+    } else if (ImGui::Button("Benchmark neighbor modes")) {
+        oclHelper.begin_neighbor_benchmark(100, 5);
+    }
+    ImGui::Checkbox("Adaptive resolution", &oclHelper.adaptive_resolution);
+    if (oclHelper.adaptive_resolution) {
+        ImGui::Text("Active particles: %d (%d merged)", oclHelper.nb_particles, oclHelper.nb_merged);
+    }
+    if (ImGui::Checkbox("Sleeping regions", &oclHelper.sleeping) && !oclHelper.sleeping) {
+        oclHelper.wake_all();
+    }
+    if (oclHelper.sleeping) {
+        ImGui::Text("Awake particles: %d / %d", oclHelper.nb_active, oclHelper.nb_particles);
+    }
+    if (ImGui::Checkbox("Profiler", &show_profiler)) {
+        profiler.enabled = show_profiler;
+    }
+    ImGui::Checkbox("Record frames", &gui_param.save_field);
+    if(gui_param.save_field){
+      ImGui::Text("Frames recorded: %d", int(capture.frame_count()));
+    }
+    ImGui::Checkbox("Surface mesh", &gui_param.surface_mesh);
+    if(gui_param.surface_mesh){
+      ImGui::Checkbox("Export surface (obj per frame)", &gui_param.export_surface);
+      ImGui::Text("Surface triangles: %d", int(surface.position.size()/3));
+    }
     ImGui::Checkbox("World Space Gravity", &gui_param.world_space_gravity);
     ImGui::Checkbox("Advanced Shading", &gui_param.advanced_shading);
     if(gui_param.advanced_shading){
       ImGui::Checkbox("with Background refraction", &gui_param.more_advanced_shading);
+      const char* resolutions[] = {"Full", "Half", "Quarter"};
+      ImGui::Combo("Thickness/blur resolution", &resolution_level, resolutions, 3);
+      ImGui::SliderInt("Blur radius", &blur_radius, 1, 8);
+      ImGui::SliderInt("Blur iterations", &blur_iterations, 1, 4);
     }
 }
 
+// Parameters of a headless run: the same as the gui. Called before setup_data, so that h, m, dt and the viscosity
+// are the ones the simulation is initialised with (m is derived from h unless given)
+bool scene_model::set_parameter(const std::string& name, const std::string& value)
+{
+    const bool flag = (value == "1" || value == "true" || value == "on");
+    if (name == "dt") sph_param.dt = std::stof(value);
+    else if (name == "h") sph_param.h = std::stof(value);
+    else if (name == "m") sph_param.m = std::stof(value);
+    else if (name == "viscosity") sph_param.c = std::stof(value);
+    else if (name == "world_space_gravity") gui_param.world_space_gravity = flag;
+    else if (name == "advanced_shading") gui_param.advanced_shading = flag;
+    else if (name == "refraction") gui_param.more_advanced_shading = flag;
+    else if (name == "surface_mesh") gui_param.surface_mesh = flag;
+    else if (name == "export_surface") gui_param.export_surface = flag;
+    else if (name == "resolution_level") resolution_level = std::max(0, std::min(std::stoi(value), 2));
+    else if (name == "blur_radius") blur_radius = std::max(1, std::stoi(value));
+    else if (name == "blur_iterations") blur_iterations = std::max(1, std::stoi(value));
+    else return false;
+    return true;
+}
+
 #endif
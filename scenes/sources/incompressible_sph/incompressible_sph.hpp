@@ -5,6 +5,10 @@
 #include "scenes/base/base.hpp"
 #include "opencl_helper.hpp"
 #include "opengl_helper.hpp"
+#include "sph_sweep.hpp"
+#include "sph_profiler.hpp"
+#include "sph_reference.hpp"
+#include "sph_surface.hpp"
 
 #ifdef INCOMPRESSIBLE_SPH
 
@@ -29,12 +33,14 @@ struct field_display
 // User parameters available in the GUI
 struct gui_parameters
 {
-    bool display_field;
-    bool display_particles;
-    bool save_field;
-    bool world_space_gravity;
-    bool advanced_shading;
-    bool more_advanced_shading;
+    bool display_field = true;
+    bool display_particles = true;
+    bool save_field = false;
+    bool world_space_gravity = false;
+    bool advanced_shading = false;
+    bool more_advanced_shading = false;
+    bool surface_mesh = false;
+    bool export_surface = false;
 };
 
 
@@ -50,12 +56,31 @@ struct scene_model : scene_base
     float render_time;
     float total_time;
 
+    // Kernel events and render passes of the recent frames, shown in the profiler window
+    sph_profiler profiler;
+    bool show_profiler = false;
+
     OGLHelper oglHelper;
-    GLuint dfbo[3]; //depth texture
-    GLuint rfbo[3]; //reverse depth texture
-    GLuint sdfbo[3]; //smoothed depth texture
-    GLuint srfbo[3]; //smoothed reverse depth texture
-    GLuint bgfbo[3]; //background fbo
+    GLuint dfbo[3] = {0,0,0}; //depth texture
+    GLuint rfbo[3] = {0,0,0}; //reverse depth texture
+    GLuint sdfbo[3] = {0,0,0}; //smoothed depth texture
+    GLuint srfbo[3] = {0,0,0}; //smoothed reverse depth texture
+    GLuint bgfbo[3] = {0,0,0}; //background fbo
+    GLuint tmpfbo[3] = {0,0,0}; //intermediate target of the separable blur
+
+    // Separable blur: taps on each side of a pass, and number of horizontal+vertical pass pairs
+    int blur_radius = 4;
+    int blur_iterations = 1;
+
+    // The render targets follow the framebuffer size: depth and background at full resolution,
+    // thickness and blurred buffers (and the blur intermediate) at 1/2^resolution_level of it
+    int resolution_level = 0;
+    int targets_level = 0;
+    int screen_width = 0, screen_height = 0;
+    int reduced_width = 0, reduced_height = 0;
+    void update_render_targets(int width, int height);
+    void bind_render_target(GLuint id, bool reduced);
+
     void basic_render(GLuint shader, scene_structure& scene);
     void draw_depth_buffer(GLuint shader, GLuint fbo[3], scene_structure& scene);
     void draw_thickness_buffer(GLuint shader, GLuint fbo[3], scene_structure& scene);
@@ -64,16 +89,27 @@ struct scene_model : scene_base
     void render_cube(GLuint shader, GLuint id, scene_structure& scene, bool isBack, bool isChecker);
     void draw_deformed_background(GLuint shader, scene_structure& scene);
 
+    // Polygonized surface of the fluid, rebuilt from the particles every frame when enabled
+    sph_surface surface;
+    int surface_export_count = 0;
+
+    // Frames recorded to sph_frame_0000.png... while gui_param.save_field is set
+    vcl::frame_capture capture;
+    bool capturing = false;
+    void render_surface(GLuint shader, scene_structure& scene);
+
     OCLHelper oclHelper;
     void initialize_sph();
     void setup_data(std::map<std::string,GLuint>& shaders, scene_structure& scene, gui_structure& gui);
     void frame_draw(std::map<std::string,GLuint>& shaders, scene_structure& scene, gui_structure& gui);
+    void simulation_step(scene_structure& scene);
     void display(std::map<std::string,GLuint>& shaders, scene_structure& scene, gui_structure& gui);
 
     std::vector<particle_element> particles;
     sph_parameters sph_param;
 
     void set_gui();
+    bool set_parameter(const std::string& name, const std::string& value);
 
     gui_parameters gui_param;
     vcl::mesh_drawable sphere;
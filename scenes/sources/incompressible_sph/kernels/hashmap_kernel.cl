@@ -3,6 +3,7 @@ struct sph_parameters {
     int hash_table_size;
     int table_list_size;
     int nb_neighbors;
+    int first_particle;
 
     float h;
     float rho0;
@@ -14,6 +15,7 @@ struct sph_parameters {
     float gx;
     float gy;
     float gz;
+    float search_radius;
 };
 
 
@@ -25,24 +27,36 @@ uint hash(int x, int y, int z) {
 }
 
 // Fill the hashmap with each particle in the corresponding position
-__kernel void fill_hashmap(__global const struct sph_parameters* param, __global const float3 *p, __global int *table, __global int *table_count) {
+// The particles beyond the capacity of their bucket get no neighbors: find_neighbors_tiled does not visit them
+// (find_neighbors overwrites the count, the grid kernels do not read it)
+__kernel void fill_hashmap(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global int *table, __global int *table_count, __global int *n_neighbors) {
     int i = get_global_id(0);
-    int x = floor(p[i].x/param->h);
-    int y = floor(p[i].y/param->h);
-    int z = floor(p[i].z/param->h);
+    __global const struct sph_parameters* param = params + scene[i];
+    // Work-items beyond the active particles (the work size is rounded to the work-group size)
+    if (i >= param->first_particle + param->nb_particles) {
+        return;
+    }
+    int x = floor(p[i].x/param->search_radius);
+    int y = floor(p[i].y/param->search_radius);
+    int z = floor(p[i].z/param->search_radius);
     uint hash_xyz = hash(x, y, z);
-    int idx = (hash_xyz % param->hash_table_size);
+    int idx = scene[i]*param->hash_table_size + hash_xyz % param->hash_table_size;
     int delta = atomic_inc(table_count  + idx);
     table[idx * param->table_list_size + min(delta, param->table_list_size-1)] = i;
+    if (delta >= param->table_list_size-1) {
+        n_neighbors[i] = 0;
+    }
 }
 
 
 // Look into the hashmap to find the potential neighbors of each particle  
-__kernel void find_neighbors(__global const struct sph_parameters* param, __global const float3 *p, __global const int *table,  __global const int *table_count, __global int *neighbors, __global int *n_neighbors) {
-    int i = get_global_id(0);
-    int x = floor(p[i].x/param->h);
-    int y = floor(p[i].y/param->h);
-    int z = floor(p[i].z/param->h);
+__kernel void find_neighbors(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *table,  __global const int *table_count, __global int *neighbors, __global int *n_neighbors, __global const float2 *scale, __global const int *active) {
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
+    int x = floor(p[i].x/param->search_radius);
+    int y = floor(p[i].y/param->search_radius);
+    int z = floor(p[i].z/param->search_radius);
     int count = 0;
     #pragma unroll 3
     for(int dx = -1; dx<2;dx++) {
@@ -50,13 +64,14 @@ __kernel void find_neighbors(__global const struct sph_parameters* param, __glob
         for(int dy = -1; dy<2;dy++) {
             #pragma unroll 3
             for(int dz = -1; dz<2;dz++) {
-                int idx = hash(x+dx, y+dy, z+dz) % param->hash_table_size;
+                int idx = scene[i]*param->hash_table_size + hash(x+dx, y+dy, z+dz) % param->hash_table_size;
                 int n = min(table_count[idx], param->table_list_size - 1);
                 for (char d_idx = 0; d_idx < n; d_idx++) {
                     int j = table[idx*param->table_list_size + d_idx];
                     float3 dp = p[i] - p[j];
                     float dij2 = dp.x*dp.x + dp.y*dp.y + dp.z*dp.z;
-                    if (dij2 < param->h*param->h && i!=j) {
+                    float hij = 0.5f * param->h * (scale[i].x + scale[j].x);
+                    if (dij2 < hij*hij && i!=j) {
                         neighbors[i*param->nb_neighbors + min(count, param->nb_neighbors-1)] =j;
                         count++;
                     }
@@ -65,4 +80,148 @@ __kernel void find_neighbors(__global const struct sph_parameters* param, __glob
         }
     }
     n_neighbors[i] = count;
-}
\ No newline at end of file
+}
+
+
+// Cell-cooperative variant of find_neighbors: one work-group per hashmap bucket (local size = table_list_size).
+// The particles of the bucket sharing a cell stage the 27 neighbouring buckets in local memory once,
+// then test all pairs from there. Hash collisions are handled by processing the distinct cells of the bucket in turn.
+// The particles beyond the capacity of a bucket are not in the table, so not visited: fill_hashmap clears their n_neighbors.
+__kernel void find_neighbors_tiled(__global const struct sph_parameters* params, __global const float3 *p, __global const int *table,  __global const int *table_count, __global int *neighbors, __global int *n_neighbors, __global const float2 *scale,
+      __local int *tile_idx, __local float3 *tile_p, __local float *tile_h) {
+    __local int first_pending;
+    __local int3 ref_cell;
+
+    int bucket = get_group_id(0);
+    int lid = get_local_id(0);
+    int scene_id = bucket / params->hash_table_size;
+    __global const struct sph_parameters* param = params + scene_id;
+    int n = min(table_count[bucket], param->table_list_size - 1);
+    if (n == 0) {
+        return;
+    }
+
+    int i = -1;
+    float3 pi = {0.f, 0.f, 0.f};
+    float hi = 0.f;
+    int3 cell = {0, 0, 0};
+    bool pending = lid < n;
+    if (pending) {
+        i = table[bucket*param->table_list_size + lid];
+        pi = p[i];
+        hi = scale[i].x;
+        cell = convert_int3(floor(pi/param->search_radius));
+    }
+    int count = 0;
+
+    while (true) {
+        // Elect the cell of the first pending particle as the cell processed by the whole group
+        if (lid == 0) {
+            first_pending = param->table_list_size;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (pending) {
+            atomic_min(&first_pending, lid);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        int first = first_pending;
+        if (first >= param->table_list_size) {
+            break;
+        }
+        if (lid == first) {
+            ref_cell = cell;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        int3 ref = ref_cell;
+        bool active = pending && all(cell == ref);
+
+        for(int dx = -1; dx<2;dx++) {
+            for(int dy = -1; dy<2;dy++) {
+                for(int dz = -1; dz<2;dz++) {
+                    int idx = scene_id*param->hash_table_size + hash(ref.x+dx, ref.y+dy, ref.z+dz) % param->hash_table_size;
+                    int m = min(table_count[idx], param->table_list_size - 1);
+                    // Stage the bucket in local memory
+                    if (lid < m) {
+                        int j = table[idx*param->table_list_size + lid];
+                        tile_idx[lid] = j;
+                        tile_p[lid] = p[j];
+                        tile_h[lid] = scale[j].x;
+                    }
+                    barrier(CLK_LOCAL_MEM_FENCE);
+                    if (active) {
+                        for (int k = 0; k < m; k++) {
+                            int j = tile_idx[k];
+                            float3 dp = pi - tile_p[k];
+                            float dij2 = dp.x*dp.x + dp.y*dp.y + dp.z*dp.z;
+                            float hij = 0.5f * param->h * (hi + tile_h[k]);
+                            if (dij2 < hij*hij && i!=j) {
+                                neighbors[i*param->nb_neighbors + min(count, param->nb_neighbors-1)] =j;
+                                count++;
+                            }
+                        }
+                    }
+                    barrier(CLK_LOCAL_MEM_FENCE);
+                }
+            }
+        }
+        if (active) {
+            pending = false;
+        }
+    }
+    if (i >= 0) {
+        n_neighbors[i] = count;
+    }
+}
+
+
+// Activity of each hashmap bucket: the largest speed and relative density error (density is rho/rho0) of its particles, relative to the sleep thresholds.
+// The activity is non-negative, so its bit pattern orders like an int and atomic_max can be used.
+__kernel void compute_cell_activity(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const float3 *v, __global const float *density, __global int *cell_activity, float sleep_speed, float sleep_density_error) {
+    int i = get_global_id(0);
+    __global const struct sph_parameters* param = params + scene[i];
+    if (i >= param->first_particle + param->nb_particles) {
+        return;
+    }
+    int x = floor(p[i].x/param->search_radius);
+    int y = floor(p[i].y/param->search_radius);
+    int z = floor(p[i].z/param->search_radius);
+    int idx = scene[i]*param->hash_table_size + hash(x, y, z) % param->hash_table_size;
+    float activity = max(length(v[i])/sleep_speed, fabs(density[i] - 1.f)/sleep_density_error);
+    atomic_max(cell_activity + idx, as_int(activity));
+}
+
+
+// A particle stays awake if any of the 27 cells around it is active, so a moving particle entering a sleeping region wakes it.
+// Awake particles are appended to the active list read by the solver kernels; sleeping ones are frozen at rest.
+__kernel void update_sleeping(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *cell_activity, __global int *active, __global int *nb_active,
+      __global float3 *q, __global float3 *v, __global float3 *v_copy, __global float3 *w, __global float *lambda, __global float3 *dp) {
+    int i = get_global_id(0);
+    __global const struct sph_parameters* param = params + scene[i];
+    if (i >= param->first_particle + param->nb_particles) {
+        return;
+    }
+    int x = floor(p[i].x/param->search_radius);
+    int y = floor(p[i].y/param->search_radius);
+    int z = floor(p[i].z/param->search_radius);
+    bool awake = false;
+    for(int dx = -1; dx<2;dx++) {
+        for(int dy = -1; dy<2;dy++) {
+            for(int dz = -1; dz<2;dz++) {
+                int idx = scene[i]*param->hash_table_size + hash(x+dx, y+dy, z+dz) % param->hash_table_size;
+                awake = awake || as_float(cell_activity[idx]) >= 1.f;
+            }
+        }
+    }
+    if (awake) {
+        active[atomic_inc(nb_active)] = i;
+    } else {
+        // Neighbours of sleeping particles read these values, they must describe a particle at rest
+        float3 zero = {0.f,0.f,0.f};
+        q[i] = p[i];
+        v[i] = zero;
+        v_copy[i] = zero;
+        w[i] = zero;
+        lambda[i] = 0.f;
+        dp[i] = zero;
+    }
+}
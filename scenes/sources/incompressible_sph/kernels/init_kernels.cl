@@ -0,0 +1,119 @@
+// Same layout as init_parameters in opencl_helper.hpp
+struct init_parameters {
+    int shape; // 0: box, 1: sphere, 2: voxel grid
+    int nx;
+    int ny;
+    int nz;
+    int first_particle;
+    int max_particles;
+    uint seed;
+
+    float spacing;
+    float jitter;
+    float ox;
+    float oy;
+    float oz;
+
+    // Sphere
+    float cx;
+    float cy;
+    float cz;
+    float radius;
+
+    // Voxel grid
+    int vx;
+    int vy;
+    int vz;
+    float voxel_ox;
+    float voxel_oy;
+    float voxel_oz;
+    float voxel_size;
+};
+
+
+uint mix_bits(uint x);
+float random_uniform(uint seed, uint counter);
+bool inside_shape(__global const struct init_parameters* param, __global const uchar *voxels, float3 x);
+float3 lattice_position(__global const struct init_parameters* param, int x, int y, int z);
+
+
+// Counter-based generator: the k-th random number only depends on (seed, k), whatever the work-item computing it
+uint mix_bits(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in [0,1)
+float random_uniform(uint seed, uint counter) {
+    return (mix_bits(mix_bits(counter) ^ seed) >> 8) * (1.f/16777216.f);
+}
+
+bool inside_shape(__global const struct init_parameters* param, __global const uchar *voxels, float3 x) {
+    if (param->shape == 1) {
+        float3 c = {param->cx, param->cy, param->cz};
+        return length(x - c) < param->radius;
+    }
+    if (param->shape == 2) {
+        int i = floor((x.x - param->voxel_ox) / param->voxel_size);
+        int j = floor((x.y - param->voxel_oy) / param->voxel_size);
+        int k = floor((x.z - param->voxel_oz) / param->voxel_size);
+        if (i < 0 || j < 0 || k < 0 || i >= param->vx || j >= param->vy || k >= param->vz) {
+            return false;
+        }
+        return voxels[i + param->vx * (j + param->vy * k)] != 0;
+    }
+    return true;
+}
+
+// Lattice node (x,y,z), without jitter
+float3 lattice_position(__global const struct init_parameters* param, int x, int y, int z) {
+    float3 o = {param->ox, param->oy, param->oz};
+    float3 k = {x + 0.5f, y + 0.5f, z + 0.5f};
+    return o + param->spacing * k;
+}
+
+// Number of lattice nodes inside the shape for each row along x. Rows are ordered by y first so that a truncated fill
+// keeps the lowest layers.
+__kernel void count_lattice_rows(__global const struct init_parameters* param, __global const uchar *voxels, __global int *row_count) {
+    int row = get_global_id(0);
+    if (row >= param->ny * param->nz) {
+        return;
+    }
+    int y = row / param->nz;
+    int z = row % param->nz;
+    int count = 0;
+    for (int x = 0; x < param->nx; x++) {
+        if (inside_shape(param, voxels, lattice_position(param, x, y, z))) {
+            count++;
+        }
+    }
+    row_count[row] = count;
+}
+
+// Write the particles of each row at the offset given by the exclusive prefix sum of row_count. The jitter is a fraction
+// of the spacing, the speed is zero.
+__kernel void fill_lattice_rows(__global const struct init_parameters* param, __global const uchar *voxels, __global const int *row_offset, __global float3 *p, __global float3 *v) {
+    int row = get_global_id(0);
+    if (row >= param->ny * param->nz) {
+        return;
+    }
+    int y = row / param->nz;
+    int z = row % param->nz;
+    int k = row_offset[row];
+    float3 zero = {0.f,0.f,0.f};
+    for (int x = 0; x < param->nx && k < param->max_particles; x++) {
+        float3 pos = lattice_position(param, x, y, z);
+        if (!inside_shape(param, voxels, pos)) {
+            continue;
+        }
+        uint counter = 3 * (uint)(x + param->nx * row);
+        float3 r = {random_uniform(param->seed, counter), random_uniform(param->seed, counter+1), random_uniform(param->seed, counter+2)};
+        p[param->first_particle + k] = pos + param->jitter * param->spacing * (r - 0.5f);
+        v[param->first_particle + k] = zero;
+        k++;
+    }
+}
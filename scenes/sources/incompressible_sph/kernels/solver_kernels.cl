@@ -3,6 +3,7 @@ struct sph_parameters {
     int hash_table_size;
     int table_list_size;
     int nb_neighbors;
+    int first_particle;
 
     float h;
     float rho0;
@@ -14,11 +15,15 @@ struct sph_parameters {
     float gx;
     float gy;
     float gz;
+    float search_radius;
 };
 
 
 float W(float h, float3 p);
 float3 gradW(float h, float3 p);
+uint hash(int x, int y, int z);
+bool is_neighbor(float h, float3 pi, float3 pj);
+float h_ij(__global const struct sph_parameters* param, __global const float2 *scale, int i, int j);
 
 float W(float h, float3 p){
     float d = length(p);
@@ -44,59 +49,147 @@ float3 gradW(float h, float3 p){
   }
 }
 
+// Same spatial hash as the one used to fill the hashmap
+uint hash(int x, int y, int z) {
+    return z*3884 + y*10+x;
+}
+
+// Distance filter of the neighbor search
+bool is_neighbor(float h, float3 pi, float3 pj) {
+    float3 dp = pi - pj;
+    return dp.x*dp.x + dp.y*dp.y + dp.z*dp.z < h*h;
+}
+
+// Symmetric smoothing length of the pair ij. The smoothing length of i is h*scale[i].x and its mass m*scale[i].y
+// (both scales are 1 unless the adaptive resolution merged the particle).
+float h_ij(__global const struct sph_parameters* param, __global const float2 *scale, int i, int j) {
+    return 0.5f * param->h * (scale[i].x + scale[j].x);
+}
+
 // Compute the constrain: lamda for each particles
-__kernel void compute_constraints(__global const struct sph_parameters* param, __global const float3 *q, __global const int *neighbors,
-      __global const int *n_neighbors, __global float *lambda) {
-  int i = get_global_id(0);
+__kernel void compute_constraints(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *q, __global const int *neighbors,
+      __global const int *n_neighbors, __global float *lambda, __global const float2 *scale, __global const int *active) {
+  int i = active[get_global_id(0)];
+  if (i < 0) return;
+  __global const struct sph_parameters* param = params + scene[i];
   int n = min(param->nb_neighbors-1, n_neighbors[i]);
   float rho = 0.f;
   float3 ci= {0.f,0.f,0.f};
   float sum = 0.f;
   for (int j_idx = 0; j_idx < n; j_idx++) {
     int j = neighbors[param->nb_neighbors * i + j_idx];
-    rho += W(param->h, q[i] - q[j]);
-    float3 grad_ij = gradW(param->h, q[i] - q[j]);
+    float h = h_ij(param, scale, i, j);
+    float mj = param->m * scale[j].y;
+    rho += mj * W(h, q[i] - q[j]);
+    float3 grad_ij = mj * gradW(h, q[i] - q[j]);
     ci += grad_ij;
     sum += dot(grad_ij,grad_ij);
   }
   sum += dot(ci,ci);
-  rho *= param->m;
-  lambda[i] = - (rho - param->rho0) * param->rho0 / (sum + param->epsilon);
-  lambda[i] /= param->m * param->m;
+  float mi = param->m * scale[i].y;
+  lambda[i] = - (rho - param->rho0) * param->rho0 / (sum + param->epsilon * mi * mi);
 }
 
 // From the constraints, compute the nex dp
-__kernel void compute_dp(__global const struct sph_parameters* param, __global const float3 *q, __global const int *neighbors,
-      __global const int *n_neighbors, __global const float *lambda, __global float3 *dp){
-  int i = get_global_id(0);
+__kernel void compute_dp(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *q, __global const int *neighbors,
+      __global const int *n_neighbors, __global const float *lambda, __global float3 *dp, __global const float2 *scale, __global const int *active){
+  int i = active[get_global_id(0)];
+  if (i < 0) return;
+  __global const struct sph_parameters* param = params + scene[i];
   int n = min(param->nb_neighbors-1, n_neighbors[i]);
   float3 zero = {0.f,0.f,0.f};
   dp[i] = zero;
   for (int j_idx = 0; j_idx < n; j_idx++) {
     int j = neighbors[param->nb_neighbors * i + j_idx];
-    float3 dq = {0.1f*param->h, 0.f, 0.f};
-    float s = - 0.1f * pow(W(param->h, q[i] - q[j])/W(param->h, dq), 4.f); // homogeneous h^-3
-    dp[i] += (lambda[i] + lambda[j] + s) * gradW(param->h, q[i] - q[j]); // homogeneous h^-2;
+    float h = h_ij(param, scale, i, j);
+    float3 dq = {0.1f*h, 0.f, 0.f};
+    float s = - 0.1f * pow(W(h, q[i] - q[j])/W(h, dq), 4.f); // homogeneous h^-3
+    dp[i] += param->m * scale[j].y * (lambda[i] + lambda[j] + s) * gradW(h, q[i] - q[j]); // homogeneous h^-2;
   }
-  dp[i] *= param->m / param->rho0;
+  dp[i] /= param->rho0;
   float d = length(dp[i]);
   d = d < param->h * param->max_relative_dp ? 1 : d / (param->h * param->max_relative_dp) ;
   dp[i] /= d;
 }
 
 //Enforce that the particles stay confined in the box
-__kernel void solve_collisions(__global const struct sph_parameters* param,  __global const float3 *q, __global float3 *dp){
-    int i = get_global_id(0);
+__kernel void solve_collisions(__global const struct sph_parameters* params, __global const int *scene,  __global const float3 *q, __global float3 *dp, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
     float3 d = q[i]+ dp[i];
     float eps = 0.01f;
-    d.x = clamp(d.x, -1.f + 0.3f*((float) param->h) + eps*(i / (float) param->nb_particles), 1.f - 0.3f*((float) param->h) - eps*(i / (float) param->nb_particles));
-    d.y = clamp(d.y, -1.f + 0.3f*((float) param->h) + eps*(i / (float) param->nb_particles), 1.f - 0.3f*((float) param->h) - eps*(i / (float) param->nb_particles));
-    d.z = clamp(d.z, -1.f + 0.3f*((float) param->h) + eps*(i / (float) param->nb_particles), 1.f - 0.3f*((float) param->h) - eps*(i / (float) param->nb_particles));
+    d.x = clamp(d.x, -1.f + 0.3f*((float) param->h) + eps*((i - param->first_particle) / (float) param->nb_particles), 1.f - 0.3f*((float) param->h) - eps*((i - param->first_particle) / (float) param->nb_particles));
+    d.y = clamp(d.y, -1.f + 0.3f*((float) param->h) + eps*((i - param->first_particle) / (float) param->nb_particles), 1.f - 0.3f*((float) param->h) - eps*((i - param->first_particle) / (float) param->nb_particles));
+    d.z = clamp(d.z, -1.f + 0.3f*((float) param->h) + eps*((i - param->first_particle) / (float) param->nb_particles), 1.f - 0.3f*((float) param->h) - eps*((i - param->first_particle) / (float) param->nb_particles));
     dp[i] =  d - q[i];
 }
 
 // apply the result of the solver step
-__kernel void add_position_correction(__global const float3 *dp, __global float3 *q){
-  int i = get_global_id(0);
+__kernel void add_position_correction(__global const float3 *dp, __global float3 *q, __global const int *active){
+  int i = active[get_global_id(0)];
+  if (i < 0) return;
   q[i] += dp[i];
 }
+
+
+// Neighbor-list-free variants: the neighbors j of i are found on the fly in the 27 cells of the hashmap around p[i]
+// (the hashmap being filled with p), and filtered by distance inline. As in the list mode, the cells are visited in the
+// order of find_neighbors and at most nb_neighbors-1 neighbors are used.
+
+__kernel void compute_constraints_grid(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const float3 *q,
+      __global const int *table, __global const int *table_count, __global float *lambda, __global const float2 *scale, __global const int *active) {
+  int i = active[get_global_id(0)];
+  if (i < 0) return;
+  __global const struct sph_parameters* param = params + scene[i];
+  int3 cell = convert_int3(floor(p[i]/param->search_radius));
+  float rho = 0.f;
+  float3 ci= {0.f,0.f,0.f};
+  float sum = 0.f;
+  int count = 0;
+  for (int c = 0; c < 27 && count < param->nb_neighbors-1; c++) {
+    int idx = scene[i]*param->hash_table_size + hash(cell.x + c/9 - 1, cell.y + (c/3)%3 - 1, cell.z + c%3 - 1) % param->hash_table_size;
+    int n = min(table_count[idx], param->table_list_size - 1);
+    for (int k = 0; k < n && count < param->nb_neighbors-1; k++) {
+      int j = table[idx*param->table_list_size + k];
+      float h = h_ij(param, scale, i, j);
+      if (i == j || !is_neighbor(h, p[i], p[j])) continue;
+      count++;
+      float mj = param->m * scale[j].y;
+      rho += mj * W(h, q[i] - q[j]);
+      float3 grad_ij = mj * gradW(h, q[i] - q[j]);
+      ci += grad_ij;
+      sum += dot(grad_ij,grad_ij);
+    }
+  }
+  sum += dot(ci,ci);
+  float mi = param->m * scale[i].y;
+  lambda[i] = - (rho - param->rho0) * param->rho0 / (sum + param->epsilon * mi * mi);
+}
+
+__kernel void compute_dp_grid(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const float3 *q,
+      __global const int *table, __global const int *table_count, __global const float *lambda, __global float3 *dp, __global const float2 *scale, __global const int *active){
+  int i = active[get_global_id(0)];
+  if (i < 0) return;
+  __global const struct sph_parameters* param = params + scene[i];
+  int3 cell = convert_int3(floor(p[i]/param->search_radius));
+  float3 dpi = {0.f,0.f,0.f};
+  int count = 0;
+  for (int c = 0; c < 27 && count < param->nb_neighbors-1; c++) {
+    int idx = scene[i]*param->hash_table_size + hash(cell.x + c/9 - 1, cell.y + (c/3)%3 - 1, cell.z + c%3 - 1) % param->hash_table_size;
+    int n = min(table_count[idx], param->table_list_size - 1);
+    for (int k = 0; k < n && count < param->nb_neighbors-1; k++) {
+      int j = table[idx*param->table_list_size + k];
+      float h = h_ij(param, scale, i, j);
+      if (i == j || !is_neighbor(h, p[i], p[j])) continue;
+      count++;
+      float3 dq = {0.1f*h, 0.f, 0.f};
+      float s = - 0.1f * pow(W(h, q[i] - q[j])/W(h, dq), 4.f);
+      dpi += param->m * scale[j].y * (lambda[i] + lambda[j] + s) * gradW(h, q[i] - q[j]);
+    }
+  }
+  dpi /= param->rho0;
+  float d = length(dpi);
+  d = d < param->h * param->max_relative_dp ? 1 : d / (param->h * param->max_relative_dp) ;
+  dp[i] = dpi / d;
+}
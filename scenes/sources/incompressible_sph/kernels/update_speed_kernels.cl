@@ -3,6 +3,7 @@ struct sph_parameters {
     int hash_table_size;
     int table_list_size;
     int nb_neighbors;
+    int first_particle;
 
     float h;
     float rho0;
@@ -14,11 +15,15 @@ struct sph_parameters {
     float gx;
     float gy;
     float gz;
+    float search_radius;
 };
 
 
 float W(float h, float3 p);
 float3 gradW(float h, float3 p);
+uint hash(int x, int y, int z);
+bool is_neighbor(float h, float3 pi, float3 pj);
+float h_ij(__global const struct sph_parameters* param, __global const float2 *scale, int i, int j);
 
 float W(float h, float3 p){
     float d = length(p);
@@ -44,10 +49,28 @@ float3 gradW(float h, float3 p){
   }
 }
 
+// Same spatial hash as the one used to fill the hashmap
+uint hash(int x, int y, int z) {
+    return z*3884 + y*10+x;
+}
+
+// Distance filter of the neighbor search
+bool is_neighbor(float h, float3 pi, float3 pj) {
+    float3 dp = pi - pj;
+    return dp.x*dp.x + dp.y*dp.y + dp.z*dp.z < h*h;
+}
+
+// Symmetric smoothing length of the pair ij, see solver_kernels.cl
+float h_ij(__global const struct sph_parameters* param, __global const float2 *scale, int i, int j) {
+    return 0.5f * param->h * (scale[i].x + scale[j].x);
+}
+
 // kernel called before the iterative solver, update v with the gravity, 
 // and compute the nexte position for each particles, before the correction
-__kernel void befor_solver(__global const struct sph_parameters* param, __global const float3 *p, __global float3 *v, __global float3 *q){
-    int i = get_global_id(0);
+__kernel void befor_solver(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global float3 *v, __global float3 *q, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
     float3 g = {param->gx, param->gy, param->gz};
     v[i]  += param->dt * g;
     q[i] = p[i] + param->dt * v[i];
@@ -55,26 +78,32 @@ __kernel void befor_solver(__global const struct sph_parameters* param, __global
 
 // Update the position, from the position given y the solver
 // Compute the new speed
-__kernel void update_position_speed(__global const struct sph_parameters* param, __global const float3 *q, __global float3 *p, __global float3 *v_copy){
-    int i = get_global_id(0);
+__kernel void update_position_speed(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *q, __global float3 *p, __global float3 *v_copy, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
     v_copy[i] = (q[i] - p[i])/param->dt;
     p[i] = q[i];
 }
 
 // compute w for the calcul of the vorticity
-__kernel void update_w(__global const struct sph_parameters* param, __global const float3 *p, __global const int *neighbors, __global const int *n_neighbors, __global const float3 *v_copy, __global float3 *w){
-    int i = get_global_id(0);
+__kernel void update_w(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *neighbors, __global const int *n_neighbors, __global const float3 *v_copy, __global float3 *w, __global const float2 *scale, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
     w[i] = float3(0.f, 0.f, 0.f);
     int n = min(param->nb_neighbors-1, n_neighbors[i]);
     for (int j_idx=0; j_idx < n; j_idx++) {
         int j = neighbors[param->nb_neighbors * i + j_idx];
-        w[i] += - param->m * cross(v_copy[j]-v_copy[i], gradW(param->h,p[i]-p[j]));
+        w[i] += - param->m * scale[j].y * cross(v_copy[j]-v_copy[i], gradW(h_ij(param, scale, i, j),p[i]-p[j]));
     }
 }
 
 // Apply the vorticity to each particles
-__kernel void apply_vorticity(__global const struct sph_parameters* param, __global const float3 *p,  __global const int *neighbors, __global const int *n_neighbors, __global float3 *v_copy, __global const float3 *w){
-    int i = get_global_id(0);
+__kernel void apply_vorticity(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p,  __global const int *neighbors, __global const int *n_neighbors, __global float3 *v_copy, __global const float3 *w, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
     int n = min(param->nb_neighbors-1, n_neighbors[i]);
     float3 eta = float3(0.f, 0.f, 0.f);
     for (int j_idx=0; j_idx < n; j_idx++) {
@@ -86,15 +115,18 @@ __kernel void apply_vorticity(__global const struct sph_parameters* param, __glo
 }
 
 // apply the viscosity to each particles
-__kernel void apply_viscosity(__global const struct sph_parameters* param, __global const float3 *p, __global const int *neighbors, __global const int *n_neighbors, __global const float3 *v_copy, __global float3 *v){
-    int i = get_global_id(0);
+__kernel void apply_viscosity(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *neighbors, __global const int *n_neighbors, __global const float3 *v_copy, __global float3 *v, __global const float2 *scale, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
     float alpha = 0;
     int n = min(param->nb_neighbors-1, n_neighbors[i]);
     float3 zero = {0.f,0.f,0.f};
     v[i] = zero;
     for (int j_idx=0; j_idx < n; j_idx++) {
         int j = neighbors[param->nb_neighbors * i + j_idx];
-        float dalpha = param->c * W(param->h, p[i] - p[j]) / W(param->h, float3(0,0,0));
+        float h = h_ij(param, scale, i, j);
+        float dalpha = param->c * scale[j].y * W(h, p[i] - p[j]) / W(h, float3(0,0,0));
         v[i] += dalpha* v_copy[j];
         alpha += dalpha;
     }
@@ -103,13 +135,114 @@ __kernel void apply_viscosity(__global const struct sph_parameters* param, __glo
 }
 
 // compute the pressure at each particle, for logging
-__kernel void compute_pressure(__global const struct sph_parameters* param, __global const float3 *p, __global const int *neighbors, __global const int *n_neighbors, __global float *pressure){
+__kernel void compute_pressure(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *neighbors, __global const int *n_neighbors, __global float *pressure, __global const float2 *scale){
     int i = get_global_id(0);
+    __global const struct sph_parameters* param = params + scene[i];
+    // Work-items beyond the particles (the work size is rounded to the work-group size)
+    if (i >= param->first_particle + param->nb_particles) {
+        return;
+    }
     int n = min(param->nb_neighbors-1, n_neighbors[i]);
     float rho = 0.f;
     for (int j_idx = 0; j_idx < n; j_idx++) {
         int j = neighbors[param->nb_neighbors * i + j_idx];
-        rho += W(param->h, p[i] - p[j]);
+        rho += scale[j].y * W(h_ij(param, scale, i, j), p[i] - p[j]);
+    }
+    rho *= param->m;
+    pressure[i] = rho/param->rho0;
+}
+
+
+// Neighbor-list-free variants: the neighbors j of i are found on the fly in the 27 cells of the hashmap around p[i]
+// (the hashmap being filled with p), and filtered by distance inline. As in the list mode, the cells are visited in the
+// order of find_neighbors and at most nb_neighbors-1 neighbors are used.
+
+__kernel void update_w_grid(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *table, __global const int *table_count, __global const float3 *v_copy, __global float3 *w, __global const float2 *scale, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
+    int3 cell = convert_int3(floor(p[i]/param->search_radius));
+    float3 wi = float3(0.f, 0.f, 0.f);
+    int count = 0;
+    for (int c = 0; c < 27 && count < param->nb_neighbors-1; c++) {
+        int idx = scene[i]*param->hash_table_size + hash(cell.x + c/9 - 1, cell.y + (c/3)%3 - 1, cell.z + c%3 - 1) % param->hash_table_size;
+        int n = min(table_count[idx], param->table_list_size - 1);
+        for (int k = 0; k < n && count < param->nb_neighbors-1; k++) {
+            int j = table[idx*param->table_list_size + k];
+            float h = h_ij(param, scale, i, j);
+            if (i == j || !is_neighbor(h, p[i], p[j])) continue;
+            count++;
+            wi += - param->m * scale[j].y * cross(v_copy[j]-v_copy[i], gradW(h,p[i]-p[j]));
+        }
+    }
+    w[i] = wi;
+}
+
+__kernel void apply_vorticity_grid(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *table, __global const int *table_count, __global float3 *v_copy, __global const float3 *w, __global const float2 *scale, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
+    int3 cell = convert_int3(floor(p[i]/param->search_radius));
+    float3 eta = float3(0.f, 0.f, 0.f);
+    int count = 0;
+    for (int c = 0; c < 27 && count < param->nb_neighbors-1; c++) {
+        int idx = scene[i]*param->hash_table_size + hash(cell.x + c/9 - 1, cell.y + (c/3)%3 - 1, cell.z + c%3 - 1) % param->hash_table_size;
+        int n = min(table_count[idx], param->table_list_size - 1);
+        for (int k = 0; k < n && count < param->nb_neighbors-1; k++) {
+            int j = table[idx*param->table_list_size + k];
+            float h = h_ij(param, scale, i, j);
+            if (i == j || !is_neighbor(h, p[i], p[j])) continue;
+            count++;
+            eta += (length(w[j])-length(w[i]))/(length(p[j]-p[i])*length(p[j]-p[i]))*(p[j]-p[i]);
+        }
+    }
+    eta = normalize(eta);
+    v_copy[i] += param->dt*param->h*0.001f*cross(eta,w[i]);
+}
+
+__kernel void apply_viscosity_grid(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *table, __global const int *table_count, __global const float3 *v_copy, __global float3 *v, __global const float2 *scale, __global const int *active){
+    int i = active[get_global_id(0)];
+    if (i < 0) return;
+    __global const struct sph_parameters* param = params + scene[i];
+    int3 cell = convert_int3(floor(p[i]/param->search_radius));
+    float alpha = 0;
+    float3 vi = {0.f,0.f,0.f};
+    int count = 0;
+    for (int c = 0; c < 27 && count < param->nb_neighbors-1; c++) {
+        int idx = scene[i]*param->hash_table_size + hash(cell.x + c/9 - 1, cell.y + (c/3)%3 - 1, cell.z + c%3 - 1) % param->hash_table_size;
+        int n = min(table_count[idx], param->table_list_size - 1);
+        for (int k = 0; k < n && count < param->nb_neighbors-1; k++) {
+            int j = table[idx*param->table_list_size + k];
+            float h = h_ij(param, scale, i, j);
+            if (i == j || !is_neighbor(h, p[i], p[j])) continue;
+            count++;
+            float dalpha = param->c * scale[j].y * W(h, p[i] - p[j]) / W(h, float3(0,0,0));
+            vi += dalpha* v_copy[j];
+            alpha += dalpha;
+        }
+    }
+    v[i] = vi + (1-alpha) * v_copy[i];
+}
+
+__kernel void compute_pressure_grid(__global const struct sph_parameters* params, __global const int *scene, __global const float3 *p, __global const int *table, __global const int *table_count, __global float *pressure, __global const float2 *scale){
+    int i = get_global_id(0);
+    __global const struct sph_parameters* param = params + scene[i];
+    if (i >= param->first_particle + param->nb_particles) {
+        return;
+    }
+    int3 cell = convert_int3(floor(p[i]/param->search_radius));
+    float rho = 0.f;
+    int count = 0;
+    for (int c = 0; c < 27 && count < param->nb_neighbors-1; c++) {
+        int idx = scene[i]*param->hash_table_size + hash(cell.x + c/9 - 1, cell.y + (c/3)%3 - 1, cell.z + c%3 - 1) % param->hash_table_size;
+        int n = min(table_count[idx], param->table_list_size - 1);
+        for (int k = 0; k < n && count < param->nb_neighbors-1; k++) {
+            int j = table[idx*param->table_list_size + k];
+            float h = h_ij(param, scale, i, j);
+            if (i == j || !is_neighbor(h, p[i], p[j])) continue;
+            count++;
+            rho += scale[j].y * W(h, p[i] - p[j]);
+        }
     }
     rho *= param->m;
     pressure[i] = rho/param->rho0;
@@ -4,27 +4,62 @@
 #include <fstream>
 #include <sstream>
 #include <chrono> 
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
 
 
 using namespace vcl;
 
 void OCLHelper::init_context(sph_parameters sph_param){
-    nb_particles=sph_param.nb_particles;
-    hash_table_size=sph_param.hash_table_size;
-    table_list_size=sph_param.table_list_size;
-    nb_neighbors=sph_param.nb_neighbors;
+    init_context(std::vector<sph_parameters>{sph_param});
+}
+
+// Each simulation of the ensemble has its own parameters and particle count. The buffers of the hashmap and of the
+// neighbor list are laid out with a single stride, so all the simulations must share their sizes.
+void OCLHelper::init_context(std::vector<sph_parameters> ensemble){
+    nb_scenes = ensemble.size();
+    nb_particles = 0;
+    first_particles.clear();
+    for (auto &sph_param : ensemble)
+    {
+        first_particles.push_back(nb_particles);
+        nb_particles += sph_param.nb_particles;
+    }
+    hash_table_size=ensemble[0].hash_table_size;
+    table_list_size=ensemble[0].table_list_size;
+    nb_neighbors=ensemble[0].nb_neighbors;
+    for (auto &sph_param : ensemble)
+    {
+        assert_vcl(sph_param.hash_table_size == hash_table_size && sph_param.table_list_size == table_list_size && sph_param.nb_neighbors == nb_neighbors,
+                   "The simulations of an ensemble must have the same hash_table_size, table_list_size and nb_neighbors");
+    }
 
     std::cout << "Initialising OpenCL context" << std::endl;
 
-    cl_platform_id platform_id = NULL;
-    cl_uint ret_num_devices;
-    cl_uint ret_num_platforms;
-    cl_int ret = clGetPlatformIDs(1, &platform_id, &ret_num_platforms);
+    // Devices of device_type on all the platforms
+    cl_platform_id platforms[16];
+    cl_uint ret_num_platforms = 0;
+    cl_int ret = clGetPlatformIDs(16, platforms, &ret_num_platforms);
     std::cout << "Error code clGetPlatformIDs : " << ret << std::endl;
+    ret_num_platforms = std::min(ret_num_platforms, 16u);
 
-    ret = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_GPU, 1,
-            &device_id, &ret_num_devices);
-    std::cout << "Error code clGetDeviceIDs : " << ret << std::endl;
+    std::vector<cl_device_id> devices;
+    for (cl_uint k = 0; k < ret_num_platforms; k++)
+    {
+        cl_device_id platform_devices[16];
+        cl_uint nb_platform_devices = 0;
+        if (clGetDeviceIDs(platforms[k], device_type, 16, platform_devices, &nb_platform_devices) == CL_SUCCESS) {
+            devices.insert(devices.end(), platform_devices, platform_devices + std::min(nb_platform_devices, 16u));
+        }
+    }
+    const cl_uint ret_num_devices = cl_uint(devices.size());
+    if (ret_num_devices > 0) {
+        device_id = devices[device_index % ret_num_devices];
+    } else {
+        std::cerr << "No OpenCL device of the requested type" << std::endl;
+        check_error(CL_DEVICE_NOT_FOUND);
+    }
 
     cl_uint max_comput_unit;
     ret = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(max_comput_unit), &max_comput_unit, NULL);
@@ -39,24 +74,69 @@ void OCLHelper::init_context(sph_parameters sph_param){
     << " name: " << std::string(name) << std::endl;
 
     context = clCreateContext( NULL, 1, &device_id, NULL, NULL, &ret);
-    command_queue = clCreateCommandQueue(context, device_id, 0, &ret);
+    check_error(ret);
+    command_queue = clCreateCommandQueue(context, device_id, profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &ret);
+    check_error(ret);
 
     init_buffers();
     init_hashmap_program();
     init_solver_program();
     init_speed_program();
-    set_sph_param(sph_param);
+    init_init_program();
+    for (int k = 0; k < nb_scenes; k++)
+    {
+        set_sph_param(ensemble[k], k);
+    }
+
+    std::vector<cl_int> scene(nb_work_items(nb_particles), 0);
+    for (int k = 0; k < nb_scenes; k++)
+    {
+        std::fill(scene.begin() + first_particles[k], scene.begin() + first_particles[k] + ensemble[k].nb_particles, k);
+    }
+    ret = clEnqueueWriteBuffer(command_queue, scene_mem, CL_TRUE, 0, scene.size() * sizeof(cl_int), scene.data(), 0, NULL, NULL);
+
+    // All the particles start at the base resolution, the buffers are sized for them
+    max_particles = nb_particles;
+    cl_float2 unit_scale = {{1.0f, 1.0f}};
+    ret = clEnqueueFillBuffer(command_queue, scale_mem, &unit_scale, sizeof(unit_scale), 0, nb_particles * sizeof(cl_float2), 0, NULL, NULL);
+    wake_all();
+
+    if (!allocate_neighbor_list) {
+        grid_neighbors = true;
+    }
 
-    pressure_log_file.open("pressure_log.csv");
+    if (!pressure_log_path.empty()) {
+        pressure_log_file.open(pressure_log_path);
+    }
+}
+
+void OCLHelper::set_profiler(sph_profiler* profiler_arg){
+    profiler = profiler_arg;
+    if (profiling == (profiler != NULL))
+        return;
+    profiling = (profiler != NULL);
+
+    // The kernels and buffers belong to the context, only the queue depends on the profiling
+    clFinish(command_queue);
+    clReleaseCommandQueue(command_queue);
+    cl_int ret;
+    command_queue = clCreateCommandQueue(context, device_id, profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &ret);
+    check_error(ret);
 }
 
 void OCLHelper::init_buffers(){
     cl_int ret;
-    sph_param_mem = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(sph_parameters), NULL, &ret);
+    sph_param_mem = clCreateBuffer(context, CL_MEM_READ_ONLY, nb_scenes * sizeof(sph_parameters), NULL, &ret);
+    // Padded to the work size: the kernels launched on all the particles read the scene of every work-item before their bounds check
+    scene_mem = clCreateBuffer(context, CL_MEM_READ_ONLY, nb_work_items(nb_particles) * sizeof(cl_int), NULL, &ret);
     p_mem = clCreateBuffer(context, CL_MEM_READ_ONLY, nb_particles * sizeof(cl_float3), NULL, &ret);
-    table_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, hash_table_size * table_list_size * sizeof(cl_int), NULL, &ret);
-    table_count_mem = clCreateBuffer(context, CL_MEM_READ_WRITE,  hash_table_size * sizeof(cl_int), NULL, &ret);
-    neighbors_mem = clCreateBuffer(context, CL_MEM_READ_WRITE,  nb_particles * nb_neighbors * sizeof(cl_int), NULL, &ret);
+    table_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_scenes * hash_table_size * table_list_size * sizeof(cl_int), NULL, &ret);
+    table_count_mem = clCreateBuffer(context, CL_MEM_READ_WRITE,  nb_scenes * hash_table_size * sizeof(cl_int), NULL, &ret);
+    neighbors_mem = NULL;
+    if (allocate_neighbor_list) {
+        neighbors_mem = clCreateBuffer(context, CL_MEM_READ_WRITE,  nb_particles * nb_neighbors * sizeof(cl_int), NULL, &ret);
+    }
+    std::cout << "Neighbor list: " << (allocate_neighbor_list ? nb_particles * nb_neighbors * sizeof(cl_int) / (1024*1024.0f) : 0.0f) << " MB" << std::endl;
     n_neighbors_mem = clCreateBuffer(context, CL_MEM_READ_WRITE,  nb_particles * sizeof(cl_int), NULL, &ret);
     q_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_particles * sizeof(cl_float3), NULL, &ret);
     lambda_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_particles * sizeof(cl_float), NULL, &ret);
@@ -65,6 +145,10 @@ void OCLHelper::init_buffers(){
     v_copy_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_particles * sizeof(cl_float3), NULL, &ret);
     w_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_particles * sizeof(cl_float3), NULL, &ret);
     pressure_mem = clCreateBuffer(context, CL_MEM_WRITE_ONLY, nb_particles * sizeof(cl_float), NULL, &ret);
+    scale_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_particles * sizeof(cl_float2), NULL, &ret);
+    active_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_work_items(nb_particles) * sizeof(cl_int), NULL, &ret);
+    nb_active_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &ret);
+    cell_activity_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_scenes * hash_table_size * sizeof(cl_int), NULL, &ret);
  }
 
 
@@ -75,18 +159,67 @@ void OCLHelper::init_hashmap_program(){
     cl_int ret;
     fill_hashmap_kernel = clCreateKernel(hashmap_program, "fill_hashmap", &ret);
     find_neighbors_kernel = clCreateKernel(hashmap_program, "find_neighbors", &ret);
+    find_neighbors_tiled_kernel = clCreateKernel(hashmap_program, "find_neighbors_tiled", &ret);
+    compute_cell_activity_kernel = clCreateKernel(hashmap_program, "compute_cell_activity", &ret);
+    update_sleeping_kernel = clCreateKernel(hashmap_program, "update_sleeping", &ret);
 
     ret = clSetKernelArg(fill_hashmap_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(fill_hashmap_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(fill_hashmap_kernel, 2, sizeof(cl_mem), (void *)&table_mem);
-    ret = clSetKernelArg(fill_hashmap_kernel, 3, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(fill_hashmap_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(fill_hashmap_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(fill_hashmap_kernel, 3, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(fill_hashmap_kernel, 4, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(fill_hashmap_kernel, 5, sizeof(cl_mem), (void *)&n_neighbors_mem);
 
     ret = clSetKernelArg(find_neighbors_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(find_neighbors_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(find_neighbors_kernel, 2, sizeof(cl_mem), (void *)&table_mem);
-    ret = clSetKernelArg(find_neighbors_kernel, 3, sizeof(cl_mem), (void *)&table_count_mem);
-    ret = clSetKernelArg(find_neighbors_kernel, 4, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(find_neighbors_kernel, 5, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 3, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 4, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 5, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 6, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(find_neighbors_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
+
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 2, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 3, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 4, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 5, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 6, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 7, table_list_size * sizeof(cl_int), NULL);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 8, table_list_size * sizeof(cl_float3), NULL);
+    ret = clSetKernelArg(find_neighbors_tiled_kernel, 9, table_list_size * sizeof(cl_float), NULL);
+
+    // The sleep thresholds (arguments 6 and 7) are set by update_sleeping
+    ret = clSetKernelArg(compute_cell_activity_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(compute_cell_activity_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_cell_activity_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(compute_cell_activity_kernel, 3, sizeof(cl_mem), (void *)&v_mem);
+    ret = clSetKernelArg(compute_cell_activity_kernel, 4, sizeof(cl_mem), (void *)&pressure_mem);
+    ret = clSetKernelArg(compute_cell_activity_kernel, 5, sizeof(cl_mem), (void *)&cell_activity_mem);
+
+    ret = clSetKernelArg(update_sleeping_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 3, sizeof(cl_mem), (void *)&cell_activity_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 4, sizeof(cl_mem), (void *)&active_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 5, sizeof(cl_mem), (void *)&nb_active_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 6, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 7, sizeof(cl_mem), (void *)&v_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 8, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 9, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 10, sizeof(cl_mem), (void *)&lambda_mem);
+    ret = clSetKernelArg(update_sleeping_kernel, 11, sizeof(cl_mem), (void *)&dp_mem);
+
+    // The tiled search needs a whole bucket in a single work-group
+    size_t max_group_size;
+    ret = clGetKernelWorkGroupInfo(find_neighbors_tiled_kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, NULL);
+    if (ret != CL_SUCCESS || max_group_size < (size_t)table_list_size) {
+        std::cout << "Tiled neighbor search unavailable (max work-group size " << max_group_size << ")" << std::endl;
+        tiled_neighbors_available = false;
+        tiled_neighbors = false;
+    }
 }
 
 void OCLHelper::init_solver_program(){
@@ -97,26 +230,58 @@ void OCLHelper::init_solver_program(){
     compute_dp_kernel = clCreateKernel(solver_program, "compute_dp", &ret);
     solve_collisions_kernel = clCreateKernel(solver_program, "solve_collisions", &ret);
     add_position_correction_kernel = clCreateKernel(solver_program, "add_position_correction", &ret);
+    compute_constraints_grid_kernel = clCreateKernel(solver_program, "compute_constraints_grid", &ret);
+    compute_dp_grid_kernel = clCreateKernel(solver_program, "compute_dp_grid", &ret);
 
     ret = clSetKernelArg(compute_constraints_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(compute_constraints_kernel, 1, sizeof(cl_mem), (void *)&q_mem);
-    ret = clSetKernelArg(compute_constraints_kernel, 2, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(compute_constraints_kernel, 3, sizeof(cl_mem), (void *)&n_neighbors_mem);
-    ret = clSetKernelArg(compute_constraints_kernel, 4, sizeof(cl_mem), (void *)&lambda_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 2, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 3, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 4, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 5, sizeof(cl_mem), (void *)&lambda_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 6, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(compute_constraints_kernel, 7, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(compute_dp_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(compute_dp_kernel, 1, sizeof(cl_mem), (void *)&q_mem);
-    ret = clSetKernelArg(compute_dp_kernel, 2, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(compute_dp_kernel, 3, sizeof(cl_mem), (void *)&n_neighbors_mem);
-    ret = clSetKernelArg(compute_dp_kernel, 4, sizeof(cl_mem), (void *)&lambda_mem);
-    ret = clSetKernelArg(compute_dp_kernel, 5, sizeof(cl_mem), (void *)&dp_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 2, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 3, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 4, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 5, sizeof(cl_mem), (void *)&lambda_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 6, sizeof(cl_mem), (void *)&dp_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(compute_dp_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(solve_collisions_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(solve_collisions_kernel, 1, sizeof(cl_mem), (void *)&q_mem);
-    ret = clSetKernelArg(solve_collisions_kernel, 2, sizeof(cl_mem), (void *)&dp_mem);
+    ret = clSetKernelArg(solve_collisions_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(solve_collisions_kernel, 2, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(solve_collisions_kernel, 3, sizeof(cl_mem), (void *)&dp_mem);
+    ret = clSetKernelArg(solve_collisions_kernel, 4, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(add_position_correction_kernel, 0, sizeof(cl_mem), (void *)&dp_mem);
     ret = clSetKernelArg(add_position_correction_kernel, 1, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(add_position_correction_kernel, 2, sizeof(cl_mem), (void *)&active_mem);
+
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 3, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 4, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 5, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 6, sizeof(cl_mem), (void *)&lambda_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(compute_constraints_grid_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
+
+    ret = clSetKernelArg(compute_dp_grid_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 3, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 4, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 5, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 6, sizeof(cl_mem), (void *)&lambda_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 7, sizeof(cl_mem), (void *)&dp_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 8, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(compute_dp_grid_kernel, 9, sizeof(cl_mem), (void *)&active_mem);
 }
 
 void OCLHelper::init_speed_program(){
@@ -129,44 +294,109 @@ void OCLHelper::init_speed_program(){
     apply_vorticity_kernel = clCreateKernel(speed_program, "apply_vorticity", &ret);
     apply_viscosity_kernel = clCreateKernel(speed_program, "apply_viscosity", &ret);
     compute_pressure_kernel = clCreateKernel(speed_program, "compute_pressure", &ret);
+    update_w_grid_kernel = clCreateKernel(speed_program, "update_w_grid", &ret);
+    apply_vorticity_grid_kernel = clCreateKernel(speed_program, "apply_vorticity_grid", &ret);
+    apply_viscosity_grid_kernel = clCreateKernel(speed_program, "apply_viscosity_grid", &ret);
+    compute_pressure_grid_kernel = clCreateKernel(speed_program, "compute_pressure_grid", &ret);
 
     // Set the arguments of the kernels
     ret = clSetKernelArg(befor_solver_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(befor_solver_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(befor_solver_kernel, 2, sizeof(cl_mem), (void *)&v_mem);
-    ret = clSetKernelArg(befor_solver_kernel, 3, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(befor_solver_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(befor_solver_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(befor_solver_kernel, 3, sizeof(cl_mem), (void *)&v_mem);
+    ret = clSetKernelArg(befor_solver_kernel, 4, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(befor_solver_kernel, 5, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(update_position_speed_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(update_position_speed_kernel, 1, sizeof(cl_mem), (void *)&q_mem);
-    ret = clSetKernelArg(update_position_speed_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(update_position_speed_kernel, 3, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(update_position_speed_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(update_position_speed_kernel, 2, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(update_position_speed_kernel, 3, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(update_position_speed_kernel, 4, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(update_position_speed_kernel, 5, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(update_w_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(update_w_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(update_w_kernel, 2, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(update_w_kernel, 3, sizeof(cl_mem), (void *)&n_neighbors_mem);
-    ret = clSetKernelArg(update_w_kernel, 4, sizeof(cl_mem), (void *)&v_copy_mem);
-    ret = clSetKernelArg(update_w_kernel, 5, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(update_w_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(update_w_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(update_w_kernel, 3, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(update_w_kernel, 4, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(update_w_kernel, 5, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(update_w_kernel, 6, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(update_w_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(update_w_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(apply_vorticity_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(apply_vorticity_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(apply_vorticity_kernel, 2, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(apply_vorticity_kernel, 3, sizeof(cl_mem), (void *)&n_neighbors_mem);
-    ret = clSetKernelArg(apply_vorticity_kernel, 4, sizeof(cl_mem), (void *)&v_copy_mem);
-    ret = clSetKernelArg(apply_vorticity_kernel, 5, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 3, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 4, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 5, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 6, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(apply_vorticity_kernel, 7, sizeof(cl_mem), (void *)&active_mem);
 
     ret = clSetKernelArg(apply_viscosity_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(apply_viscosity_kernel, 1, sizeof(cl_mem), (void *)&q_mem);
-    ret = clSetKernelArg(apply_viscosity_kernel, 2, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(apply_viscosity_kernel, 3, sizeof(cl_mem), (void *)&n_neighbors_mem);
-    ret = clSetKernelArg(apply_viscosity_kernel, 4, sizeof(cl_mem), (void *)&v_copy_mem);
-    ret = clSetKernelArg(apply_viscosity_kernel, 5, sizeof(cl_mem), (void *)&v_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 2, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 3, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 4, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 5, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 6, sizeof(cl_mem), (void *)&v_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(apply_viscosity_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
     
     ret = clSetKernelArg(compute_pressure_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
-    ret = clSetKernelArg(compute_pressure_kernel, 1, sizeof(cl_mem), (void *)&p_mem);
-    ret = clSetKernelArg(compute_pressure_kernel, 2, sizeof(cl_mem), (void *)&neighbors_mem);
-    ret = clSetKernelArg(compute_pressure_kernel, 3, sizeof(cl_mem), (void *)&n_neighbors_mem);
-    ret = clSetKernelArg(compute_pressure_kernel, 4, sizeof(cl_mem), (void *)&pressure_mem);
+    ret = clSetKernelArg(compute_pressure_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_pressure_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(compute_pressure_kernel, 3, sizeof(cl_mem), (void *)&neighbors_mem);
+    ret = clSetKernelArg(compute_pressure_kernel, 4, sizeof(cl_mem), (void *)&n_neighbors_mem);
+    ret = clSetKernelArg(compute_pressure_kernel, 5, sizeof(cl_mem), (void *)&pressure_mem);
+    ret = clSetKernelArg(compute_pressure_kernel, 6, sizeof(cl_mem), (void *)&scale_mem);
+
+    ret = clSetKernelArg(update_w_grid_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 3, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 4, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 5, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 6, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(update_w_grid_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
+
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 3, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 4, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 5, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 6, sizeof(cl_mem), (void *)&w_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(apply_vorticity_grid_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
+
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 2, sizeof(cl_mem), (void *)&q_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 3, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 4, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 5, sizeof(cl_mem), (void *)&v_copy_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 6, sizeof(cl_mem), (void *)&v_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 7, sizeof(cl_mem), (void *)&scale_mem);
+    ret = clSetKernelArg(apply_viscosity_grid_kernel, 8, sizeof(cl_mem), (void *)&active_mem);
+
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 0, sizeof(cl_mem), (void *)&sph_param_mem);
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 1, sizeof(cl_mem), (void *)&scene_mem);
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 2, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 3, sizeof(cl_mem), (void *)&table_mem);
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 4, sizeof(cl_mem), (void *)&table_count_mem);
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 5, sizeof(cl_mem), (void *)&pressure_mem);
+    ret = clSetKernelArg(compute_pressure_grid_kernel, 6, sizeof(cl_mem), (void *)&scale_mem);
+}
+
+void OCLHelper::init_init_program(){
+    init_program =  load_source("init_kernels.cl");
+
+    // The arguments depend on the shape and are set by fill_lattice
+    cl_int ret;
+    count_lattice_rows_kernel = clCreateKernel(init_program, "count_lattice_rows", &ret);
+    fill_lattice_rows_kernel = clCreateKernel(init_program, "fill_lattice_rows", &ret);
 }
 
 cl_program OCLHelper::load_source(std::string kernelName){
@@ -199,13 +429,22 @@ cl_program OCLHelper::load_source(std::string kernelName){
 }
 
 
-void OCLHelper::set_sph_param(sph_parameters sph_param){
+void OCLHelper::set_sph_param(sph_parameters sph_param, int scene_id){
     cl_int ret;
-    nb_particles=sph_param.nb_particles;
-    hash_table_size=sph_param.hash_table_size;
-    table_list_size=sph_param.table_list_size;
-    nb_neighbors=sph_param.nb_neighbors;
-    ret = clEnqueueWriteBuffer(command_queue, sph_param_mem, CL_TRUE, 0,  sizeof(sph_param), &sph_param, 0, NULL, NULL);
+    sph_param.first_particle = first_particles[scene_id];
+    if (nb_scenes == 1) {
+        sph_param.nb_particles = nb_particles;
+    }
+    // Merged particles have a larger smoothing length, the neighbors are searched up to the largest one
+    sph_param.search_radius = sph_param.h * (adaptive_resolution || nb_merged > 0 ? merged_h_scale : 1.0f);
+    // A change of the external force wakes all the sleeping particles
+    gravity.resize(nb_scenes);
+    const vec3 g = {sph_param.gx, sph_param.gy, sph_param.gz};
+    if (sleeping && !is_equal(g, gravity[scene_id])) {
+        wake_all();
+    }
+    gravity[scene_id] = g;
+    ret = clEnqueueWriteBuffer(command_queue, sph_param_mem, CL_TRUE, scene_id * sizeof(sph_param),  sizeof(sph_param), &sph_param, 0, NULL, NULL);
 }
 
 
@@ -213,29 +452,37 @@ void OCLHelper::make_neighboors(){
     auto t1 = std::chrono::high_resolution_clock::now();
     
     cl_int zero = 0;
-    cl_int ret = clEnqueueFillBuffer(command_queue, table_count_mem, &zero, sizeof(zero), 0, sizeof(cl_int) * hash_table_size, 0, NULL, NULL);
-    ret = clEnqueueFillBuffer(command_queue, n_neighbors_mem, &zero, sizeof(zero), 0, sizeof(cl_int) * nb_particles, 0, NULL, NULL);
+    cl_int ret = clEnqueueFillBuffer(command_queue, table_count_mem, &zero, sizeof(zero), 0, sizeof(cl_int) * nb_scenes * hash_table_size, 0, NULL, NULL);
 
     cl_event  barrier;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
 
-    size_t global_item_size = nb_particles;
+    size_t global_item_size = nb_work_items(nb_particles);
+    size_t active_item_size = nb_work_items(nb_active);
     cl_event  last_kernel;
 
     clFinish(command_queue);
     auto t2 = std::chrono::high_resolution_clock::now();
 
 
-    ret = clEnqueueNDRangeKernel(command_queue, fill_hashmap_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &barrier, &last_kernel);
+    ret = enqueue_kernel(fill_hashmap_kernel,
+            global_item_size, local_item_size, 1, &barrier, &last_kernel);
 
     clFinish(command_queue);
     auto t3 = std::chrono::high_resolution_clock::now();
 
 
-    ret = clEnqueueNDRangeKernel(command_queue, find_neighbors_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel, NULL);
-    
+    if (grid_neighbors) {
+        // The kernels will iterate the hashmap directly
+    } else if (tiled_neighbors && tiled_neighbors_available) {
+        size_t bucket_item_size = table_list_size;
+        size_t table_item_size = nb_scenes * hash_table_size * bucket_item_size;
+        ret = enqueue_kernel(find_neighbors_tiled_kernel,
+                table_item_size, bucket_item_size, 1, &last_kernel, NULL);
+    } else {
+        ret = enqueue_kernel(find_neighbors_kernel,
+                active_item_size, local_item_size, 1, &last_kernel, NULL);
+    }
 
     clFinish(command_queue);
     auto t4 = std::chrono::high_resolution_clock::now();
@@ -249,16 +496,16 @@ void OCLHelper::solver_step(){
     cl_int ret;
     cl_event  barrier;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
-    size_t global_item_size = nb_particles;
+    size_t global_item_size = nb_work_items(nb_active);
     cl_event  last_kernel;
-    ret = clEnqueueNDRangeKernel(command_queue, compute_constraints_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &barrier, &last_kernel);
-    ret = clEnqueueNDRangeKernel(command_queue, compute_dp_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel,  &last_kernel);
-    ret = clEnqueueNDRangeKernel(command_queue, solve_collisions_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel,  &last_kernel);
-    ret = clEnqueueNDRangeKernel(command_queue, add_position_correction_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel,  &last_kernel);
+    ret = enqueue_kernel(grid_neighbors ? compute_constraints_grid_kernel : compute_constraints_kernel,
+            global_item_size, local_item_size, 1, &barrier, &last_kernel);
+    ret = enqueue_kernel(grid_neighbors ? compute_dp_grid_kernel : compute_dp_kernel,
+            global_item_size, local_item_size, 1, &last_kernel,  &last_kernel);
+    ret = enqueue_kernel(solve_collisions_kernel,
+            global_item_size, local_item_size, 1, &last_kernel,  &last_kernel);
+    ret = enqueue_kernel(add_position_correction_kernel,
+            global_item_size, local_item_size, 1, &last_kernel,  &last_kernel);
     
 
     clFinish(command_queue);
@@ -268,17 +515,265 @@ void OCLHelper::update_speed(){
     cl_int ret;
     cl_event  barrier;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
-    size_t global_item_size = nb_particles;
+    size_t global_item_size = nb_work_items(nb_active);
     cl_event  last_kernel;
 
-    ret = clEnqueueNDRangeKernel(command_queue, update_position_speed_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &barrier, &last_kernel);
-    ret = clEnqueueNDRangeKernel(command_queue, update_w_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel,  &last_kernel);
-    ret = clEnqueueNDRangeKernel(command_queue, apply_vorticity_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel,  &last_kernel);
-    ret = clEnqueueNDRangeKernel(command_queue, apply_viscosity_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &last_kernel,  &last_kernel);
+    ret = enqueue_kernel(update_position_speed_kernel,
+            global_item_size, local_item_size, 1, &barrier, &last_kernel);
+    if (grid_neighbors) {
+        // The particles moved: the hashmap is refilled so that the cells match the new positions
+        fill_hashmap(1, &last_kernel, &last_kernel);
+    }
+    ret = enqueue_kernel(grid_neighbors ? update_w_grid_kernel : update_w_kernel,
+            global_item_size, local_item_size, 1, &last_kernel,  &last_kernel);
+    ret = enqueue_kernel(grid_neighbors ? apply_vorticity_grid_kernel : apply_vorticity_kernel,
+            global_item_size, local_item_size, 1, &last_kernel,  &last_kernel);
+    ret = enqueue_kernel(grid_neighbors ? apply_viscosity_grid_kernel : apply_viscosity_kernel,
+            global_item_size, local_item_size, 1, &last_kernel,  &last_kernel);
+}
+
+// One full time step: prediction, neighbors, solver iterations and velocity update
+void OCLHelper::step(size_t solver_iterations){
+    befor_solver();
+    make_neighboors();
+    for (size_t k = 0; k < solver_iterations; k++)
+        solver_step();
+    update_speed();
+    if (sleeping) {
+        update_sleeping();
+    }
+}
+
+// Enqueue a 1D kernel, and hand its event to the profiler when there is one
+cl_int OCLHelper::enqueue_kernel(cl_kernel kernel, size_t global_item_size, size_t local_size, cl_uint nb_wait, const cl_event* wait, cl_event* event){
+    if (profiler == NULL) {
+        return check_error(clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global_item_size, &local_size, nb_wait, wait, event));
+    }
+    cl_event kernel_event;
+    cl_int ret = check_error(clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global_item_size, &local_size, nb_wait, wait, &kernel_event));
+    if (ret == CL_SUCCESS) {
+        profiler->add_kernel_event(kernel, kernel_event);
+        if (event != NULL) {
+            *event = kernel_event;
+        } else {
+            clReleaseEvent(kernel_event);
+        }
+    }
+    return ret;
+}
+
+// Keep the first failure in error
+cl_int OCLHelper::check_error(cl_int ret){
+    if (ret != CL_SUCCESS && error == CL_SUCCESS) {
+        error = ret;
+    }
+    return ret;
+}
+
+void OCLHelper::fill_hashmap(cl_uint nb_wait, const cl_event* wait, cl_event* event){
+    cl_int zero = 0;
+    cl_event cleared;
+    size_t global_item_size = nb_work_items(nb_particles);
+    check_error(clEnqueueFillBuffer(command_queue, table_count_mem, &zero, sizeof(zero), 0, sizeof(cl_int) * nb_scenes * hash_table_size, nb_wait, wait, &cleared));
+    enqueue_kernel(fill_hashmap_kernel,
+            global_item_size, local_item_size, 1, &cleared, event);
+}
+
+// Put the calm regions to sleep: a hashmap bucket is calm when the speed and the density error of all its particles
+// are below sleep_speed and sleep_density_error. The particles with only calm buckets around them are frozen,
+// the other ones form the active list processed by the next step.
+void OCLHelper::update_sleeping(){
+    cl_int zero = 0;
+    check_error(clEnqueueFillBuffer(command_queue, cell_activity_mem, &zero, sizeof(zero), 0, sizeof(cl_int) * nb_scenes * hash_table_size, 0, NULL, NULL));
+    check_error(clEnqueueFillBuffer(command_queue, nb_active_mem, &zero, sizeof(zero), 0, sizeof(cl_int), 0, NULL, NULL));
+
+    cl_event  last_kernel;
+    check_error(clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &last_kernel));
+    if (!grid_neighbors) {
+        // The density is evaluated from the hashmap, which must match the new positions
+        fill_hashmap(1, &last_kernel, &last_kernel);
+    }
+    size_t global_item_size = nb_work_items(nb_particles);
+    enqueue_kernel(compute_pressure_grid_kernel,
+            global_item_size, local_item_size, 1, &last_kernel, &last_kernel);
+    check_error(clSetKernelArg(compute_cell_activity_kernel, 6, sizeof(cl_float), &sleep_speed));
+    check_error(clSetKernelArg(compute_cell_activity_kernel, 7, sizeof(cl_float), &sleep_density_error));
+    enqueue_kernel(compute_cell_activity_kernel,
+            global_item_size, local_item_size, 1, &last_kernel, &last_kernel);
+    enqueue_kernel(update_sleeping_kernel,
+            global_item_size, local_item_size, 1, &last_kernel, &last_kernel);
+    check_error(clEnqueueReadBuffer(command_queue, nb_active_mem, CL_TRUE, 0, sizeof(cl_int), &nb_active, 1, &last_kernel, NULL));
+
+    // The work size is rounded up: the extra work-items find -1 in the list and return
+    cl_int none = -1;
+    const size_t active_item_size = nb_work_items(nb_active);
+    if (active_item_size > size_t(nb_active)) {
+        check_error(clEnqueueFillBuffer(command_queue, active_mem, &none, sizeof(none), nb_active * sizeof(cl_int), (active_item_size - nb_active) * sizeof(cl_int), 0, NULL, NULL));
+    }
+}
+
+// Lattice spacing for which the density of an interior particle (sum over its neighbors, as in compute_constraints) is rho0
+float OCLHelper::rest_spacing(const sph_parameters& sph_param){
+    const float h = sph_param.h;
+    auto density = [&](float spacing){
+        const int n = int(h/spacing) + 1;
+        float rho = 0;
+        for (int x = -n; x <= n; x++)
+            for (int y = -n; y <= n; y++)
+                for (int z = -n; z <= n; z++)
+                {
+                    const float d = spacing * std::sqrt(float(x*x + y*y + z*z));
+                    if ((x != 0 || y != 0 || z != 0) && d <= h) {
+                        const float b = 1 - (d/h)*(d/h);
+                        rho += sph_param.m * 315.0f/(64.0f*3.1415926535f*h*h*h) * b*b*b;
+                    }
+                }
+        return rho;
+    };
+
+    // The density decreases with the spacing
+    float low = 0.2f*h, high = h;
+    for (int k = 0; k < 30; k++)
+    {
+        const float spacing = 0.5f*(low + high);
+        if (density(spacing) > sph_param.rho0)
+            low = spacing;
+        else
+            high = spacing;
+    }
+    return 0.5f*(low + high);
+}
+
+int OCLHelper::fill_box(const sph_parameters& sph_param, const vec3& p_min, const vec3& p_max, int first_particle, int max_particles, cl_uint seed){
+    init_parameters param = {};
+    param.shape = 0;
+    param.first_particle = first_particle;
+    param.max_particles = max_particles;
+    param.seed = seed;
+    return fill_lattice(param, sph_param, p_min, p_max, {});
+}
+
+int OCLHelper::fill_sphere(const sph_parameters& sph_param, const vec3& center, float radius, int first_particle, int max_particles, cl_uint seed){
+    init_parameters param = {};
+    param.shape = 1;
+    param.first_particle = first_particle;
+    param.max_particles = max_particles;
+    param.seed = seed;
+    param.cx = center.x;
+    param.cy = center.y;
+    param.cz = center.z;
+    param.radius = radius;
+    return fill_lattice(param, sph_param, center - vec3(radius, radius, radius), center + vec3(radius, radius, radius), {});
+}
+
+int OCLHelper::fill_voxels(const sph_parameters& sph_param, const buffer3D<unsigned char>& voxels, const vec3& origin, float voxel_size, int first_particle, int max_particles, cl_uint seed){
+    init_parameters param = {};
+    param.shape = 2;
+    param.first_particle = first_particle;
+    param.max_particles = max_particles;
+    param.seed = seed;
+    param.vx = voxels.dimension[0];
+    param.vy = voxels.dimension[1];
+    param.vz = voxels.dimension[2];
+    param.voxel_ox = origin.x;
+    param.voxel_oy = origin.y;
+    param.voxel_oz = origin.z;
+    param.voxel_size = voxel_size;
+    const vec3 extent = voxel_size * vec3(param.vx, param.vy, param.vz);
+    return fill_lattice(param, sph_param, origin, origin + extent, std::vector<cl_uchar>(voxels.begin(), voxels.end()));
+}
+
+// Count the lattice nodes inside the shape per row, turn the counts into offsets on the CPU (there are only ny*nz rows),
+// then write the particles. The order of the particles does not depend on the scheduling of the work-items.
+int OCLHelper::fill_lattice(init_parameters param, const sph_parameters& sph_param, const vec3& p_min, const vec3& p_max, const std::vector<cl_uchar>& voxels){
+    param.spacing = rest_spacing(sph_param);
+    param.jitter = init_jitter;
+    param.nx = std::max(int((p_max.x - p_min.x) / param.spacing), 0);
+    param.ny = std::max(int((p_max.y - p_min.y) / param.spacing), 0);
+    param.nz = std::max(int((p_max.z - p_min.z) / param.spacing), 0);
+    param.ox = p_min.x;
+    param.oy = p_min.y;
+    param.oz = p_min.z;
+    param.max_particles = std::min(param.max_particles, nb_particles - param.first_particle);
+    const int nb_rows = param.ny * param.nz;
+    if (nb_rows == 0 || param.nx == 0 || param.max_particles <= 0)
+        return 0;
+
+    cl_int ret;
+    cl_mem param_mem = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(init_parameters), NULL, &ret);
+    ret = clEnqueueWriteBuffer(command_queue, param_mem, CL_TRUE, 0, sizeof(init_parameters), &param, 0, NULL, NULL);
+    cl_mem voxels_mem = clCreateBuffer(context, CL_MEM_READ_ONLY, std::max(voxels.size(), size_t(1)), NULL, &ret);
+    if (!voxels.empty()) {
+        ret = clEnqueueWriteBuffer(command_queue, voxels_mem, CL_TRUE, 0, voxels.size(), voxels.data(), 0, NULL, NULL);
+    }
+    cl_mem rows_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, nb_rows * sizeof(cl_int), NULL, &ret);
+
+    size_t global_item_size = nb_work_items(nb_rows);
+    ret = clSetKernelArg(count_lattice_rows_kernel, 0, sizeof(cl_mem), (void *)&param_mem);
+    ret = clSetKernelArg(count_lattice_rows_kernel, 1, sizeof(cl_mem), (void *)&voxels_mem);
+    ret = clSetKernelArg(count_lattice_rows_kernel, 2, sizeof(cl_mem), (void *)&rows_mem);
+    ret = enqueue_kernel(count_lattice_rows_kernel,
+            global_item_size, local_item_size, 0, NULL, NULL);
+
+    std::vector<cl_int> rows(nb_rows);
+    ret = clEnqueueReadBuffer(command_queue, rows_mem, CL_TRUE, 0, nb_rows * sizeof(cl_int), rows.data(), 0, NULL, NULL);
+    int nb_inside = 0;
+    for (cl_int& row : rows)
+    {
+        const int count = row;
+        row = nb_inside;
+        nb_inside += count;
+    }
+    ret = clEnqueueWriteBuffer(command_queue, rows_mem, CL_TRUE, 0, nb_rows * sizeof(cl_int), rows.data(), 0, NULL, NULL);
+
+    ret = clSetKernelArg(fill_lattice_rows_kernel, 0, sizeof(cl_mem), (void *)&param_mem);
+    ret = clSetKernelArg(fill_lattice_rows_kernel, 1, sizeof(cl_mem), (void *)&voxels_mem);
+    ret = clSetKernelArg(fill_lattice_rows_kernel, 2, sizeof(cl_mem), (void *)&rows_mem);
+    ret = clSetKernelArg(fill_lattice_rows_kernel, 3, sizeof(cl_mem), (void *)&p_mem);
+    ret = clSetKernelArg(fill_lattice_rows_kernel, 4, sizeof(cl_mem), (void *)&v_mem);
+    ret = enqueue_kernel(fill_lattice_rows_kernel,
+            global_item_size, local_item_size, 0, NULL, NULL);
+    clFinish(command_queue);
+
+    ret = clReleaseMemObject(param_mem);
+    ret = clReleaseMemObject(voxels_mem);
+    ret = clReleaseMemObject(rows_mem);
+
+    wake_all();
+    return std::min(nb_inside, param.max_particles);
+}
+
+void OCLHelper::reset_simulation(const sph_parameters& sph_param){
+    assert_vcl(nb_scenes == 1, "An ensemble is reset by init_context");
+    assert_vcl(sph_param.nb_particles <= max_particles, "More particles than the buffers of init_context");
+    assert_vcl(sph_param.hash_table_size == hash_table_size && sph_param.table_list_size == table_list_size && sph_param.nb_neighbors == nb_neighbors,
+               "The table sizes are the ones of init_context");
+    nb_particles = sph_param.nb_particles;
+    nb_merged = 0;
+    error = CL_SUCCESS;
+    set_sph_param(sph_param);
+    cl_float2 unit_scale = {{1.0f, 1.0f}};
+    check_error(clEnqueueFillBuffer(command_queue, scale_mem, &unit_scale, sizeof(unit_scale), 0, nb_particles * sizeof(cl_float2), 0, NULL, NULL));
+    wake_all();
+}
+
+// Simulate only the first count particles (single simulation), ex. when the initial shape holds fewer particles than requested
+void OCLHelper::truncate_particles(const sph_parameters& sph_param, int count){
+    assert_vcl(nb_scenes == 1, "The particle count of an ensemble is fixed");
+    nb_particles = std::max(0, std::min(count, nb_particles));
+    set_sph_param(sph_param);
+    wake_all();
+}
+
+// Make all the particles active again
+void OCLHelper::wake_all(){
+    std::vector<cl_int> active(nb_work_items(nb_particles), -1);
+    for (int i = 0; i < nb_particles; i++)
+    {
+        active[i] = i;
+    }
+    nb_active = nb_particles;
+    check_error(clEnqueueWriteBuffer(command_queue, active_mem, CL_TRUE, 0, active.size() * sizeof(cl_int), active.data(), 0, NULL, NULL));
 }
 
 std::vector<vcl::vec3> OCLHelper::get_v(){
@@ -286,8 +781,8 @@ std::vector<vcl::vec3> OCLHelper::get_v(){
     cl_event  barrier;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
     cl_float3 *result = (cl_float3*)malloc(sizeof(cl_float3) * nb_particles);
-    ret = clEnqueueReadBuffer(command_queue, v_mem, CL_TRUE, 0,
-            sizeof(cl_float3) * nb_particles, result, 0, NULL, NULL);
+    ret = check_error(clEnqueueReadBuffer(command_queue, v_mem, CL_TRUE, 0,
+            sizeof(cl_float3) * nb_particles, result, 0, NULL, NULL));
     std::vector<vcl::vec3> res;
     for (size_t i = 0; i < nb_particles; i++)
     {
@@ -302,15 +797,17 @@ std::vector<vcl::vec3> OCLHelper::get_p(){
     cl_int ret;
     cl_event  barrier;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
-    cl_float3 *result = (cl_float3*)malloc(sizeof(cl_float3) * nb_particles);
-    ret = clEnqueueReadBuffer(command_queue, p_mem, CL_TRUE, 0,
-            sizeof(cl_float3) * nb_particles, result, 0, NULL, NULL);
+    // Staging copy in the frame arena, released at the end of the function
+    vcl::frame_arena::scope transient(vcl::default_frame_arena());
+    cl_float3 *result = vcl::default_frame_arena().allocate<cl_float3>(nb_particles);
+    ret = check_error(clEnqueueReadBuffer(command_queue, p_mem, CL_TRUE, 0,
+            sizeof(cl_float3) * nb_particles, result, 0, NULL, NULL));
     std::vector<vcl::vec3> res;
+    res.reserve(nb_particles);
     for (size_t i = 0; i < nb_particles; i++)
     {
         res.push_back(vcl::vec3({result[i].s[0],result[i].s[1],result[i].s[2]}));
     }
-    free(result);
     return res;
 }
 
@@ -336,34 +833,283 @@ void OCLHelper::set_p_v(std::vector<vec3> positions, std::vector<vec3> v){
     ret = clEnqueueWriteBuffer(command_queue, v_mem, CL_TRUE, 0, nb_particles * sizeof(cl_float3), v_array, 0, NULL, NULL);
     free (v_array);
     free(positions_array);
+    wake_all();
 }
 
 void OCLHelper::befor_solver(){
     cl_event  barrier;
     cl_int ret;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
-    size_t global_item_size = nb_particles;
-    ret = clEnqueueNDRangeKernel(command_queue, befor_solver_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &barrier, NULL);
+    size_t global_item_size = nb_work_items(nb_active);
+    ret = enqueue_kernel(befor_solver_kernel,
+            global_item_size, local_item_size, 1, &barrier, NULL);
     clFinish(command_queue);
 }
 
-void OCLHelper::log_pressure(){
+// Density of each particle relative to rho0
+std::vector<float> OCLHelper::get_density(){
     cl_int ret;
     cl_event  barrier;
     ret = clEnqueueBarrierWithWaitList(command_queue, 0, NULL, &barrier);
-    cl_float *result = (cl_float*)malloc(sizeof(cl_float) * nb_particles);
-    size_t global_item_size = nb_particles;
-    ret = clEnqueueNDRangeKernel(command_queue, compute_pressure_kernel, 1, NULL,
-            &global_item_size, &local_item_size, 1, &barrier, &barrier);
-    ret = clEnqueueReadBuffer(command_queue, pressure_mem, CL_TRUE, 0,
-            sizeof(cl_float) * nb_particles, result, 1, &barrier, NULL);
-    for (size_t i = 0; i < nb_particles; i++)
+    std::vector<float> result(nb_particles);
+    size_t global_item_size = nb_work_items(nb_particles);
+    // Sleeping particles have no neighbor list, the hashmap refilled by update_sleeping is used instead
+    const bool use_grid = grid_neighbors || sleeping;
+    ret = enqueue_kernel(use_grid ? compute_pressure_grid_kernel : compute_pressure_kernel,
+            global_item_size, local_item_size, 1, &barrier, &barrier);
+    ret = check_error(clEnqueueReadBuffer(command_queue, pressure_mem, CL_TRUE, 0,
+            sizeof(cl_float) * nb_particles, result.data(), 1, &barrier, NULL));
+    return result;
+}
+
+void OCLHelper::log_pressure(){
+    if (!pressure_log_file.is_open())
+        return;
+    std::vector<float> result = get_density();
+    for (size_t i = 0; i < result.size(); i++)
     {
         pressure_log_file << result[i] << ",";
     }
     pressure_log_file << std::endl;
-    free(result);
+}
+
+// Run the same steps from the current state with and without the neighbor list, and print the timings.
+// The state of the simulation is restored afterwards.
+void OCLHelper::benchmark_neighbor_modes(size_t nb_steps, size_t solver_iterations){
+    begin_neighbor_benchmark(nb_steps, solver_iterations);
+    while (neighbor_benchmark_step(nb_steps)) {}
+}
+
+void OCLHelper::begin_neighbor_benchmark(size_t nb_steps, size_t solver_iterations){
+    if (neighbor_benchmark.running)
+        return;
+    neighbor_benchmark.running = true;
+    neighbor_benchmark.nb_steps = std::max(nb_steps, size_t(1));
+    neighbor_benchmark.solver_iterations = solver_iterations;
+    neighbor_benchmark.p0 = get_p();
+    neighbor_benchmark.v0 = get_v();
+    neighbor_benchmark.grid_neighbors0 = grid_neighbors;
+    neighbor_benchmark.mode = -1;
+
+    std::cout << "*** Neighbor modes benchmark (" << nb_particles << " particles, " << nb_steps << " steps) ***" << std::endl;
+    next_neighbor_benchmark_mode();
+}
+
+// Start the measure of the next mode from the saved state, or restore the state after the last one
+void OCLHelper::next_neighbor_benchmark_mode(){
+    neighbor_benchmark.mode++;
+    if (neighbor_benchmark.mode == 0 && !allocate_neighbor_list) {
+        std::cout << "\t neighbor list: not allocated" << std::endl;
+        neighbor_benchmark.mode++;
+    }
+    neighbor_benchmark.nb_done = 0;
+    neighbor_benchmark.seconds = 0.0;
+    if (neighbor_benchmark.mode < 2) {
+        grid_neighbors = (neighbor_benchmark.mode == 1);
+    } else {
+        grid_neighbors = neighbor_benchmark.grid_neighbors0;
+        neighbor_benchmark.running = false;
+    }
+    set_p_v(neighbor_benchmark.p0, neighbor_benchmark.v0);
+    if (!neighbor_benchmark.running) {
+        neighbor_benchmark.p0.clear();
+        neighbor_benchmark.v0.clear();
+    }
+}
+
+bool OCLHelper::neighbor_benchmark_step(size_t max_steps){
+    if (!neighbor_benchmark.running)
+        return false;
+
+    const size_t nb_steps = std::min(max_steps, neighbor_benchmark.nb_steps - neighbor_benchmark.nb_done);
+    clFinish(command_queue);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (size_t k = 0; k < nb_steps; k++)
+        step(neighbor_benchmark.solver_iterations);
+    clFinish(command_queue);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    neighbor_benchmark.seconds += std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() * 1e-6;
+    neighbor_benchmark.nb_done += nb_steps;
+
+    if (neighbor_benchmark.nb_done == neighbor_benchmark.nb_steps) {
+        const float ms = float(1000.0 * neighbor_benchmark.seconds / neighbor_benchmark.nb_steps);
+        std::cout << "\t " << (grid_neighbors ? "grid (no list)" : "neighbor list") << ": " << ms << " ms/step" << std::endl;
+        next_neighbor_benchmark_mode();
+    }
+    return true;
+}
+
+// Number of work-items of the per-particle kernels: nb_items rounded up to the work-group size (at least one group)
+size_t OCLHelper::nb_work_items(int nb_items) const{
+    return ((std::max(nb_items, 1) + local_item_size - 1) / local_item_size) * local_item_size;
+}
+
+buffer3D<unsigned char> voxelize(const mesh& shape, float voxel_size, vec3& origin){
+    vec3 p_min = shape.position[0], p_max = shape.position[0];
+    for (const vec3& p : shape.position)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            p_min[c] = std::min(p_min[c], p[c]);
+            p_max[c] = std::max(p_max[c], p[c]);
+        }
+    }
+    origin = p_min;
+    const size_t nx = size_t((p_max.x - p_min.x) / voxel_size) + 1;
+    const size_t ny = size_t((p_max.y - p_min.y) / voxel_size) + 1;
+    const size_t nz = size_t((p_max.z - p_min.z) / voxel_size) + 1;
+
+    // Crossings of the triangles with the vertical line through the center of each column
+    std::vector<std::vector<float>> crossings(nx*ny);
+    for (const uint3& t : shape.connectivity)
+    {
+        const vec3& a = shape.position[t[0]];
+        const vec3& b = shape.position[t[1]];
+        const vec3& c = shape.position[t[2]];
+        const float area = (b.x-a.x)*(c.y-a.y) - (c.x-a.x)*(b.y-a.y);
+        if (std::abs(area) < 1e-12f)
+            continue;
+        const int x0 = std::max(int((std::min({a.x, b.x, c.x}) - p_min.x) / voxel_size), 0);
+        const int x1 = std::min(int((std::max({a.x, b.x, c.x}) - p_min.x) / voxel_size), int(nx)-1);
+        const int y0 = std::max(int((std::min({a.y, b.y, c.y}) - p_min.y) / voxel_size), 0);
+        const int y1 = std::min(int((std::max({a.y, b.y, c.y}) - p_min.y) / voxel_size), int(ny)-1);
+        for (int x = x0; x <= x1; x++)
+            for (int y = y0; y <= y1; y++)
+            {
+                const float px = p_min.x + (x + 0.5f) * voxel_size;
+                const float py = p_min.y + (y + 0.5f) * voxel_size;
+                const float u = ((b.x-px)*(c.y-py) - (c.x-px)*(b.y-py)) / area;
+                const float v = ((c.x-px)*(a.y-py) - (a.x-px)*(c.y-py)) / area;
+                const float w = 1 - u - v;
+                if (u >= 0 && v >= 0 && w >= 0)
+                    crossings[x + nx*y].push_back(u*a.z + v*b.z + w*c.z);
+            }
+    }
+
+    buffer3D<unsigned char> voxels(nx, ny, nz);
+    voxels.fill(0);
+    for (size_t x = 0; x < nx; x++)
+        for (size_t y = 0; y < ny; y++)
+        {
+            std::vector<float>& z_list = crossings[x + nx*y];
+            std::sort(z_list.begin(), z_list.end());
+            for (size_t k = 0; k + 1 < z_list.size(); k += 2)
+                for (size_t z = 0; z < nz; z++)
+                {
+                    const float pz = p_min.z + (z + 0.5f) * voxel_size;
+                    if (pz > z_list[k] && pz < z_list[k+1])
+                        voxels(x, y, z) = 1;
+                }
+        }
+    return voxels;
+}
+
+// Deterministic, well spread direction used to split the k-th particle
+static vec3 split_direction(size_t k){
+    const float z = 1.0f - 2.0f * std::fmod(k * 0.618034f, 1.0f);
+    const float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+    const float theta = k * 2.399963f;
+    return {r*std::cos(theta), r*std::sin(theta), z};
+}
+
+// Merge the interior particles by pairs and split the merged particles close to the surface or the camera.
+// The particles are compacted on the CPU and uploaded back, nb_particles is the new number of active particles.
+void OCLHelper::adapt_resolution(const sph_parameters& sph_param, const vcl::vec3& camera_position){
+    if (nb_scenes != 1)
+        return;
+
+    const std::vector<vec3> p = get_p();
+    const std::vector<vec3> v = get_v();
+    const std::vector<float> density = get_density();
+    std::vector<cl_float2> scale(nb_particles);
+    check_error(clEnqueueReadBuffer(command_queue, scale_mem, CL_TRUE, 0, nb_particles * sizeof(cl_float2), scale.data(), 0, NULL, NULL));
+
+    const float h = sph_param.h;
+    auto near_surface = [&](size_t i){
+        return density[i] < adaptive_surface_density || norm(p[i]-camera_position) < adaptive_camera_distance;
+    };
+
+    std::vector<vec3> new_p;
+    std::vector<vec3> new_v;
+    std::vector<cl_float2> new_scale;
+    auto push_particle = [&](const vec3& position, const vec3& speed, float h_scale, float m_scale){
+        new_p.push_back(position);
+        new_v.push_back(speed);
+        cl_float2 s = {{h_scale, m_scale}};
+        new_scale.push_back(s);
+    };
+
+    // Split the merged particles close to the surface (all of them when the adaptive mode is off).
+    // A split adds a particle: the merged particles beyond the capacity of the buffers wait for the next call.
+    std::vector<size_t> candidates;
+    int nb_split = 0;
+    for (size_t i = 0; i < p.size(); i++)
+    {
+        const bool merged = scale[i].s[1] > 1.5f;
+        if (merged && (!adaptive_resolution || near_surface(i)) && nb_particles + nb_split < max_particles) {
+            nb_split++;
+            const vec3 offset = 0.25f * h * split_direction(i);
+            push_particle(p[i] + offset, v[i], 1.0f, 1.0f);
+            push_particle(p[i] - offset, v[i], 1.0f, 1.0f);
+        }
+        else if (!merged && adaptive_resolution && !near_surface(i))
+            candidates.push_back(i);
+        else
+            push_particle(p[i], v[i], scale[i].s[0], scale[i].s[1]);
+    }
+
+    // Merge each interior particle with its closest interior neighbor still available
+    auto cell_key = [](int x, int y, int z){
+        return ((long long)(x & 0x1FFFFF) << 42) | ((long long)(y & 0x1FFFFF) << 21) | (long long)(z & 0x1FFFFF);
+    };
+    std::unordered_map<long long, std::vector<size_t>> grid;
+    for (size_t i : candidates)
+        grid[cell_key(int(std::floor(p[i].x/h)), int(std::floor(p[i].y/h)), int(std::floor(p[i].z/h)))].push_back(i);
+
+    std::vector<bool> used(p.size(), false);
+    for (size_t i : candidates)
+    {
+        if (used[i])
+            continue;
+        used[i] = true;
+
+        const int x = int(std::floor(p[i].x/h)), y = int(std::floor(p[i].y/h)), z = int(std::floor(p[i].z/h));
+        size_t closest = i;
+        float closest_distance = h;
+        for (int dx = -1; dx < 2; dx++)
+            for (int dy = -1; dy < 2; dy++)
+                for (int dz = -1; dz < 2; dz++)
+                {
+                    auto it = grid.find(cell_key(x+dx, y+dy, z+dz));
+                    if (it == grid.end())
+                        continue;
+                    for (size_t j : it->second)
+                    {
+                        const float d = norm(p[j]-p[i]);
+                        if (!used[j] && d < closest_distance) {
+                            closest = j;
+                            closest_distance = d;
+                        }
+                    }
+                }
+
+        if (closest != i) {
+            used[closest] = true;
+            push_particle(0.5f*(p[i]+p[closest]), 0.5f*(v[i]+v[closest]), merged_h_scale, 2.0f);
+        }
+        else
+            push_particle(p[i], v[i], 1.0f, 1.0f);
+    }
+
+    assert_vcl(int(new_p.size()) <= max_particles, "Adaptive resolution beyond the capacity of the particle buffers");
+    nb_particles = new_p.size();
+    nb_merged = 0;
+    for (const cl_float2& s : new_scale)
+        nb_merged += s.s[1] > 1.5f ? 1 : 0;
+
+    set_p_v(new_p, new_v);
+    check_error(clEnqueueWriteBuffer(command_queue, scale_mem, CL_TRUE, 0, nb_particles * sizeof(cl_float2), new_scale.data(), 0, NULL, NULL));
+    set_sph_param(sph_param);
 }
 
 
@@ -374,11 +1120,16 @@ OCLHelper::~OCLHelper(){
 
     ret = clReleaseKernel(fill_hashmap_kernel);
     ret = clReleaseKernel(find_neighbors_kernel);
+    ret = clReleaseKernel(find_neighbors_tiled_kernel);
+    ret = clReleaseKernel(compute_cell_activity_kernel);
+    ret = clReleaseKernel(update_sleeping_kernel);
 
     ret = clReleaseKernel(compute_constraints_kernel);
     ret = clReleaseKernel(compute_dp_kernel);
     ret = clReleaseKernel(solve_collisions_kernel);
     ret = clReleaseKernel(add_position_correction_kernel);
+    ret = clReleaseKernel(compute_constraints_grid_kernel);
+    ret = clReleaseKernel(compute_dp_grid_kernel);
 
     ret = clReleaseKernel(befor_solver_kernel);
     ret = clReleaseKernel(update_position_speed_kernel);
@@ -386,16 +1137,26 @@ OCLHelper::~OCLHelper(){
     ret = clReleaseKernel(update_w_kernel);
     ret = clReleaseKernel(apply_vorticity_kernel);
     ret = clReleaseKernel(compute_pressure_kernel);
+    ret = clReleaseKernel(update_w_grid_kernel);
+    ret = clReleaseKernel(apply_vorticity_grid_kernel);
+    ret = clReleaseKernel(apply_viscosity_grid_kernel);
+    ret = clReleaseKernel(compute_pressure_grid_kernel);
+    ret = clReleaseKernel(count_lattice_rows_kernel);
+    ret = clReleaseKernel(fill_lattice_rows_kernel);
 
     ret = clReleaseProgram(hashmap_program);
     ret = clReleaseProgram(solver_program);
     ret = clReleaseProgram(speed_program);
+    ret = clReleaseProgram(init_program);
 
     ret = clReleaseMemObject(sph_param_mem);
+    ret = clReleaseMemObject(scene_mem);
     ret = clReleaseMemObject(p_mem);
     ret = clReleaseMemObject(table_mem);
     ret = clReleaseMemObject(table_count_mem);
-    ret = clReleaseMemObject(neighbors_mem);
+    if (neighbors_mem != NULL) {
+        ret = clReleaseMemObject(neighbors_mem);
+    }
     ret = clReleaseMemObject(n_neighbors_mem);
     ret = clReleaseMemObject(q_mem);
     ret = clReleaseMemObject(lambda_mem);
@@ -404,6 +1165,10 @@ OCLHelper::~OCLHelper(){
     ret = clReleaseMemObject(v_copy_mem);
     ret = clReleaseMemObject(w_mem);
     ret = clReleaseMemObject(pressure_mem);
+    ret = clReleaseMemObject(scale_mem);
+    ret = clReleaseMemObject(active_mem);
+    ret = clReleaseMemObject(nb_active_mem);
+    ret = clReleaseMemObject(cell_activity_mem);
 
     ret = clFlush(command_queue);
     ret = clFinish(command_queue);
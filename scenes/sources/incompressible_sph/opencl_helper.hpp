@@ -9,6 +9,7 @@
 #include <fstream>
 
 #include "vcl/vcl.hpp"
+#include "sph_profiler.hpp"
 
 // SPH simulation parameters
 struct sph_parameters
@@ -17,10 +18,11 @@ struct sph_parameters
     cl_int hash_table_size=4096;
     cl_int table_list_size=128;
     cl_int nb_neighbors=64;
+    cl_int first_particle=0; // Index of the first particle of the simulation in the ensemble mode
 
     cl_float h = 0.06f;
     cl_float rho0 = 1000.0f;
-    cl_float m; // rho0*h*h*h
+    cl_float m = 0.0f; // rho0*h*h*h, computed by the scenes when 0
     cl_float epsilon = 1e-3f;
     cl_float c = 0.2;
     cl_float dt = 0.02f;
@@ -28,23 +30,111 @@ struct sph_parameters
     cl_float gx = 0.0f;
     cl_float gy = -h*100.0f;
     cl_float gz = 0.0f;
+    cl_float search_radius; // Set by OCLHelper::set_sph_param
 };
 
 
+// Shape filled by the initialisation kernels, same layout as in kernels/init_kernels.cl
+struct init_parameters
+{
+    cl_int shape; // 0: box, 1: sphere, 2: voxel grid
+    cl_int nx; // lattice size
+    cl_int ny;
+    cl_int nz;
+    cl_int first_particle;
+    cl_int max_particles;
+    cl_uint seed;
+
+    cl_float spacing;
+    cl_float jitter; // relative to the spacing
+    cl_float ox; // lattice origin
+    cl_float oy;
+    cl_float oz;
+
+    cl_float cx; // sphere center and radius
+    cl_float cy;
+    cl_float cz;
+    cl_float radius;
+
+    cl_int vx; // voxel grid size, origin and voxel size
+    cl_int vy;
+    cl_int vz;
+    cl_float voxel_ox;
+    cl_float voxel_oy;
+    cl_float voxel_oz;
+    cl_float voxel_size;
+};
+
+// Inside/outside voxelisation of a closed mesh (parity of the crossings along z). origin is set to the corner of the grid.
+vcl::buffer3D<unsigned char> voxelize(const vcl::mesh& shape, float voxel_size, vcl::vec3& origin);
+
+
 struct OCLHelper {
     std::string kernel_paths = "scenes/sources/incompressible_sph/kernels/";
     cl_context context;
     cl_device_id device_id = NULL;
     cl_command_queue command_queue;
 
+    // Create the command queue with profiling enabled (set before init_context), the kernel events are then
+    // recorded by profiler when it is set
+    bool profiling = false;
+    sph_profiler* profiler = NULL;
+    // Start (profiler_arg) or stop (NULL) the recording after init_context: the command queue is recreated
+    void set_profiler(sph_profiler* profiler_arg);
+
+    // Device used by init_context: the device_index-th device of type device_type over all the platforms
+    // (modulo the number of devices)
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+    int device_index = 0;
+
+    // First error returned by the context creation, a kernel enqueue or a read of the results (CL_SUCCESS if none)
+    cl_int error = CL_SUCCESS;
+    cl_int check_error(cl_int ret); // record ret in error if it is the first failure, and return it
+
     int nb_particles;
     int hash_table_size;
     int table_list_size;
     int nb_neighbors;
 
+    // Ensemble mode: independent simulations sharing the buffers, particle i belongs to the simulation scene[i].
+    // first_particles[k] is the offset of the particles of the simulation k.
+    // The total number of particles must stay a multiple of local_item_size.
+    int nb_scenes = 1;
+    std::vector<int> first_particles;
     size_t local_item_size = 128;
 
+    // Use the work-group cooperative neighbor search (one work-group per hashmap bucket)
+    bool tiled_neighbors = true;
+    // Set by init_context: the device can run a whole bucket in one work-group
+    bool tiled_neighbors_available = true;
+
+    // Neighbor-list-free mode: the solver and speed kernels iterate the hashmap cells on the fly
+    bool grid_neighbors = false;
+    // Allocate the explicit neighbor list (nb_particles * nb_neighbors ints), set before init_context.
+    // Without it, only the neighbor-list-free mode is available.
+    bool allocate_neighbor_list = true;
+
+    // Adaptive resolution (single simulation only): pairs of interior particles are merged into particles of mass 2m
+    // and smoothing length merged_h_scale*h, which are split back when they get close to the surface or the camera.
+    // A particle is considered at the surface when its relative density is below adaptive_surface_density.
+    bool adaptive_resolution = false;
+    float adaptive_surface_density = 0.8f;
+    float adaptive_camera_distance = 0.5f;
+    const float merged_h_scale = 1.259921f; // cbrt(2)
+    int max_particles; // capacity of the particle buffers: splits never make nb_particles exceed it
+    int nb_merged = 0;
+
+    // Sleeping regions: the particles of the calm hashmap buckets (and of their neighbors) are frozen and skipped by the
+    // solver, the other ones are listed in active_mem. A bucket is calm when its particles move slower than sleep_speed
+    // and their relative density error is below sleep_density_error. A change of gravity wakes everything.
+    bool sleeping = false;
+    float sleep_speed = 0.05f;
+    float sleep_density_error = 0.03f;
+    int nb_active;
+    std::vector<vcl::vec3> gravity;
+
     cl_mem sph_param_mem;
+    cl_mem scene_mem;
     cl_mem p_mem;
     cl_mem table_mem;
     cl_mem table_count_mem;
@@ -57,18 +147,28 @@ struct OCLHelper {
     cl_mem v_copy_mem;
     cl_mem w_mem;
     cl_mem pressure_mem;
+    cl_mem scale_mem; // (smoothing length, mass) of each particle relative to (h, m)
+    cl_mem active_mem; // indices of the active particles, -1 past nb_active
+    cl_mem nb_active_mem;
+    cl_mem cell_activity_mem;
 
     cl_program hashmap_program;
     cl_program solver_program;
     cl_program speed_program;
+    cl_program init_program;
 
     cl_kernel fill_hashmap_kernel;
     cl_kernel find_neighbors_kernel;
+    cl_kernel find_neighbors_tiled_kernel;
+    cl_kernel compute_cell_activity_kernel;
+    cl_kernel update_sleeping_kernel;
 
     cl_kernel compute_constraints_kernel;
     cl_kernel compute_dp_kernel;
     cl_kernel solve_collisions_kernel;
     cl_kernel add_position_correction_kernel;
+    cl_kernel compute_constraints_grid_kernel;
+    cl_kernel compute_dp_grid_kernel;
 
     cl_kernel befor_solver_kernel;
     cl_kernel update_position_speed_kernel;
@@ -76,17 +176,44 @@ struct OCLHelper {
     cl_kernel apply_vorticity_kernel;
     cl_kernel apply_viscosity_kernel;
     cl_kernel compute_pressure_kernel;
+    cl_kernel update_w_grid_kernel;
+    cl_kernel apply_vorticity_grid_kernel;
+    cl_kernel apply_viscosity_grid_kernel;
+    cl_kernel compute_pressure_grid_kernel;
+
+    cl_kernel count_lattice_rows_kernel;
+    cl_kernel fill_lattice_rows_kernel;
 
     float alpha_time = 0.6;
     float nn1_time;
     float nn2_time;
     float nn3_time;
 
+    // Progress of the neighbor modes benchmark: mode 0 is the neighbor list, 1 the neighbor-list-free mode
+    struct neighbor_benchmark_state
+    {
+        bool running = false;
+        int mode = 0;
+        size_t nb_steps = 0;
+        size_t solver_iterations = 0;
+        size_t nb_done = 0;
+        double seconds = 0.0;
+        bool grid_neighbors0 = false;
+        std::vector<vcl::vec3> p0;
+        std::vector<vcl::vec3> v0;
+    };
+    neighbor_benchmark_state neighbor_benchmark;
+
+    std::string pressure_log_path = "pressure_log.csv"; // no log if empty
     std::ofstream pressure_log_file;
 
     void init_context(sph_parameters sph_param);
+    void init_context(std::vector<sph_parameters> ensemble);
+    // New simulation in the context, programs and buffers of init_context (single simulation of at most the initial
+    // number of particles, same table sizes): the particles are then placed by the fill functions
+    void reset_simulation(const sph_parameters& sph_param);
 
-    void set_sph_param(sph_parameters sph_param);
+    void set_sph_param(sph_parameters sph_param, int scene_id = 0);
     void set_p_v(std::vector<vcl::vec3> positions, std::vector<vcl::vec3> v);
     void befor_solver();
     std::vector<vcl::vec3> get_v();
@@ -94,7 +221,29 @@ struct OCLHelper {
     void make_neighboors();
     void solver_step();
     void update_speed();
+    void step(size_t solver_iterations);
+    std::vector<float> get_density();
     void log_pressure();
+    void benchmark_neighbor_modes(size_t nb_steps, size_t solver_iterations);
+    // Same benchmark spread over several calls, to keep the render loop running: begin saves the state, then each
+    // call to neighbor_benchmark_step runs at most max_steps steps. It returns false once the benchmark is over.
+    void begin_neighbor_benchmark(size_t nb_steps, size_t solver_iterations);
+    bool neighbor_benchmark_step(size_t max_steps);
+    bool neighbor_benchmark_running() const { return neighbor_benchmark.running; }
+    void adapt_resolution(const sph_parameters& sph_param, const vcl::vec3& camera_position);
+    void update_sleeping();
+    void wake_all();
+    void truncate_particles(const sph_parameters& sph_param, int count);
+
+    // On-device initialisation: the shape is filled with particles at rest on a jittered lattice whose spacing gives
+    // the rest density. The particles from first_particle are written, at most max_particles of them, lowest layers first.
+    // The jitter comes from a counter-based generator, so a given seed always gives the same particles.
+    // Return the number of particles written.
+    float init_jitter = 0.1f;
+    int fill_box(const sph_parameters& sph_param, const vcl::vec3& p_min, const vcl::vec3& p_max, int first_particle, int max_particles, cl_uint seed = 0);
+    int fill_sphere(const sph_parameters& sph_param, const vcl::vec3& center, float radius, int first_particle, int max_particles, cl_uint seed = 0);
+    int fill_voxels(const sph_parameters& sph_param, const vcl::buffer3D<unsigned char>& voxels, const vcl::vec3& origin, float voxel_size, int first_particle, int max_particles, cl_uint seed = 0);
+    static float rest_spacing(const sph_parameters& sph_param);
 
     ~OCLHelper();
 
@@ -103,6 +252,12 @@ struct OCLHelper {
     void init_hashmap_program();
     void init_solver_program();
     void init_speed_program();
+    void init_init_program();
+    void next_neighbor_benchmark_mode();
+    int fill_lattice(init_parameters param, const sph_parameters& sph_param, const vcl::vec3& p_min, const vcl::vec3& p_max, const std::vector<cl_uchar>& voxels);
+    void fill_hashmap(cl_uint nb_wait, const cl_event* wait, cl_event* event);
+    size_t nb_work_items(int nb_items) const;
+    cl_int enqueue_kernel(cl_kernel kernel, size_t global_item_size, size_t local_size, cl_uint nb_wait, const cl_event* wait, cl_event* event);
 
     cl_program load_source(std::string kernelName);
 };
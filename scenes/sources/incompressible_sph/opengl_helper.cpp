@@ -6,31 +6,63 @@
 
 using namespace vcl;
 
-void OGLHelper::initializeFBO(GLuint fbo[3], bool highResolution, size_t width, size_t height){
+// Pixel format and type matching the internal format of a render target
+static void pixel_format(GLint internalFormat, GLenum& format, GLenum& type){
+  switch(internalFormat){
+    case GL_R16F: case GL_R32F:
+      format = GL_RED; type = GL_FLOAT; break;
+    case GL_RG16F: case GL_RG32F:
+      format = GL_RG; type = GL_FLOAT; break;
+    case GL_RGBA16F: case GL_RGBA32F:
+      format = GL_RGBA; type = GL_FLOAT; break;
+    case GL_RGBA: case GL_RGBA8:
+      format = GL_RGBA; type = GL_UNSIGNED_BYTE; break;
+    default:
+      format = GL_RGB; type = GL_UNSIGNED_BYTE; break;
+  }
+}
+
+void OGLHelper::initializeFBO(GLuint fbo[3], GLint internalFormat, size_t width, size_t height, bool withDepth){
+  GLenum format, type;
+  pixel_format(internalFormat, format, type);
+
   glGenFramebuffers(1, &fbo[0]);
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+  bind_framebuffer(fbo[0]);
 
   glGenTextures(1, &fbo[1]);
-  glBindTexture(GL_TEXTURE_2D, fbo[1]);
-  if(highResolution){
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-  }else{
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-  }
+  bind_texture(fbo[1]);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, GLsizei(width), GLsizei(height), 0, format, type, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  bind_texture(0);
 
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbo[1], 0);
 
-  glGenRenderbuffers(1, &fbo[2]);
-  glBindRenderbuffer(GL_RENDERBUFFER, fbo[2]);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  fbo[2] = 0;
+  if(withDepth){
+    glGenRenderbuffers(1, &fbo[2]);
+    glBindRenderbuffer(GL_RENDERBUFFER, fbo[2]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, GLsizei(width), GLsizei(height));
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, fbo[2]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fbo[2]);
+  }
 
   if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
      std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  bind_framebuffer(0);
+}
+
+void OGLHelper::deleteFBO(GLuint fbo[3]){
+  if(fbo[2] != 0)
+    glDeleteRenderbuffers(1, &fbo[2]);
+  if(fbo[1] != 0)
+    glDeleteTextures(1, &fbo[1]);
+  if(fbo[0] != 0)
+    glDeleteFramebuffers(1, &fbo[0]);
+  fbo[0] = fbo[1] = fbo[2] = 0;
+  // Deleted objects are unbound by GL behind the state cache
+  invalidate_gl_state();
 }
@@ -11,6 +11,9 @@
 
 struct OGLHelper {
 
-  void initializeFBO(GLuint fbo[3], bool highResolution = false, size_t width = 2560, size_t height = 2000);
+  // Render target: fbo[0] framebuffer, fbo[1] color texture of the given internal format (GL_R16F, GL_R32F, GL_RGB8, ...),
+  // fbo[2] depth renderbuffer when withDepth (0 otherwise)
+  void initializeFBO(GLuint fbo[3], GLint internalFormat, size_t width, size_t height, bool withDepth);
+  void deleteFBO(GLuint fbo[3]);
 
 };
@@ -0,0 +1,224 @@
+#include "sph_profiler.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <set>
+
+#include "third_party/imgui/imgui.h"
+
+sph_profiler::scope::scope(sph_profiler& profiler_arg, const std::string& name_arg)
+    :profiler(profiler_arg), name(name_arg), start(profiler_arg.now())
+{}
+
+sph_profiler::scope::~scope()
+{
+    profiler.add_cpu_interval(name, start, profiler.now());
+}
+
+double sph_profiler::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - origin).count() / 1000.0;
+}
+
+static const char* lane_prefix(int lane)
+{
+    const char* prefixes[] = {"cpu: ", "cl: ", "gl: "};
+    return prefixes[lane];
+}
+
+void sph_profiler::begin_frame()
+{
+    current = frame();
+    current.index = gpu.frame_index;
+    current.start = now();
+    in_frame = enabled;
+    gpu.enabled = enabled;
+    gpu.begin_frame();
+}
+
+void sph_profiler::end_frame()
+{
+    gpu.end_frame();
+    if (!in_frame)
+        return;
+    in_frame = false;
+
+    // The kernels are finished once the queue has been waited on by the caller
+    for (pending_kernel& k : pending)
+    {
+        cl_ulong queued = 0, start = 0, end = 0;
+        cl_int ret = clGetEventProfilingInfo(k.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+        ret |= clGetEventProfilingInfo(k.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        ret |= clGetEventProfilingInfo(k.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+        if (ret == CL_SUCCESS)
+            current.intervals.push_back({k.name, 1, k.enqueue_time + (start - queued) / 1000.0, k.enqueue_time + (end - queued) / 1000.0});
+        clReleaseEvent(k.event);
+    }
+    pending.clear();
+
+    current.end = now();
+    frames.push_back(current);
+    while (frames.size() > max_frames)
+        frames.pop_front();
+
+    // Render passes of a previous frame
+    vcl::timer_gpu::frame gpu_frame;
+    if (gpu.pop_result(gpu_frame)) {
+        for (frame& f : frames)
+        {
+            if (f.index != gpu_frame.index)
+                continue;
+            for (const vcl::timer_gpu::interval& i : gpu_frame.intervals)
+                f.intervals.push_back({i.name, 2, f.start + double(GLint64(i.start) - gpu_frame.reference) / 1000.0,
+                                       f.start + double(GLint64(i.end) - gpu_frame.reference) / 1000.0});
+            f.gpu_complete = true;
+        }
+    }
+}
+
+void sph_profiler::add_cpu_interval(const std::string& name, double start, double end)
+{
+    if (in_frame)
+        current.intervals.push_back({name, 0, start, end});
+}
+
+void sph_profiler::add_kernel_event(cl_kernel kernel, cl_event event)
+{
+    if (!in_frame || event == NULL)
+        return;
+
+    auto it = kernel_names.find(kernel);
+    if (it == kernel_names.end()) {
+        char name[128] = {0};
+        clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name)-1, name, NULL);
+        it = kernel_names.insert({kernel, name}).first;
+    }
+    clRetainEvent(event);
+    pending.push_back({it->second, event, now()});
+}
+
+void sph_profiler::draw_gui()
+{
+    ImGui::Begin("Profiler", NULL, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Checkbox("Record", &enabled);
+    if (frames.empty()) {
+        ImGui::Text("No frame recorded");
+        ImGui::End();
+        return;
+    }
+
+    // Frame times
+    std::vector<float> frame_ms;
+    for (const frame& f : frames)
+        frame_ms.push_back(float((f.end - f.start) / 1000.0));
+    const float max_ms = *std::max_element(frame_ms.begin(), frame_ms.end());
+    ImGui::PlotLines("Frame (ms)", frame_ms.data(), int(frame_ms.size()), 0, NULL, 0.0f, max_ms, ImVec2(400, 60));
+
+    // Timeline of the last frame with its render passes: CPU scopes, kernels and render passes on three lanes
+    const frame* last_ptr = &frames.back();
+    for (size_t k = frames.size(); k > 0 && k + 3 > frames.size(); --k)
+    {
+        if (frames[k-1].gpu_complete) {
+            last_ptr = &frames[k-1];
+            break;
+        }
+    }
+    const frame& last = *last_ptr;
+    const float width = 400.0f, lane_height = 18.0f;
+    const double duration = std::max(last.end - last.start, 1.0);
+    ImGui::Text("Last frame: %.2f ms", duration / 1000.0);
+    ImDrawList* draw_list = ImGui::GetWindowDrawList();
+    const ImVec2 origin_px = ImGui::GetCursorScreenPos();
+    ImGui::InvisibleButton("timeline", ImVec2(width, 3*lane_height));
+    const ImVec2 mouse = ImGui::GetIO().MousePos;
+    for (const interval& i : last.intervals)
+    {
+        const float x0 = origin_px.x + float((i.start - last.start) / duration) * width;
+        const float x1 = std::max(origin_px.x + float((i.end - last.start) / duration) * width, x0 + 1.0f);
+        const float y0 = origin_px.y + i.lane * lane_height;
+        const ImU32 colors[] = {IM_COL32(90, 150, 230, 255), IM_COL32(230, 140, 60, 255), IM_COL32(110, 190, 90, 255)};
+        const ImU32 color = colors[i.lane];
+        draw_list->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y0 + lane_height - 2), color);
+        if (ImGui::IsItemHovered() && mouse.x >= x0 && mouse.x <= x1 && mouse.y >= y0 && mouse.y <= y0 + lane_height)
+            ImGui::SetTooltip("%s: %.3f ms", i.name.c_str(), (i.end - i.start) / 1000.0);
+    }
+
+    // Distribution of the duration per frame of one stage
+    std::set<std::string> stage_set;
+    for (const frame& f : frames)
+        for (const interval& i : f.intervals)
+            stage_set.insert(lane_prefix(i.lane) + i.name);
+    const std::vector<std::string> stages(stage_set.begin(), stage_set.end());
+    selected_stage = std::min(selected_stage, int(stages.size()) - 1);
+    if (!stages.empty()) {
+        auto stage_name = [](void* data, int k, const char** text){
+            *text = (*static_cast<const std::vector<std::string>*>(data))[k].c_str();
+            return true;
+        };
+        ImGui::Combo("Stage", &selected_stage, stage_name, (void*)&stages, int(stages.size()));
+
+        std::vector<float> stage_ms;
+        for (const frame& f : frames)
+        {
+            float ms = 0;
+            for (const interval& i : f.intervals)
+                if (lane_prefix(i.lane) + i.name == stages[selected_stage])
+                    ms += float((i.end - i.start) / 1000.0);
+            stage_ms.push_back(ms);
+        }
+        const float stage_max = *std::max_element(stage_ms.begin(), stage_ms.end());
+        float stage_mean = 0;
+        for (float ms : stage_ms)
+            stage_mean += ms / stage_ms.size();
+
+        const int nb_bins = 20;
+        std::vector<float> bins(nb_bins, 0.0f);
+        for (float ms : stage_ms)
+            bins[std::min(int(nb_bins * ms / std::max(stage_max, 1e-6f)), nb_bins-1)] += 1.0f;
+        ImGui::PlotHistogram("Duration", bins.data(), nb_bins, 0, NULL, 0.0f, FLT_MAX, ImVec2(400, 60));
+        ImGui::Text("mean %.3f ms, max %.3f ms", stage_mean, stage_max);
+    }
+
+    // Export
+    ImGui::InputInt("Frames", &export_frames);
+    export_frames = std::max(export_frames, 1);
+    if (ImGui::Button("Export Chrome trace")) {
+        if (export_chrome_trace("sph_trace.json", export_frames))
+            std::cout << "Profile written to sph_trace.json" << std::endl;
+    }
+    ImGui::End();
+}
+
+bool sph_profiler::export_chrome_trace(const std::string& filename, size_t nb_frames) const
+{
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "Cannot write the trace to " << filename << std::endl;
+        return false;
+    }
+
+    const char* lanes[] = {"CPU", "OpenCL", "OpenGL"};
+    std::vector<std::string> events;
+    for (int lane = 0; lane < 3; lane++)
+        events.push_back("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" + std::to_string(lane) + ",\"args\":{\"name\":\"" + lanes[lane] + "\"}}");
+
+    auto complete_event = [&](const std::string& name, const std::string& category, int lane, double start, double end){
+        return "{\"name\":\"" + name + "\",\"cat\":\"" + category + "\",\"ph\":\"X\",\"pid\":0,\"tid\":" + std::to_string(lane)
+               + ",\"ts\":" + std::to_string(start) + ",\"dur\":" + std::to_string(end - start) + "}";
+    };
+    const size_t first = frames.size() > nb_frames ? frames.size() - nb_frames : 0;
+    for (size_t k = first; k < frames.size(); k++)
+    {
+        const frame& f = frames[k];
+        events.push_back(complete_event("frame", "frame", 0, f.start, f.end));
+        for (const interval& i : f.intervals)
+            events.push_back(complete_event(i.name, lanes[i.lane], i.lane, i.start, i.end));
+    }
+
+    file << "{\"traceEvents\":[" << std::endl;
+    for (size_t k = 0; k < events.size(); k++)
+        file << events[k] << (k + 1 < events.size() ? "," : "") << std::endl;
+    file << "]}" << std::endl;
+    return true;
+}
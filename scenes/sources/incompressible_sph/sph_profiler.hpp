@@ -0,0 +1,90 @@
+#pragma once
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+
+#include "vcl/opengl/opengl.hpp"
+
+/** Frame profiler of the SPH scene
+ *
+ * Collects CPU scopes (render passes, host side of the simulation) and the OpenCL events of the kernels
+ * (the command queue must be created with CL_QUEUE_PROFILING_ENABLE). The kernel timestamps are read back
+ * when the frame ends and shifted to the CPU clock, using the host time at which each kernel was enqueued.
+ * The render passes timed with gpu (timer_gpu::scope) are added to their frame one frame later, shifted to the
+ * CPU clock with the GPU time read at the beginning of the frame.
+ * The last max_frames frames are kept for the ImGui window and the Chrome trace export (chrome://tracing).
+ */
+struct sph_profiler
+{
+    // One timed interval, in microseconds since the creation of the profiler
+    struct interval
+    {
+        std::string name;
+        int lane; // 0: CPU, 1: OpenCL, 2: OpenGL
+        double start;
+        double end;
+    };
+
+    struct frame
+    {
+        size_t index;
+        double start;
+        double end;
+        std::vector<interval> intervals;
+        bool gpu_complete = false; // render passes received
+    };
+
+    // Time the enclosing block on the CPU lane
+    struct scope
+    {
+        scope(sph_profiler& profiler, const std::string& name);
+        ~scope();
+
+        sph_profiler& profiler;
+        std::string name;
+        double start;
+    };
+
+    bool enabled = false; // the OpenCL queue of the scene is created with profiling while enabled
+    size_t max_frames = 300;
+    std::deque<frame> frames;
+    vcl::timer_gpu gpu;
+
+    void begin_frame();
+    void end_frame();
+
+    void add_cpu_interval(const std::string& name, double start, double end);
+    // Record a kernel enqueued just before the call, the event is retained until the end of the frame
+    void add_kernel_event(cl_kernel kernel, cl_event event);
+
+    double now() const;
+
+    // Timeline of the last frame, frame times and histogram of the duration of each stage
+    void draw_gui();
+    // Write the last nb_frames frames as Chrome trace events
+    bool export_chrome_trace(const std::string& filename, size_t nb_frames) const;
+
+private:
+    struct pending_kernel
+    {
+        std::string name;
+        cl_event event;
+        double enqueue_time;
+    };
+
+    std::chrono::high_resolution_clock::time_point origin = std::chrono::high_resolution_clock::now();
+    frame current;
+    bool in_frame = false;
+    std::vector<pending_kernel> pending;
+    std::map<cl_kernel, std::string> kernel_names;
+    int export_frames = 60;
+    int selected_stage = 0;
+};
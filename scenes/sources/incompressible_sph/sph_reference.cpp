@@ -0,0 +1,365 @@
+#include "sph_reference.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+using namespace vcl;
+
+float sph_W(float h, const vec3& p)
+{
+    const float d = std::sqrt(dot(p, p));
+    if (d <= h) {
+        const float C = 315.0f/(64.0f*3.1415926535f*std::pow(h, 3.0f));
+        const float a = d/h;
+        const float b = 1-a*a;
+        return C*std::pow(b, 3.0f);
+    }
+    return 0.0f;
+}
+
+vec3 sph_gradW(float h, const vec3& p)
+{
+    const float d = std::sqrt(dot(p, p));
+    if (d < h) {
+        const float C = -6.0f*315.0f/(64.0f*3.1415926535f*std::pow(h, 5.0f));
+        const float a = d/h;
+        const float b = 1-a*a;
+        return C*std::pow(b, 2.0f)*p;
+    }
+    return {0, 0, 0};
+}
+
+// Vector functions with the same definitions as in the .cl files
+static float length(const vec3& p)
+{
+    return std::sqrt(dot(p, p));
+}
+
+// OpenCL normalize returns the zero vector unchanged
+static vec3 normalize_cl(const vec3& p)
+{
+    const float d = length(p);
+    return d > 0 ? p/d : p;
+}
+
+static float clamp(float x, float a, float b)
+{
+    return std::min(std::max(x, a), b);
+}
+
+void sph_reference::initialize(const sph_parameters& param_arg, const std::vector<vec3>& p_arg, const std::vector<vec3>& v_arg)
+{
+    param = param_arg;
+    param.nb_particles = p_arg.size();
+    p = p_arg;
+    v = v_arg;
+    q = p;
+    const size_t N = p.size();
+    v_copy.assign(N, {0, 0, 0});
+    w.assign(N, {0, 0, 0});
+    dp.assign(N, {0, 0, 0});
+    lambda.assign(N, 0.0f);
+    scale.assign(N, {1, 1});
+    neighbors.assign(N, {});
+}
+
+void sph_reference::befor_solver()
+{
+    const vec3 g = {param.gx, param.gy, param.gz};
+    for (size_t i = 0; i < p.size(); i++)
+    {
+        v[i] += param.dt * g;
+        q[i] = p[i] + param.dt * v[i];
+    }
+}
+
+// All the particles closer than the symmetric smoothing length, found through a grid of cell size the largest one
+void sph_reference::make_neighbors()
+{
+    float h_max = 0;
+    for (const vec2& s : scale)
+        h_max = std::max(h_max, param.h * s.x);
+
+    auto cell_key = [](int x, int y, int z){
+        return ((long long)(x & 0x1FFFFF) << 42) | ((long long)(y & 0x1FFFFF) << 21) | (long long)(z & 0x1FFFFF);
+    };
+    std::unordered_map<long long, std::vector<int>> grid;
+    for (size_t i = 0; i < p.size(); i++)
+        grid[cell_key(int(std::floor(p[i].x/h_max)), int(std::floor(p[i].y/h_max)), int(std::floor(p[i].z/h_max)))].push_back(i);
+
+    for (size_t i = 0; i < p.size(); i++)
+    {
+        neighbors[i].clear();
+        const int x = int(std::floor(p[i].x/h_max)), y = int(std::floor(p[i].y/h_max)), z = int(std::floor(p[i].z/h_max));
+        for (int dx = -1; dx < 2; dx++)
+            for (int dy = -1; dy < 2; dy++)
+                for (int dz = -1; dz < 2; dz++)
+                {
+                    auto it = grid.find(cell_key(x+dx, y+dy, z+dz));
+                    if (it == grid.end())
+                        continue;
+                    for (int j : it->second)
+                    {
+                        const vec3 d = p[i] - p[j];
+                        const float hij = 0.5f * param.h * (scale[i].x + scale[j].x);
+                        if (dot(d, d) < hij*hij && int(i) != j)
+                            neighbors[i].push_back(j);
+                    }
+                }
+        // The sums do not depend on the order of the cells
+        std::sort(neighbors[i].begin(), neighbors[i].end());
+    }
+}
+
+void sph_reference::solver_step()
+{
+    const size_t N = p.size();
+
+    // compute_constraints
+    for (size_t i = 0; i < N; i++)
+    {
+        float rho = 0;
+        vec3 ci = {0, 0, 0};
+        float sum = 0;
+        for (int j : neighbors[i])
+        {
+            const float h = 0.5f * param.h * (scale[i].x + scale[j].x);
+            const float mj = param.m * scale[j].y;
+            rho += mj * sph_W(h, q[i] - q[j]);
+            const vec3 grad_ij = mj * sph_gradW(h, q[i] - q[j]);
+            ci += grad_ij;
+            sum += dot(grad_ij, grad_ij);
+        }
+        sum += dot(ci, ci);
+        const float mi = param.m * scale[i].y;
+        lambda[i] = - (rho - param.rho0) * param.rho0 / (sum + param.epsilon * mi * mi);
+    }
+
+    // compute_dp
+    for (size_t i = 0; i < N; i++)
+    {
+        dp[i] = {0, 0, 0};
+        for (int j : neighbors[i])
+        {
+            const float h = 0.5f * param.h * (scale[i].x + scale[j].x);
+            const vec3 dq = {0.1f*h, 0, 0};
+            const float s = - 0.1f * std::pow(sph_W(h, q[i] - q[j])/sph_W(h, dq), 4.0f);
+            dp[i] += param.m * scale[j].y * (lambda[i] + lambda[j] + s) * sph_gradW(h, q[i] - q[j]);
+        }
+        dp[i] /= param.rho0;
+        float d = length(dp[i]);
+        d = d < param.h * param.max_relative_dp ? 1 : d / (param.h * param.max_relative_dp);
+        dp[i] /= d;
+    }
+
+    // solve_collisions
+    const float eps = 0.01f;
+    for (size_t i = 0; i < N; i++)
+    {
+        vec3 d = q[i] + dp[i];
+        const float offset = eps * (float(i) / float(param.nb_particles));
+        for (int c = 0; c < 3; c++)
+            d[c] = clamp(d[c], -1.0f + 0.3f*param.h + offset, 1.0f - 0.3f*param.h - offset);
+        dp[i] = d - q[i];
+    }
+
+    // add_position_correction
+    for (size_t i = 0; i < N; i++)
+        q[i] += dp[i];
+}
+
+void sph_reference::update_speed()
+{
+    const size_t N = p.size();
+
+    // update_position_speed
+    for (size_t i = 0; i < N; i++)
+    {
+        v_copy[i] = (q[i] - p[i])/param.dt;
+        p[i] = q[i];
+    }
+    if (grid_neighbors)
+        make_neighbors();
+
+    // update_w
+    for (size_t i = 0; i < N; i++)
+    {
+        w[i] = {0, 0, 0};
+        for (int j : neighbors[i])
+        {
+            const float h = 0.5f * param.h * (scale[i].x + scale[j].x);
+            w[i] += - param.m * scale[j].y * cross(v_copy[j]-v_copy[i], sph_gradW(h, p[i]-p[j]));
+        }
+    }
+
+    // apply_vorticity (in place, as on the device the kernel only reads v_copy[i])
+    for (size_t i = 0; i < N; i++)
+    {
+        vec3 eta = {0, 0, 0};
+        for (int j : neighbors[i])
+            eta += (length(w[j])-length(w[i]))/(length(p[j]-p[i])*length(p[j]-p[i]))*(p[j]-p[i]);
+        eta = normalize_cl(eta);
+        v_copy[i] += param.dt*param.h*0.001f*cross(eta, w[i]);
+    }
+
+    // apply_viscosity
+    for (size_t i = 0; i < N; i++)
+    {
+        float alpha = 0;
+        v[i] = {0, 0, 0};
+        for (int j : neighbors[i])
+        {
+            const float h = 0.5f * param.h * (scale[i].x + scale[j].x);
+            const float dalpha = param.c * scale[j].y * sph_W(h, p[i] - p[j]) / sph_W(h, vec3(0, 0, 0));
+            v[i] += dalpha * v_copy[j];
+            alpha += dalpha;
+        }
+        v[i] += (1-alpha) * v_copy[i];
+    }
+}
+
+void sph_reference::step(size_t solver_iterations)
+{
+    befor_solver();
+    make_neighbors();
+    for (size_t k = 0; k < solver_iterations; k++)
+        solver_step();
+    update_speed();
+}
+
+std::vector<float> sph_reference::density() const
+{
+    std::vector<float> result(p.size());
+    for (size_t i = 0; i < p.size(); i++)
+    {
+        float rho = 0;
+        for (int j : neighbors[i])
+            rho += scale[j].y * sph_W(0.5f * param.h * (scale[i].x + scale[j].x), p[i] - p[j]);
+        result[i] = rho * param.m / param.rho0;
+    }
+    return result;
+}
+
+
+static buffer_difference compare_values(const std::string& name, const std::vector<float>& diff, std::vector<float> a, std::vector<float> b)
+{
+    buffer_difference result = {name, 0, 0, 0, 0};
+    for (float d : diff)
+    {
+        result.max = std::max(result.max, d);
+        result.rms += d*d;
+    }
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        const float d = std::abs(a[i] - b[i]);
+        result.sorted_max = std::max(result.sorted_max, d);
+        result.sorted_rms += d*d;
+    }
+    if (!diff.empty()) {
+        result.rms = std::sqrt(result.rms / diff.size());
+        result.sorted_rms = std::sqrt(result.sorted_rms / diff.size());
+    }
+    return result;
+}
+
+buffer_difference compare_buffers(const std::string& name, const std::vector<vec3>& a, const std::vector<vec3>& b)
+{
+    assert_vcl(a.size() == b.size(), "Buffers "+name+" of different sizes");
+    std::vector<float> diff, norm_a, norm_b;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        diff.push_back(length(a[i] - b[i]));
+        norm_a.push_back(length(a[i]));
+        norm_b.push_back(length(b[i]));
+    }
+    return compare_values(name, diff, norm_a, norm_b);
+}
+
+buffer_difference compare_buffers(const std::string& name, const std::vector<float>& a, const std::vector<float>& b)
+{
+    assert_vcl(a.size() == b.size(), "Buffers "+name+" of different sizes");
+    std::vector<float> diff;
+    for (size_t i = 0; i < a.size(); i++)
+        diff.push_back(std::abs(a[i] - b[i]));
+    return compare_values(name, diff, a, b);
+}
+
+static std::vector<vec3> read_float3(OCLHelper& solver, cl_mem buffer)
+{
+    std::vector<cl_float3> values(solver.nb_particles);
+    clEnqueueReadBuffer(solver.command_queue, buffer, CL_TRUE, 0, values.size() * sizeof(cl_float3), values.data(), 0, NULL, NULL);
+    std::vector<vec3> result;
+    for (const cl_float3& x : values)
+        result.push_back({x.s[0], x.s[1], x.s[2]});
+    return result;
+}
+
+static std::vector<float> read_float(OCLHelper& solver, cl_mem buffer)
+{
+    std::vector<float> result(solver.nb_particles);
+    clEnqueueReadBuffer(solver.command_queue, buffer, CL_TRUE, 0, result.size() * sizeof(cl_float), result.data(), 0, NULL, NULL);
+    return result;
+}
+
+int run_sph_compare(int nb_steps, int sample_every, const std::string& mode)
+{
+    if (mode != "list" && mode != "tiled" && mode != "grid") {
+        std::cerr << "Unknown neighbor mode " << mode << " (list, tiled or grid)" << std::endl;
+        return 1;
+    }
+    const size_t solver_iterations = 5;
+
+    // Same initial state as the interactive scene
+    sph_parameters param;
+    param.m = param.rho0*param.h*param.h*param.h;
+    OCLHelper solver;
+    solver.pressure_log_path = "";
+    solver.init_context(param);
+    solver.tiled_neighbors = solver.tiled_neighbors && mode == "tiled";
+    solver.grid_neighbors = mode == "grid";
+    const float wall = -1.0f + 0.3f*param.h;
+    const int nb_filled = solver.fill_box(param, {wall, wall, wall}, {-0.2f, -wall, -wall}, 0, param.nb_particles);
+    if (nb_filled < param.nb_particles) {
+        param.nb_particles = nb_filled;
+        solver.truncate_particles(param, nb_filled);
+    }
+
+    sph_reference reference;
+    reference.initialize(param, solver.get_p(), solver.get_v());
+    reference.grid_neighbors = solver.grid_neighbors;
+
+    std::cout << "*** OpenCL (" << mode << ") against the CPU reference, " << param.nb_particles << " particles ***" << std::endl;
+    for (int step = 1; step <= nb_steps; step++)
+    {
+        solver.step(solver_iterations);
+        reference.step(solver_iterations);
+        if (step % sample_every != 0 && step != nb_steps)
+            continue;
+
+        clFinish(solver.command_queue);
+        std::vector<buffer_difference> differences = {
+            compare_buffers("p", solver.get_p(), reference.p),
+            compare_buffers("v", solver.get_v(), reference.v),
+            compare_buffers("w", read_float3(solver, solver.w_mem), reference.w),
+            compare_buffers("lambda", read_float(solver, solver.lambda_mem), reference.lambda),
+            compare_buffers("density", solver.get_density(), reference.density())
+        };
+
+        // The device lists keep at most nb_neighbors-1 neighbors
+        int truncated = 0;
+        for (const std::vector<int>& n : reference.neighbors)
+            truncated += int(n.size()) > param.nb_neighbors - 1 ? 1 : 0;
+
+        std::cout << "step " << step << " (" << truncated << " particles with truncated neighbor lists)" << std::endl;
+        std::cout << "\t buffer      max          rms          sorted max   sorted rms" << std::endl;
+        for (const buffer_difference& d : differences)
+            std::cout << "\t " << std::left << std::setw(12) << d.name << std::setw(13) << d.max << std::setw(13) << d.rms
+                      << std::setw(13) << d.sorted_max << d.sorted_rms << std::endl;
+    }
+    return 0;
+}
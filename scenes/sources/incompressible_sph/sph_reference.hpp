@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "opencl_helper.hpp"
+
+// Smoothing kernel and its gradient, as W and gradW in the .cl files
+float sph_W(float h, const vcl::vec3& p);
+vcl::vec3 sph_gradW(float h, const vcl::vec3& p);
+
+/** Scalar CPU implementation of one step of the SPH solver
+ *
+ * Mirrors the neighbor-list kernels of solver_kernels.cl and update_speed_kernels.cl operation by operation,
+ * one particle at a time, for a single simulation. The neighbors are all the particles within the smoothing
+ * length: the lists are not truncated to nb_neighbors as on the device.
+ */
+struct sph_reference
+{
+    sph_parameters param;
+    // Mirror the neighbor-list-free kernels: the neighbors are searched again at the new positions for the velocity update
+    bool grid_neighbors = false;
+
+    std::vector<vcl::vec3> p;
+    std::vector<vcl::vec3> v;
+    std::vector<vcl::vec3> q;
+    std::vector<vcl::vec3> v_copy;
+    std::vector<vcl::vec3> w;
+    std::vector<vcl::vec3> dp;
+    std::vector<float> lambda;
+    std::vector<vcl::vec2> scale; // (smoothing length, mass) relative to (h, m)
+    std::vector<std::vector<int>> neighbors;
+
+    void initialize(const sph_parameters& param, const std::vector<vcl::vec3>& p, const std::vector<vcl::vec3>& v);
+
+    void befor_solver();
+    void make_neighbors();
+    void solver_step();
+    void update_speed();
+    void step(size_t solver_iterations);
+
+    // Density relative to rho0, as compute_pressure
+    std::vector<float> density() const;
+};
+
+// Difference between the device and the reference values of one buffer
+struct buffer_difference
+{
+    std::string name;
+    float max;
+    float rms;
+    // Same measures on the sorted magnitudes, independent of the order of the particles
+    float sorted_max;
+    float sorted_rms;
+};
+
+buffer_difference compare_buffers(const std::string& name, const std::vector<vcl::vec3>& a, const std::vector<vcl::vec3>& b);
+buffer_difference compare_buffers(const std::string& name, const std::vector<float>& a, const std::vector<float>& b);
+
+// Run the OpenCL solver and the reference from the same initial state, and print the differences of the buffers
+// every sample_every steps. mode is the neighbor mode of the device: list, tiled or grid.
+int run_sph_compare(int nb_steps, int sample_every, const std::string& mode);
@@ -0,0 +1,274 @@
+#include "sph_surface.hpp"
+
+#include "sph_reference.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cmath>
+
+using namespace vcl;
+
+// Corners of a cell are indexed by x + 2y + 4z, the 6 tetrahedra share the diagonal 0-7
+static const int cell_tetrahedra[6][4] = {{0,1,3,7}, {0,3,2,7}, {0,2,6,7}, {0,6,4,7}, {0,4,5,7}, {0,5,1,7}};
+
+namespace {
+
+// Density and gradient sampled on the (block_size+1)^3 nodes of one block
+struct block_field
+{
+    int n;
+    std::vector<float> value;
+    std::vector<vec3> grad;
+
+    size_t index(int x, int y, int z) const { return size_t(x + n*(y + n*z)); }
+};
+
+struct surface_vertex
+{
+    vec3 p;
+    vec3 grad;
+};
+
+}
+
+static long long block_key(int x, int y, int z)
+{
+    return ((long long)(x & 0x1FFFFF) << 42) | ((long long)(y & 0x1FFFFF) << 21) | (long long)(z & 0x1FFFFF);
+}
+
+// Polygonize one tetrahedron, the triangles are appended to out and oriented afterwards
+static void polygonize_tetrahedron(const surface_vertex v[4], const float f[4], float iso, std::vector<surface_vertex>& out)
+{
+    int inside[4], outside[4];
+    int nb_inside = 0, nb_outside = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        if (f[k] > iso)
+            inside[nb_inside++] = k;
+        else
+            outside[nb_outside++] = k;
+    }
+    if (nb_inside == 0 || nb_inside == 4)
+        return;
+
+    auto edge = [&](int a, int b){
+        const float t = (iso - f[a]) / (f[b] - f[a]);
+        return surface_vertex{v[a].p + t*(v[b].p - v[a].p), v[a].grad + t*(v[b].grad - v[a].grad)};
+    };
+
+    if (nb_inside == 1) {
+        const int a = inside[0];
+        out.push_back(edge(a, outside[0]));
+        out.push_back(edge(a, outside[1]));
+        out.push_back(edge(a, outside[2]));
+    }
+    else if (nb_inside == 3) {
+        const int a = outside[0];
+        out.push_back(edge(inside[0], a));
+        out.push_back(edge(inside[1], a));
+        out.push_back(edge(inside[2], a));
+    }
+    else {
+        const surface_vertex ac = edge(inside[0], outside[0]);
+        const surface_vertex ad = edge(inside[0], outside[1]);
+        const surface_vertex bd = edge(inside[1], outside[1]);
+        const surface_vertex bc = edge(inside[1], outside[0]);
+        out.push_back(ac); out.push_back(ad); out.push_back(bd);
+        out.push_back(ac); out.push_back(bd); out.push_back(bc);
+    }
+}
+
+void sph_surface::extract(const std::vector<vec3>& particles, const sph_parameters& sph_param)
+{
+    const float h = sph_param.h;
+    const float mass = sph_param.m / sph_param.rho0; // relative density contribution
+    const int B = block_size;
+    const float block_length = B * cell_size;
+
+    // Particles influencing each block: every block overlapping the support [p-h, p+h]
+    std::unordered_map<long long, std::vector<int>> block_particles;
+    std::vector<int3> block_coordinates; // (z, y, x)
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        const vec3& p = particles[i];
+        const int x0 = int(std::floor((p.x-h)/block_length)), x1 = int(std::floor((p.x+h)/block_length));
+        const int y0 = int(std::floor((p.y-h)/block_length)), y1 = int(std::floor((p.y+h)/block_length));
+        const int z0 = int(std::floor((p.z-h)/block_length)), z1 = int(std::floor((p.z+h)/block_length));
+        for (int bz = z0; bz <= z1; bz++)
+            for (int by = y0; by <= y1; by++)
+                for (int bx = x0; bx <= x1; bx++)
+                {
+                    std::vector<int>& list = block_particles[block_key(bx, by, bz)];
+                    if (list.empty())
+                        block_coordinates.push_back({bz, by, bx});
+                    list.push_back(int(i));
+                }
+    }
+    // Deterministic order of the triangles, whatever the number of threads
+    std::sort(block_coordinates.begin(), block_coordinates.end());
+
+    std::vector<std::vector<surface_vertex>> block_vertices(block_coordinates.size());
+    std::atomic<size_t> next_block(0);
+
+    auto worker = [&](){
+        block_field field;
+        field.n = B + 1;
+        const size_t nb_nodes = size_t(field.n*field.n*field.n);
+        for (size_t k = next_block++; k < block_coordinates.size(); k = next_block++)
+        {
+            const int bz = block_coordinates[k][0], by = block_coordinates[k][1], bx = block_coordinates[k][2];
+            // Nodes are positioned from their global index, so that the nodes shared by two blocks coincide exactly
+            auto node = [&](int x, int y, int z){
+                return vec3((bx*B+x)*cell_size, (by*B+y)*cell_size, (bz*B+z)*cell_size);
+            };
+            field.value.assign(nb_nodes, 0.0f);
+            field.grad.assign(nb_nodes, {0, 0, 0});
+
+            // Splat the particles on the nodes of their support, in increasing index order so that the nodes
+            // shared by two blocks get exactly the same value
+            for (int i : block_particles.at(block_key(bx, by, bz)))
+            {
+                const vec3& p = particles[i];
+                const int ox = bx*B, oy = by*B, oz = bz*B;
+                const int x0 = std::max(int(std::ceil((p.x-h)/cell_size))-ox, 0), x1 = std::min(int(std::floor((p.x+h)/cell_size))-ox, B);
+                const int y0 = std::max(int(std::ceil((p.y-h)/cell_size))-oy, 0), y1 = std::min(int(std::floor((p.y+h)/cell_size))-oy, B);
+                const int z0 = std::max(int(std::ceil((p.z-h)/cell_size))-oz, 0), z1 = std::min(int(std::floor((p.z+h)/cell_size))-oz, B);
+                for (int z = z0; z <= z1; z++)
+                    for (int y = y0; y <= y1; y++)
+                        for (int x = x0; x <= x1; x++)
+                        {
+                            const vec3 d = node(x, y, z) - p;
+                            const size_t idx = field.index(x, y, z);
+                            field.value[idx] += mass * sph_W(h, d);
+                            field.grad[idx] += mass * sph_gradW(h, d);
+                        }
+            }
+
+            std::vector<surface_vertex>& out = block_vertices[k];
+            for (int z = 0; z < B; z++)
+                for (int y = 0; y < B; y++)
+                    for (int x = 0; x < B; x++)
+                    {
+                        surface_vertex corner[8];
+                        float f[8];
+                        bool any_inside = false, any_outside = false;
+                        for (int c = 0; c < 8; c++)
+                        {
+                            const int cx = x + (c&1), cy = y + ((c>>1)&1), cz = z + ((c>>2)&1);
+                            const size_t idx = field.index(cx, cy, cz);
+                            corner[c] = {node(cx, cy, cz), field.grad[idx]};
+                            f[c] = field.value[idx];
+                            any_inside = any_inside || f[c] > iso;
+                            any_outside = any_outside || f[c] <= iso;
+                        }
+                        if (!any_inside || !any_outside)
+                            continue;
+
+                        for (int t = 0; t < 6; t++)
+                        {
+                            surface_vertex tv[4];
+                            float tf[4];
+                            for (int c = 0; c < 4; c++)
+                            {
+                                tv[c] = corner[cell_tetrahedra[t][c]];
+                                tf[c] = f[cell_tetrahedra[t][c]];
+                            }
+                            polygonize_tetrahedron(tv, tf, iso, out);
+                        }
+                    }
+        }
+    };
+
+    const int nb_workers = std::max(1, nb_threads > 0 ? nb_threads : int(std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nb_workers; t++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+
+    // Concatenate the blocks, the normals point out of the fluid and the triangles are oriented along them
+    size_t nb_vertices = 0;
+    for (const std::vector<surface_vertex>& vertices : block_vertices)
+        nb_vertices += vertices.size();
+    position.resize(nb_vertices);
+    normal.resize(nb_vertices);
+    size_t offset = 0;
+    for (const std::vector<surface_vertex>& vertices : block_vertices)
+    {
+        for (size_t k = 0; k < vertices.size(); k += 3)
+        {
+            const vec3 face = cross(vertices[k+1].p - vertices[k].p, vertices[k+2].p - vertices[k].p);
+            vec3 n[3];
+            for (int c = 0; c < 3; c++)
+            {
+                const float length = norm(vertices[k+c].grad);
+                n[c] = length > 1e-12f ? -vertices[k+c].grad / length : normalize(face);
+            }
+            const bool flip = dot(face, n[0] + n[1] + n[2]) < 0;
+            for (int c = 0; c < 3; c++)
+            {
+                const int src = flip ? 2 - c : c;
+                position[offset + c] = vertices[k+src].p;
+                normal[offset + c] = n[src];
+            }
+            offset += 3;
+        }
+    }
+}
+
+void sph_surface::update_drawable(GLuint shader)
+{
+    const size_t nb_triangles = position.size() / 3;
+    if (nb_triangles > capacity) {
+        capacity = std::max(2 * nb_triangles, size_t(1024));
+
+        mesh m;
+        m.position.resize(3 * capacity);
+        m.normal.resize(3 * capacity);
+        for (size_t k = 0; k < 3 * capacity; k++)
+        {
+            m.position[k] = {0, 0, 0};
+            m.normal[k] = {0, 0, 1};
+        }
+        for (size_t k = 0; k < capacity; k++)
+            m.connectivity.push_back({unsigned(3*k), unsigned(3*k+1), unsigned(3*k+2)});
+
+        const mesh_drawable_uniform previous_uniform = drawable.uniform;
+        if (drawable.data.vao != 0) {
+            drawable.clear();
+            bind_vertex_array(0);
+            glDeleteVertexArrays(1, &drawable.data.vao);
+        }
+        drawable = mesh_drawable(m, shader);
+        drawable.uniform = previous_uniform;
+    }
+    drawable.shader = shader;
+
+    if (nb_triangles > 0) {
+        drawable.update_position(position);
+        drawable.update_normal(normal);
+    }
+    drawable.data.number_triangles = static_cast<unsigned int>(nb_triangles);
+}
+
+bool sph_surface::export_obj(const std::string& filename) const
+{
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "Cannot write the surface to " << filename << std::endl;
+        return false;
+    }
+
+    for (size_t k = 0; k < position.size(); k++)
+        file << "v " << position[k].x << " " << position[k].y << " " << position[k].z << "\n";
+    for (size_t k = 0; k < normal.size(); k++)
+        file << "vn " << normal[k].x << " " << normal[k].y << " " << normal[k].z << "\n";
+    for (size_t k = 0; k < position.size(); k += 3)
+        file << "f " << k+1 << "//" << k+1 << " " << k+2 << "//" << k+2 << " " << k+3 << "//" << k+3 << "\n";
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "vcl/vcl.hpp"
+#include "opencl_helper.hpp"
+
+/** Triangle mesh of the fluid surface, extracted from the particles
+ *
+ * The relative density sum_j m W(h, x-p_j) / rho0 is sampled on a sparse grid: only the blocks of
+ * block_size^3 cells within h of a particle are allocated. Each block is polygonized independently
+ * (on nb_threads threads) by marching tetrahedra, the cubes being split in 6 tetrahedra around their diagonal,
+ * which gives a closed surface without the ambiguous cases of the marching cubes table.
+ * The vertex normals are the normalized opposite of the density gradient.
+ *
+ * The mesh is a triangle soup streamed into drawable through update_position and update_normal: the drawable
+ * is only reallocated when the number of triangles exceeds its capacity.
+ */
+struct sph_surface
+{
+    float cell_size = 0.03f;
+    float iso = 0.5f; // relative density of the surface
+    int block_size = 8;
+    int nb_threads = 0; // 0: one per hardware thread
+
+    vcl::buffer<vcl::vec3> position; // 3 consecutive vertices per triangle
+    vcl::buffer<vcl::vec3> normal;
+    vcl::mesh_drawable drawable;
+
+    void extract(const std::vector<vcl::vec3>& particles, const sph_parameters& sph_param);
+    // Send the current mesh to drawable (OpenGL context required)
+    void update_drawable(GLuint shader);
+    // Wavefront obj of the current mesh
+    bool export_obj(const std::string& filename) const;
+
+private:
+    size_t capacity = 0; // number of triangles allocated in drawable
+};
@@ -0,0 +1,213 @@
+#include "sph_sweep.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+using namespace vcl;
+
+float sweep_range::value(int k) const
+{
+    if (count <= 1)
+        return min;
+    return min + (max - min) * k / float(count - 1);
+}
+
+int sweep_specification::nb_runs() const
+{
+    return dt.count * h.count * c.count * epsilon.count * iterations.count;
+}
+
+sweep_specification load_sweep_specification(const std::string& filename)
+{
+    assert_file_exist(filename);
+    std::ifstream file(filename);
+
+    sweep_specification spec;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream(line);
+        std::string key;
+        if (!(stream >> key))
+            continue;
+
+        sweep_range* range = nullptr;
+        if (key == "dt") range = &spec.dt;
+        else if (key == "h") range = &spec.h;
+        else if (key == "c") range = &spec.c;
+        else if (key == "epsilon") range = &spec.epsilon;
+        else if (key == "iterations") range = &spec.iterations;
+
+        if (range != nullptr) {
+            stream >> range->min >> range->max >> range->count;
+            range->count = std::max(range->count, 1);
+        }
+        else if (key == "steps") stream >> spec.steps;
+        else if (key == "sample_every") stream >> spec.sample_every;
+        else if (key == "particles") stream >> spec.particles;
+        else if (key == "jobs") stream >> spec.jobs;
+        else if (key == "device") {
+            std::string type;
+            stream >> type;
+            spec.device_type = type == "cpu" ? CL_DEVICE_TYPE_CPU : (type == "all" ? CL_DEVICE_TYPE_ALL : CL_DEVICE_TYPE_GPU);
+        }
+        else
+            std::cerr << "Unknown sweep entry: " << key << std::endl;
+    }
+    spec.sample_every = std::max(spec.sample_every, 1);
+
+    // The kernels run whole work-groups of 128 particles
+    const int group_size = 128;
+    const int particles = std::max(group_size, (spec.particles + group_size - 1) / group_size * group_size);
+    if (particles != spec.particles) {
+        std::cerr << "Sweep particles rounded up from " << spec.particles << " to " << particles << " (multiple of " << group_size << ")" << std::endl;
+        spec.particles = particles;
+    }
+    return spec;
+}
+
+sweep_run sweep_configuration(const sweep_specification& spec, int id)
+{
+    sweep_run run;
+    run.id = id;
+
+    int k = id;
+    run.param.dt = spec.dt.value(k % spec.dt.count); k /= spec.dt.count;
+    run.param.h = spec.h.value(k % spec.h.count); k /= spec.h.count;
+    run.param.c = spec.c.value(k % spec.c.count); k /= spec.c.count;
+    run.param.epsilon = spec.epsilon.value(k % spec.epsilon.count); k /= spec.epsilon.count;
+    run.iterations = int(std::round(spec.iterations.value(k % spec.iterations.count)));
+
+    run.param.nb_particles = spec.particles;
+    run.param.m = run.param.rho0*run.param.h*run.param.h*run.param.h;
+    run.param.gx = 0.0f;
+    run.param.gy = -100.0f*run.param.h;
+    run.param.gz = 0.0f;
+    return run;
+}
+
+// Simulate one configuration with solver, created by the worker for its first run and reset for the next ones,
+// and return its csv lines. A run stops at its first OpenCL error, which is reported on a last line with the status "failed".
+static std::string run_configuration(const sweep_specification& spec, const sweep_run& run, OCLHelper& solver, bool& failed)
+{
+    // Same initial state as the interactive scene
+    const float wall = -1.0f + 0.3f*run.param.h;
+    const int nb_filled = solver.fill_box(run.param, {wall, wall, wall}, {-0.2f, -wall, -wall}, 0, run.param.nb_particles);
+    if (nb_filled < run.param.nb_particles) {
+        solver.truncate_particles(run.param, nb_filled);
+    }
+
+    const vec3 g = {run.param.gx, run.param.gy, run.param.gz};
+    std::ostringstream out;
+    float total_ms = 0;
+    failed = false;
+    for (int step = 1; step <= spec.steps && !failed; step++)
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        solver.step(run.iterations);
+        solver.check_error(clFinish(solver.command_queue));
+        auto t2 = std::chrono::high_resolution_clock::now();
+        total_ms += std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() / 1000.0f;
+
+        if (solver.error != CL_SUCCESS) {
+            out << run.id << "," << run.param.dt << "," << run.param.h << "," << run.param.c << "," << run.param.epsilon << "," << run.iterations << ","
+                << step << ",,,,,failed (OpenCL error " << solver.error << ")\n";
+            failed = true;
+            continue;
+        }
+
+        if (step % spec.sample_every != 0 && step != spec.steps)
+            continue;
+
+        // The neighbor lists of the step were built before the positions were updated
+        solver.make_neighboors();
+        const std::vector<float> density = solver.get_density();
+        float error_mean = 0, error_max = 0;
+        for (float d : density)
+        {
+            error_mean += std::abs(d - 1.0f);
+            error_max = std::max(error_max, std::abs(d - 1.0f));
+        }
+        error_mean /= density.size();
+
+        const std::vector<vec3> p = solver.get_p();
+        const std::vector<vec3> vel = solver.get_v();
+        float energy = 0;
+        for (size_t i = 0; i < p.size(); i++)
+            energy += run.param.m * (0.5f*dot(vel[i], vel[i]) - dot(g, p[i]));
+
+        out << run.id << "," << run.param.dt << "," << run.param.h << "," << run.param.c << "," << run.param.epsilon << "," << run.iterations << ","
+            << step << "," << total_ms / step << "," << error_mean << "," << error_max << "," << energy << ",ok\n";
+    }
+    return out.str();
+}
+
+int run_sph_sweep(const std::string& spec_filename, const std::string& results_filename)
+{
+    const sweep_specification spec = load_sweep_specification(spec_filename);
+    const int nb_runs = spec.nb_runs();
+    int jobs = spec.jobs > 0 ? spec.jobs : int(std::thread::hardware_concurrency());
+    jobs = std::max(1, std::min(jobs, nb_runs));
+
+    std::ofstream results(results_filename);
+    if (!results)
+    {
+        std::cerr << "Cannot write sweep results to " << results_filename << std::endl;
+        return 1;
+    }
+    results << "run,dt,h,c,epsilon,iterations,step,ms_per_step,density_error_mean,density_error_max,energy,status" << std::endl;
+
+    std::cout << "*** SPH sweep: " << nb_runs << " runs, " << jobs << " concurrent jobs ***" << std::endl;
+
+    // Bounded pool: each worker takes the next configuration once its current run is done.
+    // The runs share their particle count and table sizes: a worker keeps its context, programs and buffers from one
+    // run to the next, and only creates new ones after a failed run.
+    std::atomic<int> next_run(0);
+    std::mutex results_mutex;
+    auto worker = [&](int worker_index)
+    {
+        std::unique_ptr<OCLHelper> solver;
+        for (int id = next_run++; id < nb_runs; id = next_run++)
+        {
+            const sweep_run run = sweep_configuration(spec, id);
+            if (solver) {
+                solver->reset_simulation(run.param);
+            } else {
+                solver.reset(new OCLHelper);
+                solver->device_type = spec.device_type;
+                solver->device_index = worker_index;
+                solver->pressure_log_path = "";
+                solver->init_context(run.param);
+            }
+
+            bool failed = false;
+            const std::string lines = run_configuration(spec, run, *solver, failed);
+            if (failed) {
+                solver.reset();
+            }
+
+            std::lock_guard<std::mutex> lock(results_mutex);
+            results << lines;
+            results.flush();
+            std::cout << "\t " << (failed ? "[FAILED]" : "[OK]") << " run " << id << std::endl;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int k = 0; k < jobs; k++)
+        workers.push_back(std::thread(worker, k));
+    for (auto& w : workers)
+        w.join();
+
+    std::cout << "*** Sweep results written in " << results_filename << " ***" << std::endl;
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "opencl_helper.hpp"
+
+/** Headless parameter sweep of the SPH solver (independent of scene_model)
+ *
+ * The sweep specification is a text file with one entry per line ('#' starts a comment):
+ *   dt 0.01 0.03 3        -> parameter min max count (dt, h, c, epsilon, iterations)
+ *   steps 500             -> number of time steps per run
+ *   sample_every 50       -> metrics are recorded every sample_every steps
+ *   particles 8192        -> number of particles (rounded up to a multiple of 128)
+ *   jobs 4                -> maximum number of runs executed concurrently
+ *   device gpu            -> OpenCL device type (gpu, cpu or all), runs are spread over the devices of all the platforms
+ *
+ * Every combination of the parameters is run, and one line per sample is written to the results file (csv):
+ * run, dt, h, c, epsilon, iterations, step, ms per step, mean and max density error, energy, status.
+ * A run stops at its first OpenCL error: its last line has no metrics and the status "failed".
+ * Each job creates its OpenCL context once and reuses it for its runs.
+ */
+
+// Values taken by one parameter of the sweep
+struct sweep_range
+{
+    float min;
+    float max;
+    int count;
+    float value(int k) const;
+};
+
+struct sweep_specification
+{
+    sweep_range dt         = {0.02f, 0.02f, 1};
+    sweep_range h          = {0.06f, 0.06f, 1};
+    sweep_range c          = {0.2f, 0.2f, 1};
+    sweep_range epsilon    = {1e-3f, 1e-3f, 1};
+    sweep_range iterations = {5, 5, 1};
+
+    int steps = 500;
+    int sample_every = 50;
+    int particles = 8192;
+    int jobs = 1;
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+
+    int nb_runs() const;
+};
+
+// One configuration of the sweep
+struct sweep_run
+{
+    int id;
+    sph_parameters param;
+    int iterations;
+};
+
+sweep_specification load_sweep_specification(const std::string& filename);
+sweep_run sweep_configuration(const sweep_specification& spec, int id);
+
+// Run all the configurations of the specification, and write the metrics to results_filename
+int run_sph_sweep(const std::string& spec_filename, const std::string& results_filename);
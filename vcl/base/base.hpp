@@ -7,5 +7,7 @@
 #include "file/file.hpp"
 #include "rand/rand.hpp"
 #include "error/error.hpp"
+#include "memory/memory.hpp"
+#include "parallel/parallel.hpp"
 
 
@@ -0,0 +1,134 @@
+#include "memory.hpp"
+
+#include "vcl/base/error/error.hpp"
+#include "vcl/base/string/string.hpp"
+
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+namespace vcl
+{
+
+void* aligned_malloc(size_t size, size_t alignment)
+{
+    // The address returned by malloc is stored just before the aligned block
+    void* raw = std::malloc(size + alignment + sizeof(void*));
+    if(raw == nullptr)
+        return nullptr;
+    const uintptr_t start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+    void* aligned = reinterpret_cast<void*>((start + alignment - 1) & ~uintptr_t(alignment - 1));
+    static_cast<void**>(aligned)[-1] = raw;
+    return aligned;
+}
+
+void aligned_free(void* ptr)
+{
+    if(ptr != nullptr)
+        std::free(static_cast<void**>(ptr)[-1]);
+}
+
+
+frame_arena::frame_arena(size_t capacity)
+    :blocks(), initial_capacity(capacity)
+{}
+
+frame_arena::~frame_arena()
+{
+    for(block const& b : blocks)
+        aligned_free(b.data);
+}
+
+void* frame_arena::allocate(size_t size, size_t alignment)
+{
+    assert_vcl(alignment>0 && (alignment & (alignment-1))==0 && alignment<=block_alignment, "alignment="+str(alignment));
+
+    // The blocks start on block_alignment: the padding only depends on the offset
+    size_t start = (offset + alignment-1) & ~(alignment-1);
+    if(current>=blocks.size() || start+size>blocks[current].size)
+    {
+        // Continue in the next block, kept by a rewind if it is large enough
+        size_t const next = blocks.empty()? 0 : current+1;
+        if(next<blocks.size() && blocks[next].size<size) {
+            aligned_free(blocks[next].data);
+            blocks.erase(blocks.begin()+next);
+        }
+        if(next>=blocks.size() || blocks[next].size<size) {
+            size_t const block_size = std::max(size, blocks.empty()? initial_capacity : capacity());
+            char* data = static_cast<char*>(aligned_malloc(block_size, block_alignment));
+            if(data == nullptr)
+                throw std::bad_alloc();
+            blocks.insert(blocks.begin()+next, block{data, block_size});
+        }
+        current = next;
+        offset = 0;
+        start = 0;
+    }
+
+    used_bytes += start+size-offset;
+    offset = start+size;
+    return blocks[current].data + start;
+}
+
+void frame_arena::reset()
+{
+    // Merge the blocks taken during the frame
+    if(blocks.size()>1)
+    {
+        size_t const total = capacity();
+        for(block const& b : blocks)
+            aligned_free(b.data);
+        blocks.clear();
+
+        char* data = static_cast<char*>(aligned_malloc(total, block_alignment));
+        if(data == nullptr)
+            throw std::bad_alloc();
+        blocks.push_back(block{data, total});
+    }
+    current = 0;
+    offset = 0;
+    used_bytes = 0;
+}
+
+frame_arena::marker frame_arena::position() const
+{
+    return marker{current, offset, used_bytes};
+}
+
+void frame_arena::rewind(marker const& m)
+{
+    assert_vcl(m.used<=used_bytes, "The arena has been reset since the marker");
+    current = m.block;
+    offset = m.offset;
+    used_bytes = m.used;
+}
+
+size_t frame_arena::used() const
+{
+    return used_bytes;
+}
+
+size_t frame_arena::capacity() const
+{
+    size_t total = 0;
+    for(block const& b : blocks)
+        total += b.size;
+    return total;
+}
+
+frame_arena::scope::scope(frame_arena& arena_arg)
+    :arena(arena_arg), start(arena_arg.position())
+{}
+
+frame_arena::scope::~scope()
+{
+    arena.rewind(start);
+}
+
+frame_arena& default_frame_arena()
+{
+    static thread_local frame_arena arena;
+    return arena;
+}
+
+}
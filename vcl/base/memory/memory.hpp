@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace vcl
+{
+
+/** Allocation aligned on a power of two alignment (for the SIMD loads), released by aligned_free */
+void* aligned_malloc(size_t size, size_t alignment);
+void aligned_free(void* ptr);
+
+/** Standard allocator returning aligned memory: std::vector<float, aligned_allocator<float>> starts on a 32 bytes
+ * boundary, as required by AVX loads of 8 floats */
+template <typename T, size_t alignment = 32>
+struct aligned_allocator
+{
+    using value_type = T;
+    template <typename U> struct rebind { using other = aligned_allocator<U, alignment>; };
+
+    aligned_allocator() = default;
+    template <typename U> aligned_allocator(aligned_allocator<U, alignment> const&) {}
+
+    T* allocate(size_t n);
+    void deallocate(T* p, size_t n);
+};
+
+template <typename T1, typename T2, size_t A> bool operator==(aligned_allocator<T1,A> const&, aligned_allocator<T2,A> const&) { return true; }
+template <typename T1, typename T2, size_t A> bool operator!=(aligned_allocator<T1,A> const&, aligned_allocator<T2,A> const&) { return false; }
+
+
+/** Bump allocator for the transient data of a frame: allocate() moves an offset forward in a preallocated block and
+ * reset() releases everything at once, without any call to malloc/free in the steady state.
+ * When a frame needs more than the capacity, additional blocks are taken from the heap; the next reset() replaces them
+ * by a single block of the total size, so that the following frames fit in it.
+ * A scope rewinds the arena to its position at the creation of the scope, for the temporaries of a function that may
+ * be called outside of the frame loop. Not thread safe: see default_frame_arena. */
+struct frame_arena
+{
+    struct marker
+    {
+        size_t block;
+        size_t offset;
+        size_t used;
+    };
+
+    struct scope
+    {
+        scope(frame_arena& arena);
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+        ~scope();
+
+        frame_arena& arena;
+        marker start;
+    };
+
+    // The first block is allocated by the first call to allocate
+    explicit frame_arena(size_t capacity = 1<<20);
+    frame_arena(const frame_arena&) = delete;
+    frame_arena& operator=(const frame_arena&) = delete;
+    ~frame_arena();
+
+    // alignment: power of two, at most block_alignment
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    template <typename T> T* allocate(size_t n);
+
+    void reset();
+    marker position() const;
+    void rewind(marker const& m);
+
+    size_t used() const;     // bytes allocated since the last reset, including the alignment padding
+    size_t capacity() const; // bytes of all the blocks
+
+    static constexpr size_t block_alignment = 64;
+
+private:
+    struct block
+    {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<block> blocks;
+    size_t current = 0; // block in use
+    size_t offset = 0;  // first free byte of the current block
+    size_t used_bytes = 0;
+    size_t initial_capacity;
+};
+
+/** Arena of the calling thread. The one of the main thread is reset at the end of each frame by the render loops of
+ * main.cpp: the data allocated from it must not be kept across frames. */
+frame_arena& default_frame_arena();
+
+/** Standard allocator taking its memory from a frame_arena (default_frame_arena unless specified),
+ * ex. buffer<vec3, arena_allocator<vec3>> p(N) for positions only used during the frame.
+ * deallocate does nothing: the memory is recovered by reset or rewind of the arena, reserve the containers that grow.
+ * Aligned on 16 bytes for the SSE loads, arena_allocator<float,32> for AVX. */
+template <typename T, size_t alignment = 16>
+struct arena_allocator
+{
+    using value_type = T;
+    template <typename U> struct rebind { using other = arena_allocator<U, alignment>; };
+
+    arena_allocator() : arena(&default_frame_arena()) {}
+    arena_allocator(frame_arena& arena_arg) : arena(&arena_arg) {}
+    template <typename U> arena_allocator(arena_allocator<U, alignment> const& other) : arena(other.arena) {}
+
+    T* allocate(size_t n);
+    void deallocate(T*, size_t) {}
+
+    frame_arena* arena;
+};
+
+template <typename T1, typename T2, size_t A> bool operator==(arena_allocator<T1,A> const& a, arena_allocator<T2,A> const& b) { return a.arena==b.arena; }
+template <typename T1, typename T2, size_t A> bool operator!=(arena_allocator<T1,A> const& a, arena_allocator<T2,A> const& b) { return a.arena!=b.arena; }
+
+}
+
+// Template implementation
+
+namespace vcl
+{
+
+template <typename T, size_t alignment>
+T* aligned_allocator<T,alignment>::allocate(size_t n)
+{
+    static_assert(alignment >= alignof(T) && (alignment & (alignment-1)) == 0, "Alignment must be a power of two");
+    void* p = aligned_malloc(n*sizeof(T), alignment);
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return static_cast<T*>(p);
+}
+
+template <typename T, size_t alignment>
+void aligned_allocator<T,alignment>::deallocate(T* p, size_t)
+{
+    aligned_free(p);
+}
+
+template <typename T>
+T* frame_arena::allocate(size_t n)
+{
+    return static_cast<T*>(allocate(n*sizeof(T), alignof(T)));
+}
+
+template <typename T, size_t alignment>
+T* arena_allocator<T,alignment>::allocate(size_t n)
+{
+    static_assert(alignment >= alignof(T) && (alignment & (alignment-1)) == 0, "Alignment must be a power of two");
+    static_assert(alignment <= frame_arena::block_alignment, "Alignment larger than the one of the blocks of the arena");
+    return static_cast<T*>(arena->allocate(n*sizeof(T), alignment));
+}
+
+}
@@ -0,0 +1,172 @@
+#include "parallel.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace vcl
+{
+
+namespace
+{
+
+/** Workers waiting for the tasks of a job. The job is published under the mutex with a new generation, the workers
+ * and the calling thread take its tasks from the counter next. A new job waits until no worker is still busy with
+ * the previous one. */
+struct thread_pool
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex job_mutex; // one job at a time
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    std::function<void(size_t)> const* task = nullptr;
+    size_t nb_tasks = 0;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> completed{0};
+    size_t generation = 0;
+    size_t busy = 0;
+    bool stopping = false;
+
+    ~thread_pool() { stop(); }
+
+    void start(size_t nb_workers);
+    void stop();
+    void worker_loop();
+    void run_tasks(std::function<void(size_t)> const& f, size_t n);
+};
+
+size_t threshold = size_t(1) << 16;
+size_t nb_threads_requested = 0;
+thread_pool pool;
+thread_local bool inside_task = false;
+
+void thread_pool::start(size_t nb_workers)
+{
+    for(size_t k=0; k<nb_workers; ++k)
+        workers.push_back(std::thread(&thread_pool::worker_loop, this));
+}
+
+void thread_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for(std::thread& t : workers)
+        t.join();
+    workers.clear();
+    stopping = false;
+}
+
+void thread_pool::run_tasks(std::function<void(size_t)> const& f, size_t n)
+{
+    inside_task = true;
+    for(size_t k = next++; k < n; k = next++)
+    {
+        f(k);
+        if(++completed == n) {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_done.notify_all();
+        }
+    }
+    inside_task = false;
+}
+
+void thread_pool::worker_loop()
+{
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+        job_ready.wait(lock, [&]{ return stopping || (generation != seen && task != nullptr); });
+        if(stopping)
+            return;
+        seen = generation;
+        std::function<void(size_t)> const* f = task;
+        const size_t n = nb_tasks;
+        ++busy;
+        lock.unlock();
+
+        run_tasks(*f, n);
+
+        lock.lock();
+        --busy;
+        job_done.notify_all();
+    }
+}
+
+}
+
+void parallel_set_threshold(size_t value)
+{
+    threshold = value;
+}
+
+size_t parallel_threshold()
+{
+    return threshold;
+}
+
+void parallel_set_nb_threads(size_t nb_threads)
+{
+    std::lock_guard<std::mutex> job(pool.job_mutex);
+    nb_threads_requested = nb_threads;
+    pool.stop();
+}
+
+size_t parallel_nb_threads()
+{
+    if(nb_threads_requested > 0)
+        return nb_threads_requested;
+    const size_t hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+namespace detail
+{
+
+bool parallel_enabled(size_t n, execution_policy policy)
+{
+    if(policy == execution_policy::sequential || inside_task || parallel_nb_threads() < 2)
+        return false;
+    return policy == execution_policy::parallel || n >= threshold;
+}
+
+void parallel_run(size_t nb_tasks, std::function<void(size_t)> const& task)
+{
+    std::unique_lock<std::mutex> job(pool.job_mutex, std::try_to_lock);
+    if(!job.owns_lock() || nb_tasks < 2) {
+        // Pool used by another thread
+        for(size_t k=0; k<nb_tasks; ++k)
+            task(k);
+        return;
+    }
+
+    if(pool.workers.empty())
+        pool.start(parallel_nb_threads()-1);
+
+    {
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.job_done.wait(lock, []{ return pool.busy == 0; });
+        pool.task = &task;
+        pool.nb_tasks = nb_tasks;
+        pool.next = 0;
+        pool.completed = 0;
+        ++pool.generation;
+    }
+    pool.job_ready.notify_all();
+
+    pool.run_tasks(task, nb_tasks);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.job_done.wait(lock, [&]{ return pool.completed == nb_tasks && pool.busy == 0; });
+    pool.task = nullptr;
+}
+
+}
+
+}
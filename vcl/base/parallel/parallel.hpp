@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace vcl
+{
+
+/** Execution of the element-wise loops and reductions of the buffers
+ *  automatic  - on the thread pool when the number of elements reaches parallel_threshold()
+ *  sequential - on the calling thread
+ *  parallel   - on the thread pool whatever the size */
+enum class execution_policy { automatic, sequential, parallel };
+
+// Number of elements from which the automatic policy uses the thread pool (default 1<<16)
+void parallel_set_threshold(size_t threshold);
+size_t parallel_threshold();
+// Threads used, including the calling thread (0: one per hardware thread, 1: everything runs sequentially)
+void parallel_set_nb_threads(size_t nb_threads);
+size_t parallel_nb_threads();
+
+/** Call f(begin,end) on ranges covering [0,n), on the thread pool according to the policy.
+ * The ranges begin at multiples of parallel_range_alignment elements: the packed bits of a std::vector<bool>
+ * (buffer<bool>) written by different tasks never share a word.
+ * Calls made from a task of the pool, or while another thread uses the pool, run sequentially. */
+static const size_t parallel_range_alignment = 64;
+template <typename F> void parallel_for(size_t n, F const& f, execution_policy policy = execution_policy::automatic);
+
+/** Reduction of [0,n): block_value(begin,end) reduces a block of parallel_reduction_block elements, the values of the
+ * blocks are combined in order. The blocks do not depend on the number of threads nor on the policy, so that the
+ * result is reproducible (bitwise for floating point sums) whatever the execution. identity is returned for n=0. */
+static const size_t parallel_reduction_block = 4096;
+template <typename T, typename F, typename C>
+T parallel_reduce(size_t n, T const& identity, F const& block_value, C const& combine, execution_policy policy = execution_policy::automatic);
+
+namespace detail
+{
+bool parallel_enabled(size_t n, execution_policy policy);
+// Run task(0) ... task(nb_tasks-1) on the pool and the calling thread
+void parallel_run(size_t nb_tasks, std::function<void(size_t)> const& task);
+}
+
+}
+
+// Template implementation
+
+namespace vcl
+{
+
+template <typename F> void parallel_for(size_t n, F const& f, execution_policy policy)
+{
+    if(n==0)
+        return;
+    if(!detail::parallel_enabled(n, policy)) {
+        f(size_t(0), n);
+        return;
+    }
+
+    // A few ranges per thread to balance the load, of at least 1024 elements
+    const size_t min_range = 1024;
+    size_t nb_tasks = 4*parallel_nb_threads();
+    if(nb_tasks > (n+min_range-1)/min_range)
+        nb_tasks = (n+min_range-1)/min_range;
+    const size_t range = ((n+nb_tasks-1)/nb_tasks + parallel_range_alignment-1)/parallel_range_alignment*parallel_range_alignment;
+    detail::parallel_run(nb_tasks, [&](size_t task){
+        const size_t begin = task*range;
+        const size_t end = begin+range < n ? begin+range : n;
+        if(begin < end)
+            f(begin, end);
+    });
+}
+
+template <typename T, typename F, typename C>
+T parallel_reduce(size_t n, T const& identity, F const& block_value, C const& combine, execution_policy policy)
+{
+    if(n==0)
+        return identity;
+
+    const size_t nb_blocks = (n+parallel_reduction_block-1)/parallel_reduction_block;
+    std::vector<T> partial(nb_blocks, identity);
+    auto reduce_blocks = [&](size_t first, size_t last){
+        for(size_t b=first; b<last; ++b) {
+            const size_t begin = b*parallel_reduction_block;
+            const size_t end = begin+parallel_reduction_block < n ? begin+parallel_reduction_block : n;
+            partial[b] = block_value(begin, end);
+        }
+    };
+    if(detail::parallel_enabled(n, policy))
+        detail::parallel_run(nb_blocks, [&](size_t b){ reduce_blocks(b, b+1); });
+    else
+        reduce_blocks(0, nb_blocks);
+
+    T result = partial[0];
+    for(size_t b=1; b<nb_blocks; ++b)
+        result = combine(result, partial[b]);
+    return result;
+}
+
+}
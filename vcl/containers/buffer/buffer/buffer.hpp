@@ -4,6 +4,7 @@
 #include <ostream>
 
 #include "vcl/base/base.hpp"
+#include "../buffer_expression/buffer_expression.hpp"
 #include <iostream>
 
 /** ************************************************** **/
@@ -13,21 +14,34 @@
 namespace vcl
 {
 
-template <typename T>
+/** Contiguous array of elements. The allocator is the one of the std::vector storing them: buffer<T, arena_allocator<T>>
+ * takes its memory from a frame_arena (transient data released all at once), buffer<T, aligned_allocator<T>> is aligned
+ * for the SIMD loads. */
+template <typename T, typename Allocator = std::allocator<T>>
 struct buffer
 {
-    std::vector<T> data;
+    using allocator_type = Allocator;
+
+    std::vector<T,Allocator> data;
 
     buffer();
     buffer(size_t size);
     buffer(std::initializer_list<T> arg);
     buffer(std::vector<T> const& arg);
+    explicit buffer(Allocator const& allocator);
+    buffer(size_t size, Allocator const& allocator);
+    // Evaluate a lazy expression of buffers (a+b*c, ...) in a single loop
+    template <typename E> buffer(buffer_expression<E> const& e);
+    template <typename E> buffer& operator=(buffer_expression<E> const& e);
 
     size_t size() const;
     void resize(size_t size);
+    // Allocate the storage of size elements at once, the following push_back do not reallocate
+    void reserve(size_t size);
+    size_t capacity() const;
     void push_back(T const& value);
     void clear();
-    void fill(T const& value);
+    void fill(T const& value, execution_policy policy = execution_policy::automatic);
 
     T const& operator[](size_t index) const;
     T & operator[](size_t index);
@@ -36,48 +50,58 @@ struct buffer
     T const& at(size_t index) const;
     T & at(size_t index);
 
-    typename std::vector<T>::iterator begin();
-    typename std::vector<T>::iterator end();
-    typename std::vector<T>::const_iterator begin() const;
-    typename std::vector<T>::const_iterator end() const;
-    typename std::vector<T>::const_iterator cbegin() const;
-    typename std::vector<T>::const_iterator cend() const;
+    typename std::vector<T,Allocator>::iterator begin();
+    typename std::vector<T,Allocator>::iterator end();
+    typename std::vector<T,Allocator>::const_iterator begin() const;
+    typename std::vector<T,Allocator>::const_iterator end() const;
+    typename std::vector<T,Allocator>::const_iterator cbegin() const;
+    typename std::vector<T,Allocator>::const_iterator cend() const;
 };
 
 
-template <typename T> std::ostream& operator<<(std::ostream& s, buffer<T> const& v);
-template <typename T> std::string to_string(buffer<T> const& v, std::string const& separator=" ");
+template <typename T, typename A> std::ostream& operator<<(std::ostream& s, buffer<T,A> const& v);
+template <typename T, typename A> std::string to_string(buffer<T,A> const& v, std::string const& separator=" ");
 
-template <typename T1, typename T2> bool is_equal(buffer<T1> const& a, buffer<T2> const& b);
-template <typename T> bool is_equal(buffer<T> const& a, buffer<T> const& b);
+template <typename T1, typename A1, typename T2, typename A2> bool is_equal(buffer<T1,A1> const& a, buffer<T2,A2> const& b);
+template <typename T, typename A> bool is_equal(buffer<T,A> const& a, buffer<T,A> const& b);
 
-template <typename T> T average(buffer<T> const& a);
+// Reproducible whatever the number of threads (see parallel_reduce)
+template <typename T, typename A> T average(buffer<T,A> const& a, execution_policy policy = execution_policy::automatic);
 
-template <typename T> buffer<T>  operator-(buffer<T> const& a);
+// The operators +, -, * and / are lazy (see buffer_expression), the compound assignments are in place (the operand may use another allocator)
+template <typename T, typename A, typename A2> buffer<T,A>& operator+=(buffer<T,A>& a, buffer<T,A2> const& b);
+template <typename T, typename A> buffer<T,A>& operator+=(buffer<T,A>& a, T const& b);
+template <typename T, typename A, typename E> buffer<T,A>& operator+=(buffer<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer<T>& operator+=(buffer<T>& a, buffer<T> const& b);
-template <typename T> buffer<T>& operator+=(buffer<T>& a, T const& b);
-template <typename T> buffer<T>  operator+(buffer<T> const& a, buffer<T> const& b);
-template <typename T> buffer<T>  operator+(buffer<T> const& a, T const& b);
-template <typename T> buffer<T>  operator+(T const& a, buffer<T> const& b);
+template <typename T, typename A, typename A2> buffer<T,A>& operator-=(buffer<T,A>& a, buffer<T,A2> const& b);
+template <typename T, typename A> buffer<T,A>& operator-=(buffer<T,A>& a, T const& b);
+template <typename T, typename A, typename E> buffer<T,A>& operator-=(buffer<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer<T>& operator-=(buffer<T>& a, buffer<T> const& b);
-template <typename T> buffer<T>& operator-=(buffer<T>& a, T const& b);
-template <typename T> buffer<T>  operator-(buffer<T> const& a, buffer<T> const& b);
-template <typename T> buffer<T>  operator-(buffer<T> const& a, T const& b);
-template <typename T> buffer<T>  operator-(T const& a, buffer<T> const& b);
+template <typename T, typename A, typename A2> buffer<T,A>& operator*=(buffer<T,A>& a, buffer<T,A2> const& b);
+template <typename T, typename A> buffer<T,A>& operator*=(buffer<T,A>& a, float b);
+template <typename T, typename A, typename E> buffer<T,A>& operator*=(buffer<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer<T>& operator*=(buffer<T>& a, buffer<T> const& b);
-template <typename T> buffer<T>  operator*(buffer<T> const& a, buffer<T> const& b);
-template <typename T> buffer<T>& operator*=(buffer<T>& a, float b);
-template <typename T> buffer<T>  operator*(buffer<T> const& a, float b);
-template <typename T> buffer<T>  operator*(float a, buffer<T> const& b);
+template <typename T, typename A, typename A2> buffer<T,A>& operator/=(buffer<T,A>& a, buffer<T,A2> const& b);
+template <typename T, typename A> buffer<T,A>& operator/=(buffer<T,A>& a, float b);
+template <typename T, typename A, typename E> buffer<T,A>& operator/=(buffer<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer<T>& operator/=(buffer<T>& a, buffer<T> const& b);
-template <typename T> buffer<T>& operator/=(buffer<T>& a, float b);
-template <typename T> buffer<T>  operator/(buffer<T> const& a, buffer<T> const& b);
-template <typename T> buffer<T>  operator/(buffer<T> const& a, float b);
-template <typename T> buffer<T>  operator/(float a, buffer<T> const& b);
+template <typename T, typename A>
+struct buffer_operand<buffer<T,A>>
+{
+    static constexpr bool is_operand = true;
+    using value_type = T;
+    using dimension_type = size_t;
+    using storage = buffer<T,A> const&;
+    static size_t size(buffer<T,A> const& x) { return x.data.size(); }
+    static size_t dimension(buffer<T,A> const& x) { return x.data.size(); }
+    static T const& element(buffer<T,A> const& x, size_t k) { return x.data[k]; }
+};
+
+template <typename T>
+struct buffer_evaluation<size_t, T>
+{
+    using type = buffer<T>;
+};
 
 
 }
@@ -91,338 +115,353 @@ template <typename T> buffer<T>  operator/(float a, buffer<T> const& b);
 namespace vcl
 {
 
-template <typename T>
-buffer<T>::buffer()
+template <typename T, typename A>
+buffer<T,A>::buffer()
     :data()
 {}
 
-template <typename T>
-buffer<T>::buffer(size_t size)
+template <typename T, typename A>
+buffer<T,A>::buffer(size_t size)
     :data(size)
 {}
 
-template <typename T>
-buffer<T>::buffer(std::initializer_list<T> arg)
+template <typename T, typename A>
+buffer<T,A>::buffer(std::initializer_list<T> arg)
     :data(arg)
 {}
 
-template <typename T>
-buffer<T>::buffer(const std::vector<T>& arg)
-    :data(arg)
+template <typename T, typename A>
+buffer<T,A>::buffer(const std::vector<T>& arg)
+    :data(arg.begin(), arg.end())
 {}
 
-template <typename T>
-size_t buffer<T>::size() const
+template <typename T, typename A>
+buffer<T,A>::buffer(A const& allocator)
+    :data(allocator)
+{}
+
+template <typename T, typename A>
+buffer<T,A>::buffer(size_t size, A const& allocator)
+    :data(size, T(), allocator)
+{}
+
+template <typename T, typename A>
+template <typename E>
+buffer<T,A>::buffer(buffer_expression<E> const& e)
+    :data()
+{
+    *this = e;
+}
+
+template <typename T, typename A>
+template <typename E>
+buffer<T,A>& buffer<T,A>::operator=(buffer_expression<E> const& e)
+{
+    static_assert(std::is_same<typename E::dimension_type, size_t>::value, "Expression of buffer2D/buffer3D assigned to a buffer");
+
+    // The buffer may be an operand of the expression: each element only depends on the operands at the same index
+    E const& x = e.derived();
+    size_t const N = x.size();
+    data.resize(N);
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            data[k] = x[k];
+    });
+    return *this;
+}
+
+template <typename T, typename A>
+size_t buffer<T,A>::size() const
 {
     return data.size();
 }
 
-template <typename T>
-void buffer<T>::resize(size_t size)
+template <typename T, typename A>
+void buffer<T,A>::resize(size_t size)
 {
     data.resize(size);
 }
 
-template <typename T>
-void buffer<T>::push_back(T const& value)
+template <typename T, typename A>
+void buffer<T,A>::reserve(size_t size)
+{
+    data.reserve(size);
+}
+
+template <typename T, typename A>
+size_t buffer<T,A>::capacity() const
+{
+    return data.capacity();
+}
+
+template <typename T, typename A>
+void buffer<T,A>::push_back(T const& value)
 {
     data.push_back(value);
 }
 
-template <typename T>
-void buffer<T>::clear()
+template <typename T, typename A>
+void buffer<T,A>::clear()
 {
     data.clear();
 }
 
-template <typename T>
-T const& buffer<T>::operator[](size_t index) const
+template <typename T, typename A>
+T const& buffer<T,A>::operator[](size_t index) const
 {
     assert_vcl(index<data.size(), "index="+str(index));
     return data[index];
 }
-template <typename T>
-T & buffer<T>::operator[](size_t index)
+template <typename T, typename A>
+T & buffer<T,A>::operator[](size_t index)
 {
     assert_vcl(index<data.size(), "index="+str(index));
     return data[index];
 }
 
-template <typename T>
-T const& buffer<T>::operator()(size_t index) const
+template <typename T, typename A>
+T const& buffer<T,A>::operator()(size_t index) const
 {
     return (*this)[index];
 }
 
-template <typename T>
-T & buffer<T>::operator()(size_t index)
+template <typename T, typename A>
+T & buffer<T,A>::operator()(size_t index)
 {
     return (*this)[index];
 }
 
-template <typename T>
-T const& buffer<T>::at(size_t index) const
+template <typename T, typename A>
+T const& buffer<T,A>::at(size_t index) const
 {
     return data.at(index);
 }
 
-template <typename T>
-T & buffer<T>::at(size_t index)
+template <typename T, typename A>
+T & buffer<T,A>::at(size_t index)
 {
     return data.at(index);
 }
 
-template <typename T>
-void buffer<T>::fill(T const& value)
+template <typename T, typename A>
+void buffer<T,A>::fill(T const& value, execution_policy policy)
 {
     size_t const N = size();
-    for(size_t k=0; k<N; ++k)
-        data[k] = value;
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            data[k] = value;
+    }, policy);
 }
 
-template <typename T>
-typename std::vector<T>::iterator buffer<T>::begin()
+template <typename T, typename A>
+typename std::vector<T,A>::iterator buffer<T,A>::begin()
 {
     return data.begin();
 }
 
-template <typename T>
-typename std::vector<T>::iterator buffer<T>::end()
+template <typename T, typename A>
+typename std::vector<T,A>::iterator buffer<T,A>::end()
 {
     return data.end();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer<T>::begin() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer<T,A>::begin() const
 {
     return data.begin();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer<T>::end() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer<T,A>::end() const
 {
     return data.end();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer<T>::cbegin() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer<T,A>::cbegin() const
 {
     return data.cbegin();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer<T>::cend() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer<T,A>::cend() const
 {
     return data.cend();
 }
 
-template <typename T> std::ostream& operator<<(std::ostream& s, buffer<T> const& v)
+template <typename T, typename A> std::ostream& operator<<(std::ostream& s, buffer<T,A> const& v)
 {
     std::string s_out = to_string(v);
     s << s_out;
     return s;
 }
-template <typename T> std::string to_string(buffer<T> const& v, std::string const& separator)
+template <typename T, typename A> std::string to_string(buffer<T,A> const& v, std::string const& separator)
 {
     return vcl::detail::to_string_container(v, separator);
 }
 
-template <typename T> T average(buffer<T> const& a)
+template <typename T, typename A> T average(buffer<T,A> const& a, execution_policy policy)
 {
     size_t const N = a.size();
     assert_vcl_no_msg(N>0);
 
-    T value; // assume value start at zero
-    for(size_t k=0; k<N; ++k)
-        value += a[k];
+    T value = parallel_reduce(N, a[0], [&](size_t begin, size_t end){
+        T block_sum = a[begin];
+        for(size_t k=begin+1; k<end; ++k)
+            block_sum += a[k];
+        return block_sum;
+    }, [](T const& s1, T const& s2){ return s1+s2; }, policy);
     value /= float(N);
 
     return value;
 }
 
-template <typename T>
-buffer<T>& operator+=(buffer<T>& a, buffer<T> const& b)
+template <typename T, typename A, typename A2>
+buffer<T,A>& operator+=(buffer<T,A>& a, buffer<T,A2> const& b)
 {
     assert_vcl(a.size()>0 && b.size()>0, "Size must be >0");
     assert_vcl(a.size()==b.size(), "Size do not agree");
 
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] += b[k];
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] += b[k];
+    });
     return a;
 }
 
-template <typename T>
-buffer<T>& operator+=(buffer<T>& a, T const& b)
+template <typename T, typename A>
+buffer<T,A>& operator+=(buffer<T,A>& a, T const& b)
 {
     assert_vcl(a.size()>0, "Size must be >0");
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] += b;
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] += b;
+    });
     return a;
 }
-
-template <typename T>
-buffer<T>  operator+(buffer<T> const& a, buffer<T> const& b)
-{
-    buffer<T> res = a;
-    res += b;
-    return res;
-}
-
-template <typename T>
-buffer<T>  operator+(buffer<T> const& a, T const& b)
-{
-    buffer<T> res = a;
-    res += b;
-    return res;
-}
-
-template <typename T>
-buffer<T>  operator+(T const& a, buffer<T> const& b)
+template <typename T, typename A, typename E> buffer<T,A>& operator+=(buffer<T,A>& a, buffer_expression<E> const& b)
 {
-    size_t const N = b.size();
-    buffer<T> res(N);
-    for(size_t k=0; k<N; ++k)
-        res[k] = a+b[k];
-    return res;
-}
+    E const& x = b.derived();
+    assert_vcl(a.size()==x.size(), "Size do not agree");
 
-template <typename T> buffer<T>  operator-(buffer<T> const& a)
-{
-    size_t const N = a.size();
-    buffer<T> b(N);
-    for(size_t k=0; k<N; ++k)
-        b[k] = -a[k];
-    return b;
+    const size_t N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data[k] += x[k];
+    });
+    return a;
 }
 
 
-template <typename T> buffer<T>& operator-=(buffer<T>& a, buffer<T> const& b)
+template <typename T, typename A, typename A2> buffer<T,A>& operator-=(buffer<T,A>& a, buffer<T,A2> const& b)
 {
     assert_vcl(a.size()>0 && b.size()>0, "Size must be >0");
     assert_vcl(a.size()==b.size(), "Size do not agree");
 
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] -= b[k];
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] -= b[k];
+    });
     return a;
 }
-template <typename T> buffer<T>& operator-=(buffer<T>& a, T const& b)
+template <typename T, typename A> buffer<T,A>& operator-=(buffer<T,A>& a, T const& b)
 {
     assert_vcl(a.size()>0, "Size must be >0");
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] -= b;
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] -= b;
+    });
     return a;
 }
-template <typename T> buffer<T>  operator-(buffer<T> const& a, buffer<T> const& b)
-{
-    buffer<T> res = a;
-    res -= b;
-    return res;
-}
-template <typename T> buffer<T>  operator-(buffer<T> const& a, T const& b)
+template <typename T, typename A, typename E> buffer<T,A>& operator-=(buffer<T,A>& a, buffer_expression<E> const& b)
 {
-    buffer<T> res = a;
-    res -= b;
-    return res;
-}
-template <typename T> buffer<T>  operator-(T const& a, buffer<T> const& b)
-{
-    size_t const N = b.size();
-    buffer<T> res(N);
-    for(size_t k=0; k<N; ++k)
-        res[k] = a-b[k];
-    return res;
+    E const& x = b.derived();
+    assert_vcl(a.size()==x.size(), "Size do not agree");
+
+    const size_t N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data[k] -= x[k];
+    });
+    return a;
 }
 
 
-template <typename T> buffer<T>& operator*=(buffer<T>& a, buffer<T> const& b)
+template <typename T, typename A, typename A2> buffer<T,A>& operator*=(buffer<T,A>& a, buffer<T,A2> const& b)
 {
     assert_vcl(a.size()>0 && b.size()>0, "Size must be >0");
     assert_vcl(a.size()==b.size(), "Size do not agree");
 
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] *= b[k];
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] *= b[k];
+    });
     return a;
 }
-template <typename T> buffer<T>  operator*(buffer<T> const& a, buffer<T> const& b)
-{
-    buffer<T> res = a;
-    res *= b;
-    return res;
-}
-
-
-
-
-template <typename T> buffer<T>& operator*=(buffer<T>& a, float b)
+template <typename T, typename A> buffer<T,A>& operator*=(buffer<T,A>& a, float b)
 {
     size_t const N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] *= b;
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] *= b;
+    });
     return a;
 }
-template <typename T> buffer<T>  operator*(buffer<T> const& a, float b)
-{
-    size_t const N = a.size();
-    buffer<T> res(N);
-    for(size_t k=0; k<N; ++k)
-        res[k] = a[k]*b;
-    return res;
-}
-template <typename T> buffer<T>  operator*(float a, buffer<T> const& b)
+template <typename T, typename A, typename E> buffer<T,A>& operator*=(buffer<T,A>& a, buffer_expression<E> const& b)
 {
-    size_t const N = b.size();
-    buffer<T> res(N);
-    for(size_t k=0; k<N; ++k)
-        res[k] = a*b[k];
-    return res;
+    E const& x = b.derived();
+    assert_vcl(a.size()==x.size(), "Size do not agree");
+
+    const size_t N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data[k] *= x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer<T>& operator/=(buffer<T>& a, buffer<T> const& b)
+template <typename T, typename A, typename A2> buffer<T,A>& operator/=(buffer<T,A>& a, buffer<T,A2> const& b)
 {
     assert_vcl(a.size()>0 && b.size()>0, "Size must be >0");
     assert_vcl(a.size()==b.size(), "Size do not agree");
 
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] /= b[k];
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] /= b[k];
+    });
     return a;
 }
-template <typename T> buffer<T>& operator/=(buffer<T>& a, float b)
+template <typename T, typename A> buffer<T,A>& operator/=(buffer<T,A>& a, float b)
 {
     assert_vcl(a.size()>0, "Size must be >0");
     const size_t N = a.size();
-    for(size_t k=0; k<N; ++k)
-        a[k] /= b;
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a[k] /= b;
+    });
     return a;
 }
-template <typename T> buffer<T>  operator/(buffer<T> const& a, buffer<T> const& b)
-{
-    buffer<T> res = a;
-    res /= b;
-    return res;
-}
-template <typename T> buffer<T>  operator/(buffer<T> const& a, float b)
+template <typename T, typename A, typename E> buffer<T,A>& operator/=(buffer<T,A>& a, buffer_expression<E> const& b)
 {
-    buffer<T> res = a;
-    res /= b;
-    return res;
-}
-template <typename T> buffer<T>  operator/(float a, buffer<T> const& b)
-{
-    size_t const N = b.size();
-    buffer<T> res(N);
-    for(size_t k=0; k<N; ++k)
-        res[k] = a/b[k];
-    return res;
+    E const& x = b.derived();
+    assert_vcl(a.size()==x.size(), "Size do not agree");
+
+    const size_t N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data[k] /= x[k];
+    });
+    return a;
 }
 
 
-template <typename T1, typename T2> bool is_equal(buffer<T1> const& a, buffer<T2> const& b)
+template <typename T1, typename A1, typename T2, typename A2> bool is_equal(buffer<T1,A1> const& a, buffer<T2,A2> const& b)
 {
     size_t const N = a.size();
     if(b.size()!=N)
@@ -434,9 +473,9 @@ template <typename T1, typename T2> bool is_equal(buffer<T1> const& a, buffer<T2
             return false;
     return true;
 }
-template <typename T> bool is_equal(buffer<T> const& a, buffer<T> const& b)
+template <typename T, typename A> bool is_equal(buffer<T,A> const& a, buffer<T,A> const& b)
 {
-    return is_equal<T,T>(a,b);
+    return is_equal<T,A,T,A>(a,b);
 }
 
 
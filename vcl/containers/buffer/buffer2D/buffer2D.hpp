@@ -12,16 +12,20 @@
 namespace vcl
 {
 
-template <typename T>
+template <typename T, typename Allocator = std::allocator<T>>
 struct buffer2D
 {
     size_t2 dimension;
-    buffer<T> data;
+    buffer<T,Allocator> data;
 
     buffer2D();
     buffer2D(size_t size);
     buffer2D(size_t2 const& size);
+    buffer2D(size_t2 const& size, Allocator const& allocator);
     buffer2D(size_t size_1, size_t size_2);
+    // Evaluate a lazy expression of buffer2Ds (a+b*c, ...) in a single loop
+    template <typename E> buffer2D(buffer_expression<E> const& e);
+    template <typename E> buffer2D& operator=(buffer_expression<E> const& e);
 
 
     void clear();
@@ -43,42 +47,53 @@ struct buffer2D
     T const& operator()(size_t k1, size_t k2) const;
     T & operator()(size_t k1, size_t k2);
 
-    typename std::vector<T>::iterator begin();
-    typename std::vector<T>::iterator end();
-    typename std::vector<T>::const_iterator begin() const;
-    typename std::vector<T>::const_iterator end() const;
-    typename std::vector<T>::const_iterator cbegin() const;
-    typename std::vector<T>::const_iterator cend() const;
+    typename std::vector<T,Allocator>::iterator begin();
+    typename std::vector<T,Allocator>::iterator end();
+    typename std::vector<T,Allocator>::const_iterator begin() const;
+    typename std::vector<T,Allocator>::const_iterator end() const;
+    typename std::vector<T,Allocator>::const_iterator cbegin() const;
+    typename std::vector<T,Allocator>::const_iterator cend() const;
 };
 
-template <typename T> std::ostream& operator<<(std::ostream& s, buffer2D<T> const& v);
-template <typename T> std::string to_string(buffer2D<T> const& v, std::string const& separator=" ");
+template <typename T, typename A> std::ostream& operator<<(std::ostream& s, buffer2D<T,A> const& v);
+template <typename T, typename A> std::string to_string(buffer2D<T,A> const& v, std::string const& separator=" ");
 
-template <typename T> buffer2D<T>& operator+=(buffer2D<T>& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>& operator+=(buffer2D<T>& a, T const& b);
-template <typename T> buffer2D<T>  operator+(buffer2D<T> const& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>  operator+(buffer2D<T> const& a, T const& b);
-template <typename T> buffer2D<T>  operator+(T const& a, buffer2D<T> const& b);
+// The operators +, -, * and / are lazy (see buffer_expression), the compound assignments are in place (the operand may use another allocator)
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator+=(buffer2D<T,A>& a, buffer2D<T,A2> const& b);
+template <typename T, typename A> buffer2D<T,A>& operator+=(buffer2D<T,A>& a, T const& b);
+template <typename T, typename A, typename E> buffer2D<T,A>& operator+=(buffer2D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer2D<T>& operator-=(buffer2D<T>& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>& operator-=(buffer2D<T>& a, T const& b);
-template <typename T> buffer2D<T>  operator-(buffer2D<T> const& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>  operator-(buffer2D<T> const& a, T const& b);
-template <typename T> buffer2D<T>  operator-(T const& a, buffer2D<T> const& b);
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator-=(buffer2D<T,A>& a, buffer2D<T,A2> const& b);
+template <typename T, typename A> buffer2D<T,A>& operator-=(buffer2D<T,A>& a, T const& b);
+template <typename T, typename A, typename E> buffer2D<T,A>& operator-=(buffer2D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer2D<T>& operator*=(buffer2D<T>& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>& operator*=(buffer2D<T>& a, float b);
-template <typename T> buffer2D<T>  operator*(buffer2D<T> const& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>  operator*(buffer2D<T> const& a, float b);
-template <typename T> buffer2D<T>  operator*(float a, buffer2D<T> const& b);
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator*=(buffer2D<T,A>& a, buffer2D<T,A2> const& b);
+template <typename T, typename A> buffer2D<T,A>& operator*=(buffer2D<T,A>& a, float b);
+template <typename T, typename A, typename E> buffer2D<T,A>& operator*=(buffer2D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer2D<T>& operator/=(buffer2D<T>& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>& operator/=(buffer2D<T>& a, float b);
-template <typename T> buffer2D<T>  operator/(buffer2D<T> const& a, buffer2D<T> const& b);
-template <typename T> buffer2D<T>  operator/(buffer2D<T> const& a, float b);
-template <typename T> buffer2D<T>  operator/(float a, buffer2D<T> const& b);
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator/=(buffer2D<T,A>& a, buffer2D<T,A2> const& b);
+template <typename T, typename A> buffer2D<T,A>& operator/=(buffer2D<T,A>& a, float b);
+template <typename T, typename A, typename E> buffer2D<T,A>& operator/=(buffer2D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer2D<T> buffer2D_from_vector(buffer<T> const& arg, size_t size_1, size_t size_2);
+template <typename T, typename A>
+struct buffer_operand<buffer2D<T,A>>
+{
+    static constexpr bool is_operand = true;
+    using value_type = T;
+    using dimension_type = size_t2;
+    using storage = buffer2D<T,A> const&;
+    static size_t size(buffer2D<T,A> const& x) { return x.data.data.size(); }
+    static size_t2 dimension(buffer2D<T,A> const& x) { return x.dimension; }
+    static T const& element(buffer2D<T,A> const& x, size_t k) { return x.data.data[k]; }
+};
+
+template <typename T>
+struct buffer_evaluation<size_t2, T>
+{
+    using type = buffer2D<T>;
+};
+
+template <typename T, typename A> buffer2D<T,A> buffer2D_from_vector(buffer<T,A> const& arg, size_t size_1, size_t size_2);
 
 }
 
@@ -97,91 +112,122 @@ static inline size_t offset(size_t2 const& k, size_t2 const& dim)
 }
 
 
-template <typename T>
-buffer2D<T>::buffer2D()
+template <typename T, typename A>
+buffer2D<T,A>::buffer2D()
     :dimension(size_t2{0,0}),data()
 {}
 
-template <typename T>
-buffer2D<T>::buffer2D(size_t size)
+template <typename T, typename A>
+buffer2D<T,A>::buffer2D(size_t size)
     :dimension({size,size}),data(size*size)
 {}
 
-template <typename T>
-buffer2D<T>::buffer2D(size_t2 const& size)
+template <typename T, typename A>
+buffer2D<T,A>::buffer2D(size_t2 const& size)
     :dimension(size),data(size[0]*size[1])
 {}
 
-template <typename T>
-buffer2D<T>::buffer2D(size_t size_1, size_t size_2)
+template <typename T, typename A>
+buffer2D<T,A>::buffer2D(size_t2 const& size, A const& allocator)
+    :dimension(size),data(size[0]*size[1], allocator)
+{}
+
+template <typename T, typename A>
+buffer2D<T,A>::buffer2D(size_t size_1, size_t size_2)
     :dimension({size_1,size_2}),data(size_1*size_2)
 {}
 
+template <typename T, typename A>
+template <typename E>
+buffer2D<T,A>::buffer2D(buffer_expression<E> const& e)
+    :dimension(),data()
+{
+    *this = e;
+}
+
+template <typename T, typename A>
+template <typename E>
+buffer2D<T,A>& buffer2D<T,A>::operator=(buffer_expression<E> const& e)
+{
+    static_assert(std::is_same<typename E::dimension_type, size_t2>::value, "Expression of a different kind of buffer assigned to a buffer2D");
 
+    // The buffer may be an operand of the expression: each element only depends on the operands at the same index
+    E const& x = e.derived();
+    dimension = x.dimension();
+    size_t const N = x.size();
+    data.data.resize(N);
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            data.data[k] = x[k];
+    });
+    return *this;
+}
 
-template <typename T>
-size_t buffer2D<T>::size() const
+
+
+template <typename T, typename A>
+size_t buffer2D<T,A>::size() const
 {
     return dimension[0]*dimension[1];
 }
 
-template <typename T>
-void buffer2D<T>::resize(size_t size)
+template <typename T, typename A>
+void buffer2D<T,A>::resize(size_t size)
 {
     resize(size,size);
 }
 
-template <typename T>
-void buffer2D<T>::resize(size_t2 const& size)
+template <typename T, typename A>
+void buffer2D<T,A>::resize(size_t2 const& size)
 {
     dimension = size;
     data.resize(size[0]*size[1]);
 }
 
-template <typename T>
-void buffer2D<T>::resize(size_t size_1, size_t size_2)
+template <typename T, typename A>
+void buffer2D<T,A>::resize(size_t size_1, size_t size_2)
 {
     dimension = {size_1,size_2};
     resize({size_1,size_2});
 }
 
-template <typename T>
-void buffer2D<T>::fill(T const& value)
+template <typename T, typename A>
+void buffer2D<T,A>::fill(T const& value)
 {
     data.fill(value);
 }
 
 
-template <typename T>
-T const& buffer2D<T>::operator[](size_t const& index) const
+template <typename T, typename A>
+T const& buffer2D<T,A>::operator[](size_t const& index) const
 {
     assert_vcl(index<data.size(), "Index="+str(index));
     return data[index];
 }
 
-template <typename T>
-T & buffer2D<T>::operator[](size_t const& index)
+template <typename T, typename A>
+T & buffer2D<T,A>::operator[](size_t const& index)
 {
     assert_vcl(index<data.size(), "Index="+str(index));
     return data[index];
 }
 
-template <typename T>
-T const& buffer2D<T>::operator()(size_t const& index) const
+template <typename T, typename A>
+T const& buffer2D<T,A>::operator()(size_t const& index) const
 {
     return (*this)[index];
 }
 
-template <typename T>
-T & buffer2D<T>::operator()(size_t const& index)
+template <typename T, typename A>
+T & buffer2D<T,A>::operator()(size_t const& index)
 {
     return (*this)[index];
 }
 
 
 
-template <typename T>
-T const& buffer2D<T>::operator[](size_t2 const& index) const
+template <typename T, typename A>
+T const& buffer2D<T,A>::operator[](size_t2 const& index) const
 {
     assert_vcl(index[0]<dimension[0], "index=("+str(index)+"), dimension=("+str(dimension)+")");
     assert_vcl(index[1]<dimension[1], "index=("+str(index)+"), dimension=("+str(dimension)+")");
@@ -192,8 +238,8 @@ T const& buffer2D<T>::operator[](size_t2 const& index) const
     return data[k];
 }
 
-template <typename T>
-T & buffer2D<T>::operator[](size_t2 const& index)
+template <typename T, typename A>
+T & buffer2D<T,A>::operator[](size_t2 const& index)
 {
     assert_vcl(index[0]<dimension[0], "index=("+str(index)+"), dimension=("+str(dimension)+")");
     assert_vcl(index[1]<dimension[1], "index=("+str(index)+"), dimension=("+str(dimension)+")");
@@ -206,199 +252,178 @@ T & buffer2D<T>::operator[](size_t2 const& index)
 
 
 
-template <typename T>
-T const& buffer2D<T>::operator()(size_t2 const& index) const
+template <typename T, typename A>
+T const& buffer2D<T,A>::operator()(size_t2 const& index) const
 {
     return (*this)[index];
 }
 
-template <typename T>
-T & buffer2D<T>::operator()(size_t2 const& index)
+template <typename T, typename A>
+T & buffer2D<T,A>::operator()(size_t2 const& index)
 {
     return (*this)[index];
 }
 
-template <typename T>
-T const& buffer2D<T>::operator()(size_t k1, size_t k2) const
+template <typename T, typename A>
+T const& buffer2D<T,A>::operator()(size_t k1, size_t k2) const
 {
     return (*this)({k1,k2});
 }
 
-template <typename T>
-T & buffer2D<T>::operator()(size_t k1, size_t k2)
+template <typename T, typename A>
+T & buffer2D<T,A>::operator()(size_t k1, size_t k2)
 {
     return (*this)({k1,k2});
 }
 
-template <typename T>
-typename std::vector<T>::iterator buffer2D<T>::begin()
+template <typename T, typename A>
+typename std::vector<T,A>::iterator buffer2D<T,A>::begin()
 {
     return data.begin();
 }
 
-template <typename T>
-typename std::vector<T>::iterator buffer2D<T>::end()
+template <typename T, typename A>
+typename std::vector<T,A>::iterator buffer2D<T,A>::end()
 {
     return data.end();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer2D<T>::begin() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer2D<T,A>::begin() const
 {
     return data.begin();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer2D<T>::end() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer2D<T,A>::end() const
 {
     return data.end();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer2D<T>::cbegin() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer2D<T,A>::cbegin() const
 {
     return data.cbegin();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer2D<T>::cend() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer2D<T,A>::cend() const
 {
     return data.cend();
 }
 
-template <typename T> std::ostream& operator<<(std::ostream& s, buffer2D<T> const& v)
+template <typename T, typename A> std::ostream& operator<<(std::ostream& s, buffer2D<T,A> const& v)
 {
     return s << v.data;
 }
-template <typename T> std::string to_string(buffer2D<T> const& v, std::string const& separator)
+template <typename T, typename A> std::string to_string(buffer2D<T,A> const& v, std::string const& separator)
 {
     return to_string(v.data, separator);
 }
 
 
-template <typename T> buffer2D<T>& operator+=(buffer2D<T>& a, buffer2D<T> const& b)
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator+=(buffer2D<T,A>& a, buffer2D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
     a.data += b.data;
+    return a;
 }
-template <typename T> buffer2D<T>& operator+=(buffer2D<T>& a, T const& b)
+template <typename T, typename A> buffer2D<T,A>& operator+=(buffer2D<T,A>& a, T const& b)
 {
     a.data += b;
+    return a;
 }
-template <typename T> buffer2D<T>  operator+(buffer2D<T> const& a, buffer2D<T> const& b)
+template <typename T, typename A, typename E> buffer2D<T,A>& operator+=(buffer2D<T,A>& a, buffer_expression<E> const& b)
 {
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer2D<T> res(a.dimension);
-    res.data = a.data+b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
 
-}
-template <typename T> buffer2D<T>  operator+(buffer2D<T> const& a, T const& b)
-{
-    buffer2D<T> res(a.dimension);
-    res.data = a.data+b;
-    return res;
-}
-template <typename T> buffer2D<T>  operator+(T const& a, buffer2D<T> const& b)
-{
-    buffer2D<T> res(b.dimension);
-    res.data = a + b.data;
-    return res;
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] += x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer2D<T>& operator-=(buffer2D<T>& a, buffer2D<T> const& b)
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator-=(buffer2D<T,A>& a, buffer2D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    a.data += b.data;
+    a.data -= b.data;
+    return a;
 }
-template <typename T> buffer2D<T>& operator-=(buffer2D<T>& a, T const& b)
+template <typename T, typename A> buffer2D<T,A>& operator-=(buffer2D<T,A>& a, T const& b)
 {
     a.data -= b;
+    return a;
 }
-template <typename T> buffer2D<T>  operator-(buffer2D<T> const& a, buffer2D<T> const& b)
-{
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer2D<T> res(a.dimension);
-    res.data = a.data-b.data;
-    return res;
-}
-template <typename T> buffer2D<T>  operator-(buffer2D<T> const& a, T const& b)
+template <typename T, typename A, typename E> buffer2D<T,A>& operator-=(buffer2D<T,A>& a, buffer_expression<E> const& b)
 {
-    buffer2D<T> res(a.dimension);
-    res.data = a.data-b;
-    return res;
-}
-template <typename T> buffer2D<T>  operator-(T const& a, buffer2D<T> const& b)
-{
-    buffer2D<T> res(a.dimension);
-    res.data = a-b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
+
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] -= x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer2D<T>& operator*=(buffer2D<T>& a, buffer2D<T> const& b)
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator*=(buffer2D<T,A>& a, buffer2D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
     a.data *= b.data;
+    return a;
 }
-template <typename T> buffer2D<T>& operator*=(buffer2D<T>& a, float b)
+template <typename T, typename A> buffer2D<T,A>& operator*=(buffer2D<T,A>& a, float b)
 {
     a.data *= b;
+    return a;
 }
-template <typename T> buffer2D<T>  operator*(buffer2D<T> const& a, buffer2D<T> const& b)
+template <typename T, typename A, typename E> buffer2D<T,A>& operator*=(buffer2D<T,A>& a, buffer_expression<E> const& b)
 {
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer2D<T> res(a.dimension);
-    res.data = a.data*b.data;
-    return res;
-}
-template <typename T> buffer2D<T>  operator*(buffer2D<T> const& a, float b)
-{
-    buffer2D<T> res(a.dimension);
-    res.data = a.data*b;
-    return res;
-}
-template <typename T> buffer2D<T>  operator*(float a, buffer2D<T> const& b)
-{
-    buffer2D<T> res(b.dimension);
-    res.data = a*b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
+
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] *= x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer2D<T>& operator/=(buffer2D<T>& a, buffer2D<T> const& b)
+template <typename T, typename A, typename A2> buffer2D<T,A>& operator/=(buffer2D<T,A>& a, buffer2D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
     a.data /= b.data;
+    return a;
 }
-template <typename T> buffer2D<T>& operator/=(buffer2D<T>& a, float b)
+template <typename T, typename A> buffer2D<T,A>& operator/=(buffer2D<T,A>& a, float b)
 {
-    a.data *= b;
-}
-template <typename T> buffer2D<T>  operator/(buffer2D<T> const& a, buffer2D<T> const& b)
-{
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer2D<T> res(a.dimension);
-    res.data = a.data/b.data;
-    return res;
+    a.data /= b;
+    return a;
 }
-template <typename T> buffer2D<T>  operator/(buffer2D<T> const& a, float b)
+template <typename T, typename A, typename E> buffer2D<T,A>& operator/=(buffer2D<T,A>& a, buffer_expression<E> const& b)
 {
-    buffer2D<T> res(a.dimension);
-    res.data = a.data/b;
-    return res;
-}
-template <typename T> buffer2D<T>  operator/(float a, buffer2D<T> const& b)
-{
-    buffer2D<T> res(b.dimension);
-    res.data = a/b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
+
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] /= x[k];
+    });
+    return a;
 }
 
-template <typename T>
-buffer2D<T> buffer2D_from_vector(buffer<T> const& arg, size_t size_1, size_t size_2)
+template <typename T, typename A>
+buffer2D<T,A> buffer2D_from_vector(buffer<T,A> const& arg, size_t size_1, size_t size_2)
 {
     assert_vcl(arg.size()==size_1*size_2, "Incoherent size to generate buffer2D");
 
-    buffer2D<T> b(size_1, size_2);
+    buffer2D<T,A> b(size_1, size_2);
     b.data = arg;
 
     return b;
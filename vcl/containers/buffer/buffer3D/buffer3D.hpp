@@ -12,16 +12,20 @@
 namespace vcl
 {
 
-template <typename T>
+template <typename T, typename Allocator = std::allocator<T>>
 struct buffer3D
 {
     size_t3 dimension;
-    buffer<T> data;
+    buffer<T,Allocator> data;
 
     buffer3D();
     buffer3D(size_t size);
     buffer3D(size_t3 const& size);
+    buffer3D(size_t3 const& size, Allocator const& allocator);
     buffer3D(size_t size_1, size_t size_2, size_t size_3);
+    // Evaluate a lazy expression of buffer3Ds (a+b*c, ...) in a single loop
+    template <typename E> buffer3D(buffer_expression<E> const& e);
+    template <typename E> buffer3D& operator=(buffer_expression<E> const& e);
 
     void clear();
     size_t size() const;
@@ -42,40 +46,51 @@ struct buffer3D
     T const& operator()(size_t k1, size_t k2, size_t k3) const;
     T & operator()(size_t k1, size_t k2, size_t k3);
 
-    typename std::vector<T>::iterator begin();
-    typename std::vector<T>::iterator end();
-    typename std::vector<T>::const_iterator begin() const;
-    typename std::vector<T>::const_iterator end() const;
-    typename std::vector<T>::const_iterator cbegin() const;
-    typename std::vector<T>::const_iterator cend() const;
+    typename std::vector<T,Allocator>::iterator begin();
+    typename std::vector<T,Allocator>::iterator end();
+    typename std::vector<T,Allocator>::const_iterator begin() const;
+    typename std::vector<T,Allocator>::const_iterator end() const;
+    typename std::vector<T,Allocator>::const_iterator cbegin() const;
+    typename std::vector<T,Allocator>::const_iterator cend() const;
 };
 
-template <typename T> std::ostream& operator<<(std::ostream& s, buffer3D<T> const& v);
-template <typename T> std::string to_string(buffer3D<T> const& v, std::string const& separator=" ");
+template <typename T, typename A> std::ostream& operator<<(std::ostream& s, buffer3D<T,A> const& v);
+template <typename T, typename A> std::string to_string(buffer3D<T,A> const& v, std::string const& separator=" ");
 
-template <typename T> buffer3D<T>& operator+=(buffer3D<T>& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>& operator+=(buffer3D<T>& a, T const& b);
-template <typename T> buffer3D<T>  operator+(buffer3D<T> const& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>  operator+(buffer3D<T> const& a, T const& b);
-template <typename T> buffer3D<T>  operator+(T const& a, buffer3D<T> const& b);
+// The operators +, -, * and / are lazy (see buffer_expression), the compound assignments are in place (the operand may use another allocator)
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator+=(buffer3D<T,A>& a, buffer3D<T,A2> const& b);
+template <typename T, typename A> buffer3D<T,A>& operator+=(buffer3D<T,A>& a, T const& b);
+template <typename T, typename A, typename E> buffer3D<T,A>& operator+=(buffer3D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer3D<T>& operator-=(buffer3D<T>& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>& operator-=(buffer3D<T>& a, T const& b);
-template <typename T> buffer3D<T>  operator-(buffer3D<T> const& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>  operator-(buffer3D<T> const& a, T const& b);
-template <typename T> buffer3D<T>  operator-(T const& a, buffer3D<T> const& b);
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator-=(buffer3D<T,A>& a, buffer3D<T,A2> const& b);
+template <typename T, typename A> buffer3D<T,A>& operator-=(buffer3D<T,A>& a, T const& b);
+template <typename T, typename A, typename E> buffer3D<T,A>& operator-=(buffer3D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer3D<T>& operator*=(buffer3D<T>& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>& operator*=(buffer3D<T>& a, float b);
-template <typename T> buffer3D<T>  operator*(buffer3D<T> const& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>  operator*(buffer3D<T> const& a, float b);
-template <typename T> buffer3D<T>  operator*(float a, buffer3D<T> const& b);
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator*=(buffer3D<T,A>& a, buffer3D<T,A2> const& b);
+template <typename T, typename A> buffer3D<T,A>& operator*=(buffer3D<T,A>& a, float b);
+template <typename T, typename A, typename E> buffer3D<T,A>& operator*=(buffer3D<T,A>& a, buffer_expression<E> const& b);
 
-template <typename T> buffer3D<T>& operator/=(buffer3D<T>& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>& operator/=(buffer3D<T>& a, float b);
-template <typename T> buffer3D<T>  operator/(buffer3D<T> const& a, buffer3D<T> const& b);
-template <typename T> buffer3D<T>  operator/(buffer3D<T> const& a, float b);
-template <typename T> buffer3D<T>  operator/(float a, buffer3D<T> const& b);
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator/=(buffer3D<T,A>& a, buffer3D<T,A2> const& b);
+template <typename T, typename A> buffer3D<T,A>& operator/=(buffer3D<T,A>& a, float b);
+template <typename T, typename A, typename E> buffer3D<T,A>& operator/=(buffer3D<T,A>& a, buffer_expression<E> const& b);
+
+template <typename T, typename A>
+struct buffer_operand<buffer3D<T,A>>
+{
+    static constexpr bool is_operand = true;
+    using value_type = T;
+    using dimension_type = size_t3;
+    using storage = buffer3D<T,A> const&;
+    static size_t size(buffer3D<T,A> const& x) { return x.data.data.size(); }
+    static size_t3 dimension(buffer3D<T,A> const& x) { return x.dimension; }
+    static T const& element(buffer3D<T,A> const& x, size_t k) { return x.data.data[k]; }
+};
+
+template <typename T>
+struct buffer_evaluation<size_t3, T>
+{
+    using type = buffer3D<T>;
+};
 
 }
 
@@ -94,89 +109,120 @@ static inline size_t offset(size_t3 const& k, size_t3 const& dim)
 }
 
 
-template <typename T>
-buffer3D<T>::buffer3D()
+template <typename T, typename A>
+buffer3D<T,A>::buffer3D()
     :dimension(size_t3{0,0,0}),data()
 {}
 
-template <typename T>
-buffer3D<T>::buffer3D(size_t size)
+template <typename T, typename A>
+buffer3D<T,A>::buffer3D(size_t size)
     :dimension({size,size,size}),data(size*size*size)
 {}
 
-template <typename T>
-buffer3D<T>::buffer3D(size_t3 const& size)
+template <typename T, typename A>
+buffer3D<T,A>::buffer3D(size_t3 const& size)
     :dimension(size),data(size[0]*size[1]*size[2])
 {}
 
-template <typename T>
-buffer3D<T>::buffer3D(size_t size_1, size_t size_2, size_t size_3)
+template <typename T, typename A>
+buffer3D<T,A>::buffer3D(size_t3 const& size, A const& allocator)
+    :dimension(size),data(size[0]*size[1]*size[2], allocator)
+{}
+
+template <typename T, typename A>
+buffer3D<T,A>::buffer3D(size_t size_1, size_t size_2, size_t size_3)
     :dimension({size_1,size_2}),data(size_1*size_2*size_3)
 {}
 
-template <typename T>
-size_t buffer3D<T>::size() const
+template <typename T, typename A>
+template <typename E>
+buffer3D<T,A>::buffer3D(buffer_expression<E> const& e)
+    :dimension(),data()
+{
+    *this = e;
+}
+
+template <typename T, typename A>
+template <typename E>
+buffer3D<T,A>& buffer3D<T,A>::operator=(buffer_expression<E> const& e)
+{
+    static_assert(std::is_same<typename E::dimension_type, size_t3>::value, "Expression of a different kind of buffer assigned to a buffer3D");
+
+    // The buffer may be an operand of the expression: each element only depends on the operands at the same index
+    E const& x = e.derived();
+    dimension = x.dimension();
+    size_t const N = x.size();
+    data.data.resize(N);
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            data.data[k] = x[k];
+    });
+    return *this;
+}
+
+template <typename T, typename A>
+size_t buffer3D<T,A>::size() const
 {
     return dimension[0]*dimension[1]*dimension[2];
 }
 
-template <typename T>
-void buffer3D<T>::resize(size_t size)
+template <typename T, typename A>
+void buffer3D<T,A>::resize(size_t size)
 {
     resize(size,size,size);
 }
 
-template <typename T>
-void buffer3D<T>::resize(size_t3 const& size)
+template <typename T, typename A>
+void buffer3D<T,A>::resize(size_t3 const& size)
 {
     dimension = size;
     data.resize(size[0]*size[1]*size[2]);
 }
 
-template <typename T>
-void buffer3D<T>::resize(size_t size_1, size_t size_2, size_t size_3)
+template <typename T, typename A>
+void buffer3D<T,A>::resize(size_t size_1, size_t size_2, size_t size_3)
 {
     dimension = {size_1, size_2, size_3};
     resize({size_1, size_2, size_3});
 }
 
-template <typename T>
-void buffer3D<T>::fill(T const& value)
+template <typename T, typename A>
+void buffer3D<T,A>::fill(T const& value)
 {
     data.fill(value);
 }
 
 
-template <typename T>
-T const& buffer3D<T>::operator[](size_t const& index) const
+template <typename T, typename A>
+T const& buffer3D<T,A>::operator[](size_t const& index) const
 {
     assert_vcl(index<data.size(), "Index="+str(index));
     return data[index];
 }
 
-template <typename T>
-T & buffer3D<T>::operator[](size_t const& index)
+template <typename T, typename A>
+T & buffer3D<T,A>::operator[](size_t const& index)
 {
     assert_vcl(index<data.size(), "Index="+str(index));
     return data[index];
 }
 
-template <typename T>
-T const& buffer3D<T>::operator()(size_t const& index) const
+template <typename T, typename A>
+T const& buffer3D<T,A>::operator()(size_t const& index) const
 {
     return (*this)[index];
 }
 
-template <typename T>
-T & buffer3D<T>::operator()(size_t const& index)
+template <typename T, typename A>
+T & buffer3D<T,A>::operator()(size_t const& index)
 {
     return (*this)[index];
 }
 
 
 
-template <typename T>
-T const& buffer3D<T>::operator[](size_t3 const& index) const
+template <typename T, typename A>
+T const& buffer3D<T,A>::operator[](size_t3 const& index) const
 {
     assert_vcl(index[0]<dimension[0], "index=("+str(index)+"), dimension=("+str(dimension)+")");
     assert_vcl(index[1]<dimension[1], "index=("+str(index)+"), dimension=("+str(dimension)+")");
@@ -188,8 +234,8 @@ T const& buffer3D<T>::operator[](size_t3 const& index) const
     return data[k];
 }
 
-template <typename T>
-T & buffer3D<T>::operator[](size_t3 const& index)
+template <typename T, typename A>
+T & buffer3D<T,A>::operator[](size_t3 const& index)
 {
     assert_vcl(index[0]<dimension[0], "index=("+str(index)+"), dimension=("+str(dimension)+")");
     assert_vcl(index[1]<dimension[1], "index=("+str(index)+"), dimension=("+str(dimension)+")");
@@ -203,193 +249,170 @@ T & buffer3D<T>::operator[](size_t3 const& index)
 
 
 
-template <typename T>
-T const& buffer3D<T>::operator()(size_t3 const& index) const
+template <typename T, typename A>
+T const& buffer3D<T,A>::operator()(size_t3 const& index) const
 {
     return (*this)[index];
 }
 
-template <typename T>
-T & buffer3D<T>::operator()(size_t3 const& index)
+template <typename T, typename A>
+T & buffer3D<T,A>::operator()(size_t3 const& index)
 {
     return (*this)[index];
 }
 
-template <typename T>
-T const& buffer3D<T>::operator()(size_t k1, size_t k2, size_t k3) const
+template <typename T, typename A>
+T const& buffer3D<T,A>::operator()(size_t k1, size_t k2, size_t k3) const
 {
     return (*this)({k1,k2,k3});
 }
 
-template <typename T>
-T & buffer3D<T>::operator()(size_t k1, size_t k2, size_t k3)
+template <typename T, typename A>
+T & buffer3D<T,A>::operator()(size_t k1, size_t k2, size_t k3)
 {
     return (*this)({k1,k2,k3});
 }
 
-template <typename T>
-typename std::vector<T>::iterator buffer3D<T>::begin()
+template <typename T, typename A>
+typename std::vector<T,A>::iterator buffer3D<T,A>::begin()
 {
     return data.begin();
 }
 
-template <typename T>
-typename std::vector<T>::iterator buffer3D<T>::end()
+template <typename T, typename A>
+typename std::vector<T,A>::iterator buffer3D<T,A>::end()
 {
     return data.end();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer3D<T>::begin() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer3D<T,A>::begin() const
 {
     return data.begin();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer3D<T>::end() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer3D<T,A>::end() const
 {
     return data.end();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer3D<T>::cbegin() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer3D<T,A>::cbegin() const
 {
     return data.cbegin();
 }
 
-template <typename T>
-typename std::vector<T>::const_iterator buffer3D<T>::cend() const
+template <typename T, typename A>
+typename std::vector<T,A>::const_iterator buffer3D<T,A>::cend() const
 {
     return data.cend();
 }
 
-template <typename T> std::ostream& operator<<(std::ostream& s, buffer3D<T> const& v)
+template <typename T, typename A> std::ostream& operator<<(std::ostream& s, buffer3D<T,A> const& v)
 {
     return s << v.data;
 }
-template <typename T> std::string to_string(buffer3D<T> const& v, std::string const& separator)
+template <typename T, typename A> std::string to_string(buffer3D<T,A> const& v, std::string const& separator)
 {
     return to_string(v.data, separator);
 }
 
 
-template <typename T> buffer3D<T>& operator+=(buffer3D<T>& a, buffer3D<T> const& b)
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator+=(buffer3D<T,A>& a, buffer3D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
     a.data += b.data;
+    return a;
 }
-template <typename T> buffer3D<T>& operator+=(buffer3D<T>& a, T const& b)
+template <typename T, typename A> buffer3D<T,A>& operator+=(buffer3D<T,A>& a, T const& b)
 {
     a.data += b;
+    return a;
 }
-template <typename T> buffer3D<T>  operator+(buffer3D<T> const& a, buffer3D<T> const& b)
+template <typename T, typename A, typename E> buffer3D<T,A>& operator+=(buffer3D<T,A>& a, buffer_expression<E> const& b)
 {
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer3D<T> res(a.dimension);
-    res.data = a.data+b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
 
-}
-template <typename T> buffer3D<T>  operator+(buffer3D<T> const& a, T const& b)
-{
-    buffer3D<T> res(a.dimension);
-    res.data = a.data+b;
-    return res;
-}
-template <typename T> buffer3D<T>  operator+(T const& a, buffer3D<T> const& b)
-{
-    buffer3D<T> res(b.dimension);
-    res.data = a + b.data;
-    return res;
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] += x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer3D<T>& operator-=(buffer3D<T>& a, buffer3D<T> const& b)
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator-=(buffer3D<T,A>& a, buffer3D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    a.data += b.data;
+    a.data -= b.data;
+    return a;
 }
-template <typename T> buffer3D<T>& operator-=(buffer3D<T>& a, T const& b)
+template <typename T, typename A> buffer3D<T,A>& operator-=(buffer3D<T,A>& a, T const& b)
 {
     a.data -= b;
+    return a;
 }
-template <typename T> buffer3D<T>  operator-(buffer3D<T> const& a, buffer3D<T> const& b)
-{
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer3D<T> res(a.dimension);
-    res.data = a.data-b.data;
-    return res;
-}
-template <typename T> buffer3D<T>  operator-(buffer3D<T> const& a, T const& b)
-{
-    buffer3D<T> res(a.dimension);
-    res.data = a.data-b;
-    return res;
-}
-template <typename T> buffer3D<T>  operator-(T const& a, buffer3D<T> const& b)
+template <typename T, typename A, typename E> buffer3D<T,A>& operator-=(buffer3D<T,A>& a, buffer_expression<E> const& b)
 {
-    buffer3D<T> res(a.dimension);
-    res.data = a-b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
+
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] -= x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer3D<T>& operator*=(buffer3D<T>& a, buffer3D<T> const& b)
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator*=(buffer3D<T,A>& a, buffer3D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
     a.data *= b.data;
+    return a;
 }
-template <typename T> buffer3D<T>& operator*=(buffer3D<T>& a, float b)
+template <typename T, typename A> buffer3D<T,A>& operator*=(buffer3D<T,A>& a, float b)
 {
     a.data *= b;
+    return a;
 }
-template <typename T> buffer3D<T>  operator*(buffer3D<T> const& a, buffer3D<T> const& b)
-{
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer3D<T> res(a.dimension);
-    res.data = a.data*b.data;
-    return res;
-}
-template <typename T> buffer3D<T>  operator*(buffer3D<T> const& a, float b)
+template <typename T, typename A, typename E> buffer3D<T,A>& operator*=(buffer3D<T,A>& a, buffer_expression<E> const& b)
 {
-    buffer3D<T> res(a.dimension);
-    res.data = a.data*b;
-    return res;
-}
-template <typename T> buffer3D<T>  operator*(float a, buffer3D<T> const& b)
-{
-    buffer3D<T> res(b.dimension);
-    res.data = a*b.data;
-    return res;
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
+
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] *= x[k];
+    });
+    return a;
 }
 
-template <typename T> buffer3D<T>& operator/=(buffer3D<T>& a, buffer3D<T> const& b)
+template <typename T, typename A, typename A2> buffer3D<T,A>& operator/=(buffer3D<T,A>& a, buffer3D<T,A2> const& b)
 {
     assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
     a.data /= b.data;
+    return a;
 }
-template <typename T> buffer3D<T>& operator/=(buffer3D<T>& a, float b)
+template <typename T, typename A> buffer3D<T,A>& operator/=(buffer3D<T,A>& a, float b)
 {
-    a.data *= b;
+    a.data /= b;
+    return a;
 }
-template <typename T> buffer3D<T>  operator/(buffer3D<T> const& a, buffer3D<T> const& b)
+template <typename T, typename A, typename E> buffer3D<T,A>& operator/=(buffer3D<T,A>& a, buffer_expression<E> const& b)
 {
-    assert_vcl( is_equal(a.dimension,b.dimension), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(b.dimension) );
-    buffer3D<T> res(a.dimension);
-    res.data = a.data/b.data;
-    return res;
-}
-template <typename T> buffer3D<T>  operator/(buffer3D<T> const& a, float b)
-{
-    buffer3D<T> res(a.dimension);
-    res.data = a.data/b;
-    return res;
-}
-template <typename T> buffer3D<T>  operator/(float a, buffer3D<T> const& b)
-{
-    buffer3D<T> res(b.dimension);
-    res.data = a/b.data;
-    return res;
-}
-
+    E const& x = b.derived();
+    assert_vcl( is_equal(a.dimension,x.dimension()), "Dimension do not agree: a:"+str(a.dimension)+", b:"+str(x.dimension()) );
 
+    size_t const N = a.size();
+    parallel_for(N, [&](size_t begin, size_t end){
+        for(size_t k=begin; k<end; ++k)
+            a.data.data[k] /= x[k];
+    });
+    return a;
+}
 
 }
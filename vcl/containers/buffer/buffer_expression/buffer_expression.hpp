@@ -0,0 +1,367 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "vcl/base/base.hpp"
+
+/** ************************************************** **/
+/**           Header                                   **/
+/** ************************************************** **/
+
+/** Lazy element-wise arithmetic on buffer, buffer2D and buffer3D.
+ * The operators +, -, * and / return an expression referencing their operands instead of a new buffer. The expression
+ * is evaluated in a single loop, without temporary buffers, when it is assigned to (or used to construct) a buffer:
+ *   buffer<vec3> p = a + b*c - d/2.0f;   // one allocation, one pass over the elements
+ *   p += (q - p)*0.5f;                   // no allocation
+ * An expression references the named buffers it is made of: stored with auto, it must be evaluated before they are
+ * modified or destroyed. Temporary buffers (a + f(b)) are moved into the expression. The operands of an expression must
+ * have the same dimension. eval(e) returns the buffer of an expression, the functions taking buffers of any element
+ * type (operator<<, to_string, average) also accept expressions. */
+
+namespace vcl
+{
+
+/** Base of the lazy expressions, buffers are constructed and assigned from it */
+template <typename E>
+struct buffer_expression
+{
+    E const& derived() const { return static_cast<E const&>(*this); }
+};
+
+/** Description of the operands of the expressions, specialized for buffer, buffer2D, buffer3D and the expressions:
+ *   value_type     - type of the elements
+ *   dimension_type - size_t, size_t2 or size_t3
+ *   storage        - how an expression keeps an lvalue operand (reference to a buffer, copy of an expression)
+ *   size(x), dimension(x), element(x,k) */
+template <typename X>
+struct buffer_operand
+{
+    static constexpr bool is_operand = false;
+};
+
+/** Buffer storing the evaluation of an expression, specialized by buffer, buffer2D and buffer3D on their dimension_type */
+template <typename D, typename T>
+struct buffer_evaluation;
+
+namespace detail
+{
+
+// Operand kept by an expression built from X&& (deduced by the operators): the storage of buffer_operand for an lvalue,
+// the value itself for a temporary
+template <typename X>
+using buffer_stored = typename std::conditional<std::is_lvalue_reference<X>::value,
+    typename buffer_operand<typename std::decay<X>::type>::storage, typename std::decay<X>::type>::type;
+
+struct buffer_add      { template <typename A, typename B> static auto apply(A const& a, B const& b) -> decltype(a+b) { return a+b; } };
+struct buffer_subtract { template <typename A, typename B> static auto apply(A const& a, B const& b) -> decltype(a-b) { return a-b; } };
+struct buffer_multiply { template <typename A, typename B> static auto apply(A const& a, B const& b) -> decltype(a*b) { return a*b; } };
+struct buffer_divide   { template <typename A, typename B> static auto apply(A const& a, B const& b) -> decltype(a/b) { return a/b; } };
+
+// Type of the scalar operand: the element type for + and -, float for * and / (as the former buffer operators)
+template <typename Op, typename T> struct buffer_scalar_type                  { using type = T; };
+template <typename T> struct buffer_scalar_type<buffer_multiply, T>          { using type = float; };
+template <typename T> struct buffer_scalar_type<buffer_divide, T>            { using type = float; };
+
+/** Element-wise operation between two operands of the same dimension.
+ * L and R are the stored operands (see buffer_stored): reference to a buffer, or value of a temporary buffer or of an expression */
+template <typename Op, typename L, typename R>
+struct buffer_binary_expression : buffer_expression<buffer_binary_expression<Op,L,R>>
+{
+    using left_operand = buffer_operand<typename std::decay<L>::type>;
+    using right_operand = buffer_operand<typename std::decay<R>::type>;
+    using value_type = typename std::decay<decltype(Op::apply(std::declval<typename left_operand::value_type>(), std::declval<typename right_operand::value_type>()))>::type;
+    using dimension_type = typename left_operand::dimension_type;
+    static_assert(std::is_same<dimension_type, typename right_operand::dimension_type>::value, "Operands of different kinds of buffers");
+
+    buffer_binary_expression(L l, R r);
+
+    size_t size() const { return left_operand::size(left); }
+    dimension_type dimension() const { return left_operand::dimension(left); }
+    value_type operator[](size_t k) const { return Op::apply(left_operand::element(left,k), right_operand::element(right,k)); }
+
+    L left;
+    R right;
+};
+
+// Operation with the scalar on the left (scalar_left) or on the right of the element
+template <typename Op, bool scalar_left> struct buffer_scalar_apply
+{
+    template <typename V, typename S> static auto apply(V const& v, S const& s) -> decltype(Op::apply(v,s)) { return Op::apply(v,s); }
+};
+template <typename Op> struct buffer_scalar_apply<Op,true>
+{
+    template <typename V, typename S> static auto apply(V const& v, S const& s) -> decltype(Op::apply(s,v)) { return Op::apply(s,v); }
+};
+
+/** Element-wise operation between an operand and a scalar (on the right, or on the left if scalar_left) */
+template <typename Op, typename X, typename S, bool scalar_left>
+struct buffer_scalar_expression : buffer_expression<buffer_scalar_expression<Op,X,S,scalar_left>>
+{
+    using x_operand = buffer_operand<typename std::decay<X>::type>;
+    using value_type = typename std::decay<decltype(buffer_scalar_apply<Op,scalar_left>::apply(std::declval<typename x_operand::value_type>(), std::declval<S>()))>::type;
+    using dimension_type = typename x_operand::dimension_type;
+
+    buffer_scalar_expression(X x, S const& s) : operand(std::forward<X>(x)), scalar(s) {}
+
+    size_t size() const { return x_operand::size(operand); }
+    dimension_type dimension() const { return x_operand::dimension(operand); }
+    value_type operator[](size_t k) const { return buffer_scalar_apply<Op,scalar_left>::apply(x_operand::element(operand,k), scalar); }
+
+    X operand;
+    S scalar;
+};
+
+template <typename X>
+struct buffer_negate_expression : buffer_expression<buffer_negate_expression<X>>
+{
+    using x_operand = buffer_operand<typename std::decay<X>::type>;
+    using value_type = typename std::decay<decltype(-std::declval<typename x_operand::value_type>())>::type;
+    using dimension_type = typename x_operand::dimension_type;
+
+    explicit buffer_negate_expression(X x) : operand(std::forward<X>(x)) {}
+
+    size_t size() const { return x_operand::size(operand); }
+    dimension_type dimension() const { return x_operand::dimension(operand); }
+    value_type operator[](size_t k) const { return -x_operand::element(operand,k); }
+
+    X operand;
+};
+
+// A and B are the types deduced by the operators (references for the lvalues)
+template <typename A, typename B>
+using enable_if_buffer_operands = typename std::enable_if<buffer_operand<typename std::decay<A>::type>::is_operand && buffer_operand<typename std::decay<B>::type>::is_operand>::type;
+
+// X is an operand and S converts to its scalar type for the operation Op
+template <typename Op, typename X, typename S>
+using enable_if_buffer_scalar = typename std::enable_if<buffer_operand<typename std::decay<X>::type>::is_operand && !buffer_operand<S>::is_operand
+    && std::is_convertible<S const&, typename buffer_scalar_type<Op, typename buffer_operand<typename std::decay<X>::type>::value_type>::type>::value>::type;
+
+template <typename Op, typename X>
+using buffer_scalar_expression_right = buffer_scalar_expression<Op, buffer_stored<X>, typename buffer_scalar_type<Op, typename buffer_operand<typename std::decay<X>::type>::value_type>::type, false>;
+template <typename Op, typename X>
+using buffer_scalar_expression_left = buffer_scalar_expression<Op, buffer_stored<X>, typename buffer_scalar_type<Op, typename buffer_operand<typename std::decay<X>::type>::value_type>::type, true>;
+
+}
+
+/** Expressions are kept by copy (they hold references to the named buffers, temporary buffers and scalars) */
+template <typename Op, typename L, typename R>
+struct buffer_operand<detail::buffer_binary_expression<Op,L,R>>
+{
+    using type = detail::buffer_binary_expression<Op,L,R>;
+    static constexpr bool is_operand = true;
+    using value_type = typename type::value_type;
+    using dimension_type = typename type::dimension_type;
+    using storage = type;
+    static size_t size(type const& x) { return x.size(); }
+    static dimension_type dimension(type const& x) { return x.dimension(); }
+    static value_type element(type const& x, size_t k) { return x[k]; }
+};
+
+template <typename Op, typename X, typename S, bool scalar_left>
+struct buffer_operand<detail::buffer_scalar_expression<Op,X,S,scalar_left>>
+{
+    using type = detail::buffer_scalar_expression<Op,X,S,scalar_left>;
+    static constexpr bool is_operand = true;
+    using value_type = typename type::value_type;
+    using dimension_type = typename type::dimension_type;
+    using storage = type;
+    static size_t size(type const& x) { return x.size(); }
+    static dimension_type dimension(type const& x) { return x.dimension(); }
+    static value_type element(type const& x, size_t k) { return x[k]; }
+};
+
+template <typename X>
+struct buffer_operand<detail::buffer_negate_expression<X>>
+{
+    using type = detail::buffer_negate_expression<X>;
+    static constexpr bool is_operand = true;
+    using value_type = typename type::value_type;
+    using dimension_type = typename type::dimension_type;
+    using storage = type;
+    static size_t size(type const& x) { return x.size(); }
+    static dimension_type dimension(type const& x) { return x.dimension(); }
+    static value_type element(type const& x, size_t k) { return x[k]; }
+};
+
+
+template <typename A, typename B, typename = detail::enable_if_buffer_operands<A,B>>
+detail::buffer_binary_expression<detail::buffer_add,detail::buffer_stored<A>,detail::buffer_stored<B>> operator+(A&& a, B&& b);
+template <typename X, typename S, typename = detail::enable_if_buffer_scalar<detail::buffer_add,X,S>>
+detail::buffer_scalar_expression_right<detail::buffer_add,X> operator+(X&& a, S const& b);
+template <typename S, typename X, typename = detail::enable_if_buffer_scalar<detail::buffer_add,X,S>, typename = void>
+detail::buffer_scalar_expression_left<detail::buffer_add,X> operator+(S const& a, X&& b);
+
+template <typename X, typename = typename std::enable_if<buffer_operand<typename std::decay<X>::type>::is_operand>::type>
+detail::buffer_negate_expression<detail::buffer_stored<X>> operator-(X&& a);
+template <typename A, typename B, typename = detail::enable_if_buffer_operands<A,B>>
+detail::buffer_binary_expression<detail::buffer_subtract,detail::buffer_stored<A>,detail::buffer_stored<B>> operator-(A&& a, B&& b);
+template <typename X, typename S, typename = detail::enable_if_buffer_scalar<detail::buffer_subtract,X,S>>
+detail::buffer_scalar_expression_right<detail::buffer_subtract,X> operator-(X&& a, S const& b);
+template <typename S, typename X, typename = detail::enable_if_buffer_scalar<detail::buffer_subtract,X,S>, typename = void>
+detail::buffer_scalar_expression_left<detail::buffer_subtract,X> operator-(S const& a, X&& b);
+
+template <typename A, typename B, typename = detail::enable_if_buffer_operands<A,B>>
+detail::buffer_binary_expression<detail::buffer_multiply,detail::buffer_stored<A>,detail::buffer_stored<B>> operator*(A&& a, B&& b);
+template <typename X, typename S, typename = detail::enable_if_buffer_scalar<detail::buffer_multiply,X,S>>
+detail::buffer_scalar_expression_right<detail::buffer_multiply,X> operator*(X&& a, S const& b);
+template <typename S, typename X, typename = detail::enable_if_buffer_scalar<detail::buffer_multiply,X,S>, typename = void>
+detail::buffer_scalar_expression_left<detail::buffer_multiply,X> operator*(S const& a, X&& b);
+
+template <typename A, typename B, typename = detail::enable_if_buffer_operands<A,B>>
+detail::buffer_binary_expression<detail::buffer_divide,detail::buffer_stored<A>,detail::buffer_stored<B>> operator/(A&& a, B&& b);
+template <typename X, typename S, typename = detail::enable_if_buffer_scalar<detail::buffer_divide,X,S>>
+detail::buffer_scalar_expression_right<detail::buffer_divide,X> operator/(X&& a, S const& b);
+template <typename S, typename X, typename = detail::enable_if_buffer_scalar<detail::buffer_divide,X,S>, typename = void>
+detail::buffer_scalar_expression_left<detail::buffer_divide,X> operator/(S const& a, X&& b);
+
+// Buffer (buffer, buffer2D or buffer3D) evaluating the expression
+template <typename E> typename buffer_evaluation<typename E::dimension_type, typename E::value_type>::type eval(buffer_expression<E> const& e);
+
+template <typename E> std::ostream& operator<<(std::ostream& s, buffer_expression<E> const& e);
+// One overload per kind of expression, to be preferred to the generic to_string(T const&)
+template <typename Op, typename L, typename R> std::string to_string(detail::buffer_binary_expression<Op,L,R> const& e, std::string const& separator=" ");
+template <typename Op, typename X, typename S, bool scalar_left> std::string to_string(detail::buffer_scalar_expression<Op,X,S,scalar_left> const& e, std::string const& separator=" ");
+template <typename X> std::string to_string(detail::buffer_negate_expression<X> const& e, std::string const& separator=" ");
+// Average of an expression of buffer, computed without evaluating it into a buffer
+template <typename E> typename E::value_type average(buffer_expression<E> const& e, execution_policy policy = execution_policy::automatic);
+
+}
+
+
+
+/** ************************************************** **/
+/**           IMPLEMENTATION                           **/
+/** ************************************************** **/
+
+namespace vcl
+{
+
+namespace detail
+{
+
+template <typename Op, typename L, typename R>
+buffer_binary_expression<Op,L,R>::buffer_binary_expression(L l, R r)
+    :left(std::forward<L>(l)), right(std::forward<R>(r))
+{
+    assert_vcl(left_operand::dimension(left)==right_operand::dimension(right), "Dimension do not agree");
+}
+
+}
+
+template <typename A, typename B, typename>
+detail::buffer_binary_expression<detail::buffer_add,detail::buffer_stored<A>,detail::buffer_stored<B>> operator+(A&& a, B&& b)
+{
+    return {std::forward<A>(a), std::forward<B>(b)};
+}
+template <typename X, typename S, typename>
+detail::buffer_scalar_expression_right<detail::buffer_add,X> operator+(X&& a, S const& b)
+{
+    return detail::buffer_scalar_expression_right<detail::buffer_add,X>(std::forward<X>(a), b);
+}
+template <typename S, typename X, typename, typename>
+detail::buffer_scalar_expression_left<detail::buffer_add,X> operator+(S const& a, X&& b)
+{
+    return detail::buffer_scalar_expression_left<detail::buffer_add,X>(std::forward<X>(b), a);
+}
+
+template <typename X, typename>
+detail::buffer_negate_expression<detail::buffer_stored<X>> operator-(X&& a)
+{
+    return detail::buffer_negate_expression<detail::buffer_stored<X>>(std::forward<X>(a));
+}
+template <typename A, typename B, typename>
+detail::buffer_binary_expression<detail::buffer_subtract,detail::buffer_stored<A>,detail::buffer_stored<B>> operator-(A&& a, B&& b)
+{
+    return {std::forward<A>(a), std::forward<B>(b)};
+}
+template <typename X, typename S, typename>
+detail::buffer_scalar_expression_right<detail::buffer_subtract,X> operator-(X&& a, S const& b)
+{
+    return detail::buffer_scalar_expression_right<detail::buffer_subtract,X>(std::forward<X>(a), b);
+}
+template <typename S, typename X, typename, typename>
+detail::buffer_scalar_expression_left<detail::buffer_subtract,X> operator-(S const& a, X&& b)
+{
+    return detail::buffer_scalar_expression_left<detail::buffer_subtract,X>(std::forward<X>(b), a);
+}
+
+template <typename A, typename B, typename>
+detail::buffer_binary_expression<detail::buffer_multiply,detail::buffer_stored<A>,detail::buffer_stored<B>> operator*(A&& a, B&& b)
+{
+    return {std::forward<A>(a), std::forward<B>(b)};
+}
+template <typename X, typename S, typename>
+detail::buffer_scalar_expression_right<detail::buffer_multiply,X> operator*(X&& a, S const& b)
+{
+    return detail::buffer_scalar_expression_right<detail::buffer_multiply,X>(std::forward<X>(a), b);
+}
+template <typename S, typename X, typename, typename>
+detail::buffer_scalar_expression_left<detail::buffer_multiply,X> operator*(S const& a, X&& b)
+{
+    return detail::buffer_scalar_expression_left<detail::buffer_multiply,X>(std::forward<X>(b), a);
+}
+
+template <typename A, typename B, typename>
+detail::buffer_binary_expression<detail::buffer_divide,detail::buffer_stored<A>,detail::buffer_stored<B>> operator/(A&& a, B&& b)
+{
+    return {std::forward<A>(a), std::forward<B>(b)};
+}
+template <typename X, typename S, typename>
+detail::buffer_scalar_expression_right<detail::buffer_divide,X> operator/(X&& a, S const& b)
+{
+    return detail::buffer_scalar_expression_right<detail::buffer_divide,X>(std::forward<X>(a), b);
+}
+template <typename S, typename X, typename, typename>
+detail::buffer_scalar_expression_left<detail::buffer_divide,X> operator/(S const& a, X&& b)
+{
+    return detail::buffer_scalar_expression_left<detail::buffer_divide,X>(std::forward<X>(b), a);
+}
+
+template <typename E> typename buffer_evaluation<typename E::dimension_type, typename E::value_type>::type eval(buffer_expression<E> const& e)
+{
+    return typename buffer_evaluation<typename E::dimension_type, typename E::value_type>::type(e);
+}
+
+template <typename E> std::ostream& operator<<(std::ostream& s, buffer_expression<E> const& e)
+{
+    s << eval(e);
+    return s;
+}
+template <typename Op, typename L, typename R> std::string to_string(detail::buffer_binary_expression<Op,L,R> const& e, std::string const& separator)
+{
+    return to_string(eval(e), separator);
+}
+template <typename Op, typename X, typename S, bool scalar_left> std::string to_string(detail::buffer_scalar_expression<Op,X,S,scalar_left> const& e, std::string const& separator)
+{
+    return to_string(eval(e), separator);
+}
+template <typename X> std::string to_string(detail::buffer_negate_expression<X> const& e, std::string const& separator)
+{
+    return to_string(eval(e), separator);
+}
+
+template <typename E> typename E::value_type average(buffer_expression<E> const& e, execution_policy policy)
+{
+    static_assert(std::is_same<typename E::dimension_type, size_t>::value, "Average of an expression of buffer2D/buffer3D");
+    using T = typename E::value_type;
+
+    E const& x = e.derived();
+    size_t const N = x.size();
+    assert_vcl_no_msg(N>0);
+
+    T value = parallel_reduce(N, x[0], [&](size_t begin, size_t end){
+        T block_sum = x[begin];
+        for(size_t k=begin+1; k<end; ++k)
+            block_sum += x[k];
+        return block_sum;
+    }, [](T const& s1, T const& s2){ return s1+s2; }, policy);
+    value /= float(N);
+
+    return value;
+}
+
+}
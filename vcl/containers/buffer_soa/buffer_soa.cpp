@@ -0,0 +1,315 @@
+#include "buffer_soa.hpp"
+
+#include "vcl/math/vec/vec.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VCL_SOA_SSE2
+#endif
+
+namespace vcl
+{
+namespace detail
+{
+
+// Minimal SIMD abstraction: the kernels below are written once for a register of simd_width floats
+#if defined(__AVX2__)
+typedef __m256 simd_float;
+static const size_t simd_width = 8;
+static inline simd_float simd_load(float const* p) { return _mm256_loadu_ps(p); }
+static inline void simd_store(float* p, simd_float a) { _mm256_storeu_ps(p, a); }
+static inline simd_float simd_set(float a) { return _mm256_set1_ps(a); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+static inline simd_float simd_div(simd_float a, simd_float b) { return _mm256_div_ps(a, b); }
+static inline simd_float simd_sqrt(simd_float a) { return _mm256_sqrt_ps(a); }
+static inline simd_float simd_min(simd_float a, simd_float b) { return _mm256_min_ps(a, b); }
+static inline simd_float simd_max(simd_float a, simd_float b) { return _mm256_max_ps(a, b); }
+// a where a!=0, b elsewhere
+static inline simd_float simd_select_nonzero(simd_float mask, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(mask, _mm256_setzero_ps(), _CMP_NEQ_OQ)); }
+#elif defined(VCL_SOA_SSE2)
+typedef __m128 simd_float;
+static const size_t simd_width = 4;
+static inline simd_float simd_load(float const* p) { return _mm_loadu_ps(p); }
+static inline void simd_store(float* p, simd_float a) { _mm_storeu_ps(p, a); }
+static inline simd_float simd_set(float a) { return _mm_set1_ps(a); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+static inline simd_float simd_div(simd_float a, simd_float b) { return _mm_div_ps(a, b); }
+static inline simd_float simd_sqrt(simd_float a) { return _mm_sqrt_ps(a); }
+static inline simd_float simd_min(simd_float a, simd_float b) { return _mm_min_ps(a, b); }
+static inline simd_float simd_max(simd_float a, simd_float b) { return _mm_max_ps(a, b); }
+static inline simd_float simd_select_nonzero(simd_float mask, simd_float a, simd_float b)
+{
+    const simd_float m = _mm_cmpneq_ps(mask, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+#else
+typedef float simd_float;
+static const size_t simd_width = 1;
+static inline simd_float simd_load(float const* p) { return *p; }
+static inline void simd_store(float* p, simd_float a) { *p = a; }
+static inline simd_float simd_set(float a) { return a; }
+static inline simd_float simd_add(simd_float a, simd_float b) { return a + b; }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return a - b; }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return a * b; }
+static inline simd_float simd_div(simd_float a, simd_float b) { return a / b; }
+static inline simd_float simd_sqrt(simd_float a) { return std::sqrt(a); }
+static inline simd_float simd_min(simd_float a, simd_float b) { return std::min(a, b); }
+static inline simd_float simd_max(simd_float a, simd_float b) { return std::max(a, b); }
+static inline simd_float simd_select_nonzero(simd_float mask, simd_float a, simd_float b) { return mask != 0.0f ? a : b; }
+#endif
+
+// The sums are accumulated in reduction_lanes partial sums whatever simd_width is, and the lanes are added in a fixed
+// order: the result does not depend on the instruction set
+static const size_t reduction_lanes = 8;
+static_assert(reduction_lanes % simd_width == 0, "Lanes of the reductions");
+
+
+void soa_add(float const* a, float const* b, float* out, size_t n)
+{
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+        simd_store(out+k, simd_add(simd_load(a+k), simd_load(b+k)));
+    for(; k<n; ++k)
+        out[k] = a[k] + b[k];
+}
+
+void soa_subtract(float const* a, float const* b, float* out, size_t n)
+{
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+        simd_store(out+k, simd_sub(simd_load(a+k), simd_load(b+k)));
+    for(; k<n; ++k)
+        out[k] = a[k] - b[k];
+}
+
+void soa_scale(float const* a, float s, float* out, size_t n)
+{
+    const simd_float s_simd = simd_set(s);
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+        simd_store(out+k, simd_mul(simd_load(a+k), s_simd));
+    for(; k<n; ++k)
+        out[k] = a[k] * s;
+}
+
+void soa_dot(float const* const* a, float const* const* b, size_t nb_components, float* out, size_t n)
+{
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+    {
+        simd_float d = simd_mul(simd_load(a[0]+k), simd_load(b[0]+k));
+        for(size_t c=1; c<nb_components; ++c)
+            d = simd_add(d, simd_mul(simd_load(a[c]+k), simd_load(b[c]+k)));
+        simd_store(out+k, d);
+    }
+    for(; k<n; ++k)
+    {
+        float d = a[0][k] * b[0][k];
+        for(size_t c=1; c<nb_components; ++c)
+            d += a[c][k] * b[c][k];
+        out[k] = d;
+    }
+}
+
+void soa_sqrt(float* a, size_t n)
+{
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+        simd_store(a+k, simd_sqrt(simd_load(a+k)));
+    for(; k<n; ++k)
+        a[k] = std::sqrt(a[k]);
+}
+
+void soa_cross(float const* const* a, float const* const* b, float* const* out, size_t n)
+{
+    // All the components are loaded before the first store: out may be a or b
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+    {
+        const simd_float ax = simd_load(a[0]+k), ay = simd_load(a[1]+k), az = simd_load(a[2]+k);
+        const simd_float bx = simd_load(b[0]+k), by = simd_load(b[1]+k), bz = simd_load(b[2]+k);
+        simd_store(out[0]+k, simd_sub(simd_mul(ay, bz), simd_mul(az, by)));
+        simd_store(out[1]+k, simd_sub(simd_mul(az, bx), simd_mul(ax, bz)));
+        simd_store(out[2]+k, simd_sub(simd_mul(ax, by), simd_mul(ay, bx)));
+    }
+    for(; k<n; ++k)
+    {
+        const float ax = a[0][k], ay = a[1][k], az = a[2][k];
+        const float bx = b[0][k], by = b[1][k], bz = b[2][k];
+        out[0][k] = ay*bz - az*by;
+        out[1][k] = az*bx - ax*bz;
+        out[2][k] = ax*by - ay*bx;
+    }
+}
+
+void soa_normalize(float* const* a, size_t nb_components, size_t n)
+{
+    const simd_float zero = simd_set(0.0f), one = simd_set(1.0f);
+    size_t k = 0;
+    for(; k+simd_width<=n; k+=simd_width)
+    {
+        simd_float d = simd_mul(simd_load(a[0]+k), simd_load(a[0]+k));
+        for(size_t c=1; c<nb_components; ++c)
+            d = simd_add(d, simd_mul(simd_load(a[c]+k), simd_load(a[c]+k)));
+        const simd_float length = simd_sqrt(d);
+        for(size_t c=0; c<nb_components; ++c)
+            simd_store(a[c]+k, simd_select_nonzero(length, simd_div(simd_load(a[c]+k), length), c==0 ? one : zero));
+    }
+    for(; k<n; ++k)
+    {
+        float d = a[0][k] * a[0][k];
+        for(size_t c=1; c<nb_components; ++c)
+            d += a[c][k] * a[c][k];
+        const float length = std::sqrt(d);
+        for(size_t c=0; c<nb_components; ++c)
+            a[c][k] = length != 0.0f ? a[c][k] / length : (c==0 ? 1.0f : 0.0f);
+    }
+}
+
+float soa_sum(float const* a, size_t n)
+{
+    simd_float lanes[reduction_lanes/simd_width];
+    for(size_t j=0; j<reduction_lanes/simd_width; ++j)
+        lanes[j] = simd_set(0.0f);
+
+    size_t k = 0;
+    for(; k+reduction_lanes<=n; k+=reduction_lanes)
+        for(size_t j=0; j<reduction_lanes/simd_width; ++j)
+            lanes[j] = simd_add(lanes[j], simd_load(a+k+j*simd_width));
+
+    float partial[reduction_lanes];
+    for(size_t j=0; j<reduction_lanes/simd_width; ++j)
+        simd_store(partial+j*simd_width, lanes[j]);
+    float s = ((partial[0]+partial[1]) + (partial[2]+partial[3])) + ((partial[4]+partial[5]) + (partial[6]+partial[7]));
+    for(; k<n; ++k)
+        s += a[k];
+    return s;
+}
+
+void soa_min_max(float const* a, size_t n, float& a_min, float& a_max)
+{
+    size_t k = 0;
+    float result_min = n>0 ? a[0] : 0.0f;
+    float result_max = result_min;
+    if(n>=simd_width)
+    {
+        simd_float v_min = simd_load(a), v_max = v_min;
+        for(k=simd_width; k+simd_width<=n; k+=simd_width)
+        {
+            const simd_float v = simd_load(a+k);
+            v_min = simd_min(v_min, v);
+            v_max = simd_max(v_max, v);
+        }
+        float partial_min[simd_width], partial_max[simd_width];
+        simd_store(partial_min, v_min);
+        simd_store(partial_max, v_max);
+        for(size_t j=0; j<simd_width; ++j)
+        {
+            result_min = std::min(result_min, partial_min[j]);
+            result_max = std::max(result_max, partial_max[j]);
+        }
+    }
+    for(; k<n; ++k)
+    {
+        result_min = std::min(result_min, a[k]);
+        result_max = std::max(result_max, a[k]);
+    }
+    a_min = result_min;
+    a_max = result_max;
+}
+
+void soa_from_aos(float const* aos, size_t nb_components, float* const* soa, size_t n)
+{
+    size_t k = 0;
+#if defined(__AVX2__) || defined(VCL_SOA_SSE2)
+    // Transposition of 4 elements at a time
+    if(nb_components==3)
+    {
+        for(; k+4<=n; k+=4)
+        {
+            // m0 = x0 y0 z0 x1, m1 = y1 z1 x2 y2, m2 = z2 x3 y3 z3
+            const __m128 m0 = _mm_loadu_ps(aos+3*k), m1 = _mm_loadu_ps(aos+3*k+4), m2 = _mm_loadu_ps(aos+3*k+8);
+            const __m128 t_x = _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(1,1,2,2));
+            const __m128 t_y0 = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(0,0,1,1));
+            const __m128 t_y1 = _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(2,2,3,3));
+            const __m128 t_z = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(1,1,2,2));
+            _mm_storeu_ps(soa[0]+k, _mm_shuffle_ps(m0, t_x, _MM_SHUFFLE(2,0,3,0)));
+            _mm_storeu_ps(soa[1]+k, _mm_shuffle_ps(t_y0, t_y1, _MM_SHUFFLE(2,0,2,0)));
+            _mm_storeu_ps(soa[2]+k, _mm_shuffle_ps(t_z, m2, _MM_SHUFFLE(3,0,2,0)));
+        }
+    }
+    else if(nb_components==4)
+    {
+        for(; k+4<=n; k+=4)
+        {
+            __m128 r0 = _mm_loadu_ps(aos+4*k), r1 = _mm_loadu_ps(aos+4*k+4), r2 = _mm_loadu_ps(aos+4*k+8), r3 = _mm_loadu_ps(aos+4*k+12);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(soa[0]+k, r0);
+            _mm_storeu_ps(soa[1]+k, r1);
+            _mm_storeu_ps(soa[2]+k, r2);
+            _mm_storeu_ps(soa[3]+k, r3);
+        }
+    }
+#endif
+    for(; k<n; ++k)
+        for(size_t c=0; c<nb_components; ++c)
+            soa[c][k] = aos[nb_components*k+c];
+}
+
+void soa_to_aos(float const* const* soa, size_t nb_components, float* aos, size_t n)
+{
+    size_t k = 0;
+#if defined(__AVX2__) || defined(VCL_SOA_SSE2)
+    if(nb_components==3)
+    {
+        for(; k+4<=n; k+=4)
+        {
+            const __m128 x = _mm_loadu_ps(soa[0]+k), y = _mm_loadu_ps(soa[1]+k), z = _mm_loadu_ps(soa[2]+k);
+            const __m128 xy0 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(0,0,0,0)), zx0 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1,1,0,0));
+            const __m128 yz1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1,1,1,1)), xy1 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2,2,2,2));
+            const __m128 zx2 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3,3,2,2)), yz2 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3,3,3,3));
+            _mm_storeu_ps(aos+3*k, _mm_shuffle_ps(xy0, zx0, _MM_SHUFFLE(2,0,2,0)));
+            _mm_storeu_ps(aos+3*k+4, _mm_shuffle_ps(yz1, xy1, _MM_SHUFFLE(2,0,2,0)));
+            _mm_storeu_ps(aos+3*k+8, _mm_shuffle_ps(zx2, yz2, _MM_SHUFFLE(2,0,2,0)));
+        }
+    }
+    else if(nb_components==4)
+    {
+        for(; k+4<=n; k+=4)
+        {
+            __m128 r0 = _mm_loadu_ps(soa[0]+k), r1 = _mm_loadu_ps(soa[1]+k), r2 = _mm_loadu_ps(soa[2]+k), r3 = _mm_loadu_ps(soa[3]+k);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(aos+4*k, r0);
+            _mm_storeu_ps(aos+4*k+4, r1);
+            _mm_storeu_ps(aos+4*k+8, r2);
+            _mm_storeu_ps(aos+4*k+12, r3);
+        }
+    }
+#endif
+    for(; k<n; ++k)
+        for(size_t c=0; c<nb_components; ++c)
+            aos[nb_components*k+c] = soa[c][k];
+}
+
+}
+
+void cross(buffer_soa<vec3> const& a, buffer_soa<vec3> const& b, buffer_soa<vec3>& out)
+{
+    assert_vcl(a.size()==b.size(), "Size do not agree");
+    out.resize(a.size());
+    float const* pa[3] = {a.component[0].data(), a.component[1].data(), a.component[2].data()};
+    float const* pb[3] = {b.component[0].data(), b.component[1].data(), b.component[2].data()};
+    float* po[3] = {out.component[0].data(), out.component[1].data(), out.component[2].data()};
+    detail::soa_cross(pa, pb, po, a.size());
+}
+
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "vcl/base/base.hpp"
+#include "vcl/containers/buffer/buffer.hpp"
+#include "vcl/containers/buffer_stack/buffer_stack.hpp"
+
+#include <vector>
+
+/** ************************************************** **/
+/**           Header                                   **/
+/** ************************************************** **/
+
+namespace vcl
+{
+
+/** Structure of arrays storage of vec2/vec3/vec4 elements: the components x, y, z (, w) of all the elements are
+ * stored in separate 32 bytes aligned arrays, so that the bulk operations below process 8 (AVX2) or 4 (SSE2) elements
+ * per instruction. buffer<vec3> (array of structures) remains the layout uploaded to the GPU, to_buffer/from_buffer
+ * convert between both in a single pass.
+ * The kernels are selected at compile time: AVX2 with the cmake option VCL_AVX2, SSE2 on x86-64, scalar otherwise.
+ * The reductions give the same result with all of them. */
+template <typename T> struct buffer_soa;
+
+template <size_t N>
+struct buffer_soa<buffer_stack<float,N>>
+{
+    using value_type = buffer_stack<float,N>;
+    using component_type = std::vector<float, aligned_allocator<float>>;
+
+    // component[0] holds the x coordinates, component[1] the y coordinates, ...
+    component_type component[N];
+
+    buffer_soa();
+    buffer_soa(size_t size);
+    buffer_soa(buffer<value_type> const& arg);
+
+    size_t size() const;
+    void resize(size_t size);
+    void clear();
+    void fill(value_type const& value);
+
+    value_type get(size_t index) const;
+    void set(size_t index, value_type const& value);
+
+    void from_buffer(buffer<value_type> const& arg);
+    void to_buffer(buffer<value_type>& arg) const;
+    buffer<value_type> to_buffer() const;
+};
+
+// Element-wise operations: out may be one of the arguments
+template <size_t N> void add(buffer_soa<buffer_stack<float,N>> const& a, buffer_soa<buffer_stack<float,N>> const& b, buffer_soa<buffer_stack<float,N>>& out);
+template <size_t N> void subtract(buffer_soa<buffer_stack<float,N>> const& a, buffer_soa<buffer_stack<float,N>> const& b, buffer_soa<buffer_stack<float,N>>& out);
+template <size_t N> void scale(buffer_soa<buffer_stack<float,N>> const& a, float s, buffer_soa<buffer_stack<float,N>>& out);
+void cross(buffer_soa<buffer_stack<float,3>> const& a, buffer_soa<buffer_stack<float,3>> const& b, buffer_soa<buffer_stack<float,3>>& out);
+// Zero vectors are normalized to (1,0,0), as vcl::normalize
+template <size_t N> void normalize(buffer_soa<buffer_stack<float,N>>& a);
+
+template <size_t N> void dot(buffer_soa<buffer_stack<float,N>> const& a, buffer_soa<buffer_stack<float,N>> const& b, buffer<float>& out);
+template <size_t N> void norm(buffer_soa<buffer_stack<float,N>> const& a, buffer<float>& out);
+
+// Reductions
+template <size_t N> buffer_stack<float,N> sum(buffer_soa<buffer_stack<float,N>> const& a);
+template <size_t N> buffer_stack<float,N> average(buffer_soa<buffer_stack<float,N>> const& a);
+template <size_t N> void bounding_box(buffer_soa<buffer_stack<float,N>> const& a, buffer_stack<float,N>& p_min, buffer_stack<float,N>& p_max);
+
+
+namespace detail
+{
+// Kernels on arrays of n floats (buffer_soa.cpp)
+void soa_add(float const* a, float const* b, float* out, size_t n);
+void soa_subtract(float const* a, float const* b, float* out, size_t n);
+void soa_scale(float const* a, float s, float* out, size_t n);
+void soa_dot(float const* const* a, float const* const* b, size_t nb_components, float* out, size_t n);
+void soa_sqrt(float* a, size_t n);
+void soa_cross(float const* const* a, float const* const* b, float* const* out, size_t n);
+void soa_normalize(float* const* a, size_t nb_components, size_t n);
+float soa_sum(float const* a, size_t n);
+void soa_min_max(float const* a, size_t n, float& a_min, float& a_max);
+void soa_from_aos(float const* aos, size_t nb_components, float* const* soa, size_t n);
+void soa_to_aos(float const* const* soa, size_t nb_components, float* aos, size_t n);
+}
+
+}
+
+
+
+/** ************************************************** **/
+/**           IMPLEMENTATION                           **/
+/** ************************************************** **/
+
+namespace vcl
+{
+
+template <size_t N>
+buffer_soa<buffer_stack<float,N>>::buffer_soa()
+{
+    static_assert(sizeof(value_type)==N*sizeof(float), "Components of the elements must be contiguous");
+}
+
+template <size_t N>
+buffer_soa<buffer_stack<float,N>>::buffer_soa(size_t size)
+{
+    resize(size);
+}
+
+template <size_t N>
+buffer_soa<buffer_stack<float,N>>::buffer_soa(buffer<value_type> const& arg)
+{
+    from_buffer(arg);
+}
+
+template <size_t N>
+size_t buffer_soa<buffer_stack<float,N>>::size() const
+{
+    return component[0].size();
+}
+
+template <size_t N>
+void buffer_soa<buffer_stack<float,N>>::resize(size_t size)
+{
+    for(size_t c=0; c<N; ++c)
+        component[c].resize(size);
+}
+
+template <size_t N>
+void buffer_soa<buffer_stack<float,N>>::clear()
+{
+    for(size_t c=0; c<N; ++c)
+        component[c].clear();
+}
+
+template <size_t N>
+void buffer_soa<buffer_stack<float,N>>::fill(value_type const& value)
+{
+    for(size_t c=0; c<N; ++c)
+        std::fill(component[c].begin(), component[c].end(), value[c]);
+}
+
+template <size_t N>
+buffer_stack<float,N> buffer_soa<buffer_stack<float,N>>::get(size_t index) const
+{
+    assert_vcl(index<size(), "index="+str(index));
+    value_type value;
+    for(size_t c=0; c<N; ++c)
+        value[c] = component[c][index];
+    return value;
+}
+
+template <size_t N>
+void buffer_soa<buffer_stack<float,N>>::set(size_t index, value_type const& value)
+{
+    assert_vcl(index<size(), "index="+str(index));
+    for(size_t c=0; c<N; ++c)
+        component[c][index] = value[c];
+}
+
+template <size_t N>
+void buffer_soa<buffer_stack<float,N>>::from_buffer(buffer<value_type> const& arg)
+{
+    resize(arg.size());
+    if(arg.size()==0)
+        return;
+    float* soa[N];
+    for(size_t c=0; c<N; ++c)
+        soa[c] = component[c].data();
+    detail::soa_from_aos(&arg.data[0][0], N, soa, arg.size());
+}
+
+template <size_t N>
+void buffer_soa<buffer_stack<float,N>>::to_buffer(buffer<value_type>& arg) const
+{
+    arg.resize(size());
+    if(size()==0)
+        return;
+    float const* soa[N];
+    for(size_t c=0; c<N; ++c)
+        soa[c] = component[c].data();
+    detail::soa_to_aos(soa, N, &arg.data[0][0], size());
+}
+
+template <size_t N>
+buffer<buffer_stack<float,N>> buffer_soa<buffer_stack<float,N>>::to_buffer() const
+{
+    buffer<value_type> arg;
+    to_buffer(arg);
+    return arg;
+}
+
+
+template <size_t N> void add(buffer_soa<buffer_stack<float,N>> const& a, buffer_soa<buffer_stack<float,N>> const& b, buffer_soa<buffer_stack<float,N>>& out)
+{
+    assert_vcl(a.size()==b.size(), "Size do not agree");
+    out.resize(a.size());
+    for(size_t c=0; c<N; ++c)
+        detail::soa_add(a.component[c].data(), b.component[c].data(), out.component[c].data(), a.size());
+}
+
+template <size_t N> void subtract(buffer_soa<buffer_stack<float,N>> const& a, buffer_soa<buffer_stack<float,N>> const& b, buffer_soa<buffer_stack<float,N>>& out)
+{
+    assert_vcl(a.size()==b.size(), "Size do not agree");
+    out.resize(a.size());
+    for(size_t c=0; c<N; ++c)
+        detail::soa_subtract(a.component[c].data(), b.component[c].data(), out.component[c].data(), a.size());
+}
+
+template <size_t N> void scale(buffer_soa<buffer_stack<float,N>> const& a, float s, buffer_soa<buffer_stack<float,N>>& out)
+{
+    out.resize(a.size());
+    for(size_t c=0; c<N; ++c)
+        detail::soa_scale(a.component[c].data(), s, out.component[c].data(), a.size());
+}
+
+template <size_t N> void normalize(buffer_soa<buffer_stack<float,N>>& a)
+{
+    float* p[N];
+    for(size_t c=0; c<N; ++c)
+        p[c] = a.component[c].data();
+    detail::soa_normalize(p, N, a.size());
+}
+
+template <size_t N> void dot(buffer_soa<buffer_stack<float,N>> const& a, buffer_soa<buffer_stack<float,N>> const& b, buffer<float>& out)
+{
+    assert_vcl(a.size()==b.size(), "Size do not agree");
+    out.resize(a.size());
+    if(a.size()==0)
+        return;
+    float const* pa[N];
+    float const* pb[N];
+    for(size_t c=0; c<N; ++c) {
+        pa[c] = a.component[c].data();
+        pb[c] = b.component[c].data();
+    }
+    detail::soa_dot(pa, pb, N, &out.data[0], a.size());
+}
+
+template <size_t N> void norm(buffer_soa<buffer_stack<float,N>> const& a, buffer<float>& out)
+{
+    dot(a, a, out);
+    if(out.size()>0)
+        detail::soa_sqrt(&out.data[0], out.size());
+}
+
+template <size_t N> buffer_stack<float,N> sum(buffer_soa<buffer_stack<float,N>> const& a)
+{
+    buffer_stack<float,N> s;
+    for(size_t c=0; c<N; ++c)
+        s[c] = detail::soa_sum(a.component[c].data(), a.size());
+    return s;
+}
+
+template <size_t N> buffer_stack<float,N> average(buffer_soa<buffer_stack<float,N>> const& a)
+{
+    assert_vcl_no_msg(a.size()>0);
+    buffer_stack<float,N> s = sum(a);
+    for(size_t c=0; c<N; ++c)
+        s[c] /= float(a.size());
+    return s;
+}
+
+template <size_t N> void bounding_box(buffer_soa<buffer_stack<float,N>> const& a, buffer_stack<float,N>& p_min, buffer_stack<float,N>& p_max)
+{
+    assert_vcl_no_msg(a.size()>0);
+    for(size_t c=0; c<N; ++c)
+        detail::soa_min_max(a.component[c].data(), a.size(), p_min[c], p_max[c]);
+}
+
+}
@@ -2,3 +2,4 @@
 
 #include "buffer/buffer.hpp"
 #include "buffer_stack/buffer_stack.hpp"
+#include "buffer_soa/buffer_soa.hpp"
@@ -2,6 +2,8 @@
 
 #include "../../math/transformation/transformation.hpp"
 
+#include <algorithm>
+
 namespace vcl
 {
 
@@ -15,6 +17,12 @@ perspective_structure::perspective_structure(float angle_of_view_arg, float imag
 
 mat4 perspective_structure::matrix() const
 {
+    const float parameters[4] = {angle_of_view, image_aspect, z_near, z_far};
+    if( matrix_valid && std::equal(parameters, parameters+4, cached_parameters) )
+        return cached_matrix;
+    std::copy(parameters, parameters+4, cached_parameters);
+    matrix_valid = true;
+
     const float fy = 1/std::tan(angle_of_view/2);
     const float fx = fy/image_aspect;
     const float L = z_near-z_far;
@@ -22,12 +30,13 @@ mat4 perspective_structure::matrix() const
     const float C = (z_far+z_near)/L;
     const float D = (2*z_far*z_near)/L;
 
-    return {
+    cached_matrix = {
         fx,0,0,0,
                 0,fy,0,0,
                 0,0,C,D,
                 0,0,-1,0
     };
+    return cached_matrix;
 }
 
 mat4 perspective_structure::matrix_inverse() const
@@ -49,16 +58,37 @@ mat4 perspective_structure::matrix_inverse() const
 
 
 
-mat4 camera_scene::view_matrix() const
+static bool same_values(const float* a, const float* b, size_t N)
 {
+    return std::equal(a, a+N, b);
+}
+
+void camera_scene::update_cache() const
+{
+    if( cache_valid && scale==cached_scale
+        && same_values(&translation[0], &cached_translation[0], 3)
+        && same_values(&orientation[0], &cached_orientation[0], 9) )
+        return;
+
+    cached_scale = scale;
+    cached_translation = translation;
+    cached_orientation = orientation;
+    cache_valid = true;
+
     mat3 R = transpose(orientation);
     vec3 T = vec3{0,0,-scale} + R*translation;
 
-    return    { R(0,0), R(0,1), R(0,2), T.x,
-                R(1,0), R(1,1), R(1,2), T.y,
-                R(2,0), R(2,1), R(2,2), T.z,
-                0  ,    0  ,   0   ,  1 };
+    cached_view = { R(0,0), R(0,1), R(0,2), T.x,
+                    R(1,0), R(1,1), R(1,2), T.y,
+                    R(2,0), R(2,1), R(2,2), T.z,
+                    0  ,    0  ,   0   ,  1 };
+    cached_position = orientation*vec3{0,0,scale} - translation;
+}
 
+mat4 camera_scene::view_matrix() const
+{
+    update_cache();
+    return cached_view;
 }
 
 mat4 camera_scene::camera_matrix() const
@@ -165,7 +195,8 @@ void camera_scene::apply_scaling(float s)
 
 vec3 camera_scene::camera_position() const
 {
-    return orientation*vec3{0,0,scale} - translation;;
+    update_cache();
+    return cached_position;
 }
 
 }
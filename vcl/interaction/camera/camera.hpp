@@ -17,8 +17,14 @@ struct perspective_structure
     perspective_structure();
     perspective_structure(float angle_of_view, float image_aspect, float z_near, float z_far);
 
+    /** The matrix is cached, and only recomputed when one of the parameters above has changed */
     mat4 matrix() const;
     mat4 matrix_inverse() const;
+
+private:
+    mutable bool matrix_valid = false;
+    mutable float cached_parameters[4];
+    mutable mat4 cached_matrix;
 };
 
 enum camera_control_type {camera_control_trackball, camera_control_spherical_coordinates};
@@ -38,7 +44,8 @@ struct camera_scene
     mat3 orientation = {};
     perspective_structure perspective = {};
 
-    /** Compute the view matrix to be multiplied to vertices */
+    /** Compute the view matrix to be multiplied to vertices
+     * The view matrix and camera position are cached, and only recomputed when scale, translation or orientation have changed */
     mat4 view_matrix() const;
     mat4 camera_matrix() const;
     /** Return the corresponding center of camera */
@@ -52,6 +59,15 @@ struct camera_scene
     void apply_translation_orthogonal_to_screen_plane(float tr);
     void apply_rotation(float p0x, float p0y, float p1x, float p1y);
     void apply_scaling(float s);
+
+private:
+    void update_cache() const;
+    mutable bool cache_valid = false;
+    mutable float cached_scale;
+    mutable vec3 cached_translation;
+    mutable mat3 cached_orientation;
+    mutable mat4 cached_view;
+    mutable vec3 cached_position;
 };
 
 
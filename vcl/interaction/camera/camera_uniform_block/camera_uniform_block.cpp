@@ -0,0 +1,44 @@
+#include "camera_uniform_block.hpp"
+
+#include "vcl/opengl/opengl.hpp"
+
+#include <algorithm>
+
+namespace vcl
+{
+
+// std140 layout of camera_data: two mat4 and a vec3 padded to a vec4
+static const size_t camera_block_size = 16 + 16 + 4;
+
+void publish_camera(const camera_scene& camera)
+{
+    static GLuint ubo = 0;
+    static float published[camera_block_size];
+
+    float data[camera_block_size];
+    const mat4 perspective = camera.perspective.matrix();
+    const mat4 view = camera.view_matrix();
+    const vec3 position = camera.camera_position();
+    std::copy(&perspective[0], &perspective[0]+16, data);
+    std::copy(&view[0], &view[0]+16, data+16);
+    data[32] = position.x; data[33] = position.y; data[34] = position.z; data[35] = 0.0f;
+
+    if(ubo==0) {
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(sizeof(data)), data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, camera_uniform_binding, ubo);
+    }
+    else if(std::equal(data, data+camera_block_size, published)) {
+        return;
+    }
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, GLsizeiptr(sizeof(data)), data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    std::copy(data, data+camera_block_size, published);
+}
+
+}
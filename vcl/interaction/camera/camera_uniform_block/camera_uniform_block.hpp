@@ -0,0 +1,16 @@
+#pragma once
+
+#include "vcl/interaction/camera/camera.hpp"
+
+namespace vcl
+{
+
+/** Upload the camera to the uniform buffer bound at camera_uniform_binding, read by the shaders as
+ *
+ *   layout(std140, row_major) uniform camera_data { mat4 perspective; mat4 view; vec3 camera_position; };
+ *
+ * The buffer is only updated when the camera differs from the last published one: calling it before each
+ * draw costs a comparison, and the data is sent once per frame in practice. */
+void publish_camera(const camera_scene& camera);
+
+}
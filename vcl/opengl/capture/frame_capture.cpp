@@ -0,0 +1,151 @@
+#include "frame_capture.hpp"
+
+#include "vcl/wrapper/lodepng/lodepng.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+
+namespace vcl
+{
+
+frame_capture::~frame_capture()
+{
+    // The frames still in the ring need the OpenGL context: finish() must be called before it is destroyed
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_added.notify_all();
+    for (std::thread& t : encoders)
+        t.join();
+}
+
+void frame_capture::allocate(int width, int height)
+{
+    ring.resize(std::max(ring_size, size_t(2)));
+    for (slot& s : ring)
+    {
+        glGenBuffers(1, &s.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(4*size_t(width)*size_t(height)), nullptr, GL_STREAM_READ);
+        s.filled = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ring_width = width;
+    ring_height = height;
+    next_slot = 0;
+
+    if (encoders.empty()) {
+        const size_t nb_threads = nb_encoders > 0 ? nb_encoders : size_t(std::max(1, int(std::thread::hardware_concurrency()) - 1));
+        stopping = false;
+        for (size_t k = 0; k < nb_threads; ++k)
+            encoders.push_back(std::thread(&frame_capture::encoder_loop, this));
+    }
+}
+
+void frame_capture::capture(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    if (ring.empty() || width != ring_width || height != ring_height) {
+        finish();
+        allocate(width, height);
+    }
+
+    // Oldest buffer of the ring, filled ring_size-1 frames ago
+    slot& s = ring[next_slot];
+    if (s.filled)
+        read_slot(s);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s.filled = true;
+    s.index = next_index++;
+    next_slot = (next_slot + 1) % ring.size();
+}
+
+void frame_capture::read_slot(slot& s)
+{
+    job j;
+    char number[16];
+    std::snprintf(number, sizeof(number), "%04d", int(s.index));
+    j.format = format;
+    j.filename = prefix + number + image_encoding_extension(format);
+    j.width = ring_width;
+    j.height = ring_height;
+
+    const size_t row = 4*size_t(ring_width);
+    const size_t size = row*size_t(ring_height);
+    j.pixels.resize(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+    const unsigned char* data = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(size), GL_MAP_READ_BIT));
+    if (data != nullptr) {
+        // OpenGL rows start from the bottom
+        for (size_t y = 0; y < size_t(ring_height); ++y)
+            std::copy(data + row*(size_t(ring_height)-1-y), data + row*(size_t(ring_height)-y), j.pixels.begin() + row*y);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s.filled = false;
+    if (data == nullptr) {
+        std::cerr << "Cannot map the captured frame " << s.index << std::endl;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job_removed.wait(lock, [this]{ return jobs.size() < std::max(max_pending, size_t(1)); });
+    jobs.push_back(std::move(j));
+    lock.unlock();
+    job_added.notify_one();
+}
+
+void frame_capture::finish()
+{
+    // Remaining frames, in capture order
+    for (size_t k = 0; k < ring.size(); ++k)
+    {
+        slot& s = ring[(next_slot + k) % ring.size()];
+        if (s.filled)
+            read_slot(s);
+    }
+    for (slot& s : ring)
+        glDeleteBuffers(1, &s.pbo);
+    ring.clear();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job_removed.wait(lock, [this]{ return jobs.empty() && busy == 0; });
+}
+
+void frame_capture::encoder_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        job_added.wait(lock, [this]{ return stopping || !jobs.empty(); });
+        if (jobs.empty())
+            return; // stopping, once the queue is drained
+
+        job j = std::move(jobs.front());
+        jobs.pop_front();
+        ++busy;
+        lock.unlock();
+        job_removed.notify_all();
+
+        encode(j);
+
+        lock.lock();
+        --busy;
+        job_removed.notify_all();
+    }
+}
+
+void frame_capture::encode(const job& j)
+{
+    // One thread per frame: the encoders already run in parallel
+    image_save(j.filename, image_raw(unsigned(j.width), unsigned(j.height), image_color_type::rgba, j.pixels), j.format, 1);
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "vcl/wrapper/glad/glad.hpp"
+#include "vcl/wrapper/lodepng/lodepng.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace vcl
+{
+
+/** Capture of the rendered frames to a sequence of image files, without stalling the render thread.
+ * capture() starts the copy of the bound framebuffer into the next pixel pack buffer of a ring (glReadPixels into a
+ * buffer returns immediately), and maps the buffer filled ring_size-1 frames before, which the GPU has completed by then.
+ * The pixels are then written by a pool of encoder threads as prefix0000.png, prefix0001.png... (or .qoi, .ppm, see image_encoding).
+ * capture() only waits when max_pending frames are already queued for the encoders, to bound the memory. */
+struct frame_capture
+{
+    std::string prefix = "frame_";
+    image_encoding format = image_encoding::png_fast;
+    size_t ring_size = 3;
+    size_t nb_encoders = 0; // 0: one per hardware thread, minus the render thread
+    size_t max_pending = 16;
+
+    frame_capture() = default;
+    frame_capture(const frame_capture&) = delete;
+    frame_capture& operator=(const frame_capture&) = delete;
+    ~frame_capture();
+
+    // Capture the region (0,0,width,height) of the bound framebuffer
+    void capture(int width, int height);
+    // Encode the frames still in the ring, wait for the encoders and release the buffers (OpenGL context required)
+    void finish();
+
+    // Number of frames captured since the creation
+    size_t frame_count() const { return next_index; }
+
+private:
+    struct slot
+    {
+        GLuint pbo = 0;
+        size_t index = 0;
+        bool filled = false;
+    };
+
+    struct job
+    {
+        std::string filename;
+        image_encoding format;
+        int width;
+        int height;
+        std::vector<unsigned char> pixels; // rgba, first row at the top
+    };
+
+    void allocate(int width, int height);
+    void read_slot(slot& s);
+    void encoder_loop();
+    static void encode(const job& j);
+
+    std::vector<slot> ring;
+    int ring_width = 0;
+    int ring_height = 0;
+    size_t next_slot = 0;
+    size_t next_index = 0;
+
+    std::vector<std::thread> encoders;
+    std::deque<job> jobs;
+    size_t busy = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_removed;
+};
+
+}
@@ -2,6 +2,30 @@
 
 #include "vcl/base/base.hpp"
 #include <iostream>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+// KHR_debug / ARB_debug_output (core in 4.3), absent from the GL 3.3 glad files
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT 0x92E0
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#define GL_DEBUG_SOURCE_API 0x8246
+#define GL_DEBUG_SOURCE_WINDOW_SYSTEM 0x8247
+#define GL_DEBUG_SOURCE_SHADER_COMPILER 0x8248
+#define GL_DEBUG_SOURCE_THIRD_PARTY 0x8249
+#define GL_DEBUG_SOURCE_APPLICATION 0x824A
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#define GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR 0x824D
+#define GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR 0x824E
+#define GL_DEBUG_TYPE_PORTABILITY 0x824F
+#define GL_DEBUG_TYPE_PERFORMANCE 0x8250
+#define GL_DEBUG_SEVERITY_HIGH 0x9146
+#define GL_DEBUG_SEVERITY_MEDIUM 0x9147
+#define GL_DEBUG_SEVERITY_LOW 0x9148
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#endif
 
 
 namespace vcl
@@ -42,6 +66,182 @@ static std::string opengl_error_to_string(GLenum error)
 
 }
 
+opengl_debug_level opengl_debug_current_level = opengl_debug_level::off;
+
+typedef void (APIENTRYP PFN_debug_message_callback)(GLDEBUGPROC callback, const void* user_param);
+typedef void (APIENTRYP PFN_debug_message_control)(GLenum source, GLenum type, GLenum severity, GLsizei count, const GLuint* ids, GLboolean enabled);
+
+static bool debug_callback_installed = false;
+static int debug_min_severity = 2; // medium
+static std::mutex debug_mutex;
+static std::set<std::tuple<GLenum,GLenum,GLuint>> debug_reported; // each message is printed once
+
+struct opengl_debug_location
+{
+    const char* file;
+    const char* function;
+    int line;
+};
+static opengl_debug_location debug_last_location = {"", "", 0}; // guarded by debug_mutex
+
+void opengl_debug_set_location(const char* file, const char* function, int line)
+{
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    debug_last_location = {file, function, line};
+}
+
+// 3: high, 2: medium, 1: low, 0: notification
+static int severity_rank(GLenum severity)
+{
+    switch(severity)
+    {
+    case GL_DEBUG_SEVERITY_HIGH:
+        return 3;
+    case GL_DEBUG_SEVERITY_MEDIUM:
+        return 2;
+    case GL_DEBUG_SEVERITY_LOW:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static const char* debug_source_to_string(GLenum source)
+{
+    switch(source)
+    {
+    case GL_DEBUG_SOURCE_API:
+        return "API";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+        return "WINDOW_SYSTEM";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER:
+        return "SHADER_COMPILER";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:
+        return "THIRD_PARTY";
+    case GL_DEBUG_SOURCE_APPLICATION:
+        return "APPLICATION";
+    default:
+        return "OTHER";
+    }
+}
+
+static const char* debug_type_to_string(GLenum type)
+{
+    switch(type)
+    {
+    case GL_DEBUG_TYPE_ERROR:
+        return "ERROR";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+        return "DEPRECATED_BEHAVIOR";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+        return "UNDEFINED_BEHAVIOR";
+    case GL_DEBUG_TYPE_PORTABILITY:
+        return "PORTABILITY";
+    case GL_DEBUG_TYPE_PERFORMANCE:
+        return "PERFORMANCE";
+    default:
+        return "OTHER";
+    }
+}
+
+static void APIENTRY opengl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei, const GLchar* message, const void*)
+{
+    if (opengl_debug_current_level == opengl_debug_level::off || severity_rank(severity) < debug_min_severity)
+        return;
+
+    // May be called from a driver thread when the output is asynchronous
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    if (!debug_reported.insert(std::make_tuple(source, type, id)).second)
+        return;
+
+    const opengl_debug_location& location = debug_last_location;
+    std::cerr<<"OpenGL "<<debug_type_to_string(type)<<" ["<<debug_source_to_string(source)<<", id "<<id<<"]: "<<message<<"\n"
+             <<"\tLast checkpoint "<<location.file<<":"<<location.line<<" ("<<location.function<<")"<<std::endl;
+}
+
+bool opengl_extension_supported(const char* name)
+{
+    GLint nb_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &nb_extensions);
+    for (GLint k = 0; k < nb_extensions; ++k)
+    {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, GLuint(k)));
+        if (extension != nullptr && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+void opengl_debug_init(GLADloadproc proc_address, opengl_debug_level level)
+{
+    opengl_debug_set_level(level);
+    if (VCL_OPENGL_DEBUG_LEVEL == 0)
+        return;
+
+    // Same entry points for the core 4.3 and KHR_debug versions, suffixed for ARB_debug_output
+    PFN_debug_message_callback debug_message_callback = nullptr;
+    PFN_debug_message_control debug_message_control = nullptr;
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3) || opengl_extension_supported("GL_KHR_debug")) {
+        debug_message_callback = reinterpret_cast<PFN_debug_message_callback>(proc_address("glDebugMessageCallback"));
+        debug_message_control = reinterpret_cast<PFN_debug_message_control>(proc_address("glDebugMessageControl"));
+    }
+    else if (opengl_extension_supported("GL_ARB_debug_output")) {
+        debug_message_callback = reinterpret_cast<PFN_debug_message_callback>(proc_address("glDebugMessageCallbackARB"));
+        debug_message_control = reinterpret_cast<PFN_debug_message_control>(proc_address("glDebugMessageControlARB"));
+    }
+
+    if (debug_message_callback == nullptr) {
+        std::cout<<"\t [OpenGL debug] No debug output extension: errors are checked once per frame"<<std::endl;
+        return;
+    }
+
+    glEnable(GL_DEBUG_OUTPUT); // no-op for ARB_debug_output, which is always enabled in a debug context
+    glGetError();
+    debug_message_callback(opengl_debug_callback, nullptr);
+    if (debug_message_control != nullptr)
+        debug_message_control(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+    debug_callback_installed = true;
+    opengl_debug_set_level(level); // synchronous output if needed
+    std::cout<<"\t [OpenGL debug] Message callback installed"<<std::endl;
+}
+
+void opengl_debug_set_level(opengl_debug_level level)
+{
+    if (int(level) > VCL_OPENGL_DEBUG_LEVEL)
+        level = opengl_debug_level(VCL_OPENGL_DEBUG_LEVEL);
+    opengl_debug_current_level = level;
+
+    // The callback is called within the faulty GL call only in synchronous mode
+    if (debug_callback_installed) {
+        if (level == opengl_debug_level::sync)
+            glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        else
+            glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    }
+}
+
+opengl_debug_level opengl_debug_get_level()
+{
+    return opengl_debug_current_level;
+}
+
+void opengl_debug_set_min_severity(GLenum min_severity)
+{
+    debug_min_severity = severity_rank(min_severity);
+}
+
+void opengl_debug_end_frame()
+{
+    if (opengl_debug_current_level == opengl_debug_level::async && !debug_callback_installed) {
+        opengl_debug_location location;
+        {
+            std::lock_guard<std::mutex> lock(debug_mutex);
+            location = debug_last_location;
+        }
+        check_opengl_error(location.file, location.function, location.line);
+    }
+}
+
 void check_opengl_error(const std::string& file, const std::string& function, int line)
 {
     GLenum error = glGetError();
@@ -10,12 +10,53 @@
 #define P_FUNCTION __FUNCTION__
 #endif
 
-#define opengl_debug() vcl::check_opengl_error(__FILE__,P_FUNCTION,__LINE__)
+/** Highest OpenGL debug level compiled in
+ *  0: off   - opengl_debug() compiles to nothing and no debug context is requested
+ *  1: async - errors are reported by the KHR_debug/ARB_debug_output message callback, opengl_debug() only records its location
+ *  2: sync  - opengl_debug() calls glGetError (flushes the pipeline), as well as the callback made synchronous
+ * The level can be lowered at runtime with opengl_debug_set_level. */
+#ifndef VCL_OPENGL_DEBUG_LEVEL
+#define VCL_OPENGL_DEBUG_LEVEL 2
+#endif
+
+#if VCL_OPENGL_DEBUG_LEVEL > 0
+#define opengl_debug() vcl::opengl_debug_checkpoint(__FILE__,P_FUNCTION,__LINE__)
+#else
+#define opengl_debug() ((void)0)
+#endif
 
 namespace vcl
 {
 
+enum class opengl_debug_level { off = 0, async = 1, sync = 2 };
+
 void opengl_debug_print_version();
+// Extension listed by glGetStringi(GL_EXTENSIONS)
+bool opengl_extension_supported(const char* name);
 void check_opengl_error(const std::string& file, const std::string& function, int line);
 
+// Install the message callback if the context supports it (after glad_init).
+// proc_address is the loader of the window library (glfwGetProcAddress), the entry points are not part of the GL 3.3 glad files.
+void opengl_debug_init(GLADloadproc proc_address, opengl_debug_level level);
+// Runtime level, clamped to VCL_OPENGL_DEBUG_LEVEL
+void opengl_debug_set_level(opengl_debug_level level);
+opengl_debug_level opengl_debug_get_level();
+// Messages less severe than min_severity (GL_DEBUG_SEVERITY_HIGH/MEDIUM/LOW/NOTIFICATION) are ignored
+void opengl_debug_set_min_severity(GLenum min_severity);
+// Once per frame: without a message callback, the async level checks glGetError here instead of at each checkpoint
+void opengl_debug_end_frame();
+
+extern opengl_debug_level opengl_debug_current_level;
+// Last location passed through opengl_debug(), reported with the asynchronous messages.
+// Guarded by the mutex of the message callback, which may run on a driver thread.
+void opengl_debug_set_location(const char* file, const char* function, int line);
+
+inline void opengl_debug_checkpoint(const char* file, const char* function, int line)
+{
+    if (opengl_debug_current_level == opengl_debug_level::sync)
+        check_opengl_error(file, function, line);
+    else if (opengl_debug_current_level == opengl_debug_level::async)
+        opengl_debug_set_location(file, function, line);
+}
+
 }
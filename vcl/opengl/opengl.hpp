@@ -2,6 +2,10 @@
 
 #include "debug/opengl_debug.hpp"
 #include "shader/shader.hpp"
+#include "shader/shader_library.hpp"
 #include "uniform/uniform.hpp"
 #include "texture/texture.hpp"
 
+#include "state/state.hpp"
+#include "timer/timer_gpu.hpp"
+#include "capture/frame_capture.hpp"
@@ -1,6 +1,7 @@
 #include "shader.hpp"
 
 #include "vcl/base/base.hpp"
+#include "vcl/opengl/uniform/uniform.hpp"
 
 #include <vector>
 #include <iostream>
@@ -9,7 +10,7 @@
 namespace vcl
 {
 
-static void check_compilation(GLuint shader,const std::string& shader_str)
+void check_compilation(GLuint shader,const std::string& shader_str)
 {
     GLint is_compiled = 0;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &is_compiled);
@@ -35,7 +36,7 @@ static void check_compilation(GLuint shader,const std::string& shader_str)
     }
 }
 
-static void check_link(GLuint vertex_shader, GLuint fragment_shader, GLuint program)
+void check_link(GLuint vertex_shader, GLuint fragment_shader, GLuint program)
 {
     GLint is_linked = 0;
     glGetProgramiv(program, GL_LINK_STATUS, &is_linked);
@@ -108,6 +109,10 @@ GLuint create_shader_program(const std::string& vertex_shader_path, const std::s
     glDetachShader( program, fragment_shader);
 
 
+    // Locations of the uniforms, looked up once for all the draw calls
+    introspect_uniforms(program);
+    bind_uniform_block(program, "camera_data", camera_uniform_binding);
+
     return program;
 }
 
@@ -145,6 +150,10 @@ GLuint create_shader_program(const std::string& vertex_shader_path, const std::s
     glDetachShader( program, fragment_shader);
 
 
+    // Locations of the uniforms, looked up once for all the draw calls
+    introspect_uniforms(program);
+    bind_uniform_block(program, "camera_data", camera_uniform_binding);
+
     return program;
 }
 
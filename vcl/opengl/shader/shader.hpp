@@ -11,6 +11,10 @@ namespace vcl
  * Check that the compilation succeed. */
 GLuint compile_shader(const std::string& shader_str, const GLenum shader_type);
 
+/** Print the logs of a compiled shader / linked program, and exit on failure. */
+void check_compilation(GLuint shader, const std::string& shader_str);
+void check_link(GLuint vertex_shader, GLuint fragment_shader, GLuint program);
+
 
 /** Compile vertex and fragment shaders provided from their file paths, link them, and return a shader program.
  * Check that link operation succeed. */
@@ -0,0 +1,231 @@
+#include "shader_library.hpp"
+
+#include "shader.hpp"
+#include "vcl/base/base.hpp"
+#include "vcl/opengl/debug/opengl_debug.hpp"
+#include "vcl/opengl/uniform/uniform.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+// ARB_get_program_binary (core in 4.1) and KHR_parallel_shader_compile, absent from the GL 3.3 glad files
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace vcl
+{
+
+typedef void (APIENTRYP PFN_get_program_binary)(GLuint program, GLsizei buffer_size, GLsizei* length, GLenum* format, void* binary);
+typedef void (APIENTRYP PFN_program_binary)(GLuint program, GLenum format, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFN_program_parameteri)(GLuint program, GLenum name, GLint value);
+typedef void (APIENTRYP PFN_max_shader_compiler_threads)(GLuint count);
+
+static PFN_get_program_binary get_program_binary = nullptr;
+static PFN_program_binary program_binary = nullptr;
+static PFN_program_parameteri program_parameteri = nullptr;
+
+static const char cache_magic[8] = {'V','C','L','S','H','D','R','1'};
+
+// FNV-1a, stable across runs and platforms
+static void hash_combine(unsigned long long& h, const std::string& s)
+{
+    for (size_t k = 0; k < s.size(); ++k)
+    {
+        h ^= static_cast<unsigned char>(s[k]);
+        h *= 1099511628211ull;
+    }
+    h ^= 0xFF; // separator
+    h *= 1099511628211ull;
+}
+
+void shader_library::init(GLADloadproc proc_address)
+{
+    driver = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "|"
+           + reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "|"
+           + reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+    const bool core_binary = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1);
+    if (core_binary || opengl_extension_supported("GL_ARB_get_program_binary")) {
+        get_program_binary = reinterpret_cast<PFN_get_program_binary>(proc_address("glGetProgramBinary"));
+        program_binary = reinterpret_cast<PFN_program_binary>(proc_address("glProgramBinary"));
+        program_parameteri = reinterpret_cast<PFN_program_parameteri>(proc_address("glProgramParameteri"));
+    }
+    GLint nb_formats = 0;
+    if (get_program_binary != nullptr && program_binary != nullptr)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nb_formats);
+    binary_supported = nb_formats > 0 && !cache_filename.empty();
+
+    // Let the driver compile on its own threads
+    PFN_max_shader_compiler_threads max_threads = nullptr;
+    if (opengl_extension_supported("GL_KHR_parallel_shader_compile"))
+        max_threads = reinterpret_cast<PFN_max_shader_compiler_threads>(proc_address("glMaxShaderCompilerThreadsKHR"));
+    else if (opengl_extension_supported("GL_ARB_parallel_shader_compile"))
+        max_threads = reinterpret_cast<PFN_max_shader_compiler_threads>(proc_address("glMaxShaderCompilerThreadsARB"));
+    if (max_threads != nullptr)
+        max_threads(0xFFFFFFFF);
+
+    if (binary_supported)
+        read_cache();
+}
+
+GLuint shader_library::add(const std::string& vertex_shader_path, const std::string& fragment_shader_path)
+{
+    return add(std::vector<std::string>{vertex_shader_path, fragment_shader_path});
+}
+
+GLuint shader_library::add(const std::string& vertex_shader_path, const std::string& geometry_shader_path, const std::string& fragment_shader_path)
+{
+    return add(std::vector<std::string>{vertex_shader_path, geometry_shader_path, fragment_shader_path});
+}
+
+GLuint shader_library::add(const std::vector<std::string>& paths)
+{
+    pending_program p;
+    p.key = 14695981039346656037ull;
+    hash_combine(p.key, driver);
+    for (const std::string& path : paths)
+    {
+        p.sources.push_back(read_file_text(path));
+        hash_combine(p.key, p.sources.back());
+    }
+    p.program = glCreateProgram();
+
+    auto it = cache.find(p.key);
+    if (binary_supported && it != cache.end())
+        program_binary(p.program, it->second.format, it->second.data.data(), GLsizei(it->second.data.size()));
+    else
+        compile(p);
+
+    pending.push_back(p);
+    return p.program;
+}
+
+void shader_library::compile(pending_program& p)
+{
+    const GLenum types_2[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    const GLenum types_3[] = {GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER};
+    const GLenum* types = p.sources.size() == 3 ? types_3 : types_2;
+
+    for (size_t k = 0; k < p.sources.size(); ++k)
+    {
+        const GLuint shader = glCreateShader(types[k]);
+        char const* const shader_cstring = p.sources[k].c_str();
+        glShaderSource(shader, 1, &shader_cstring, nullptr);
+        glCompileShader(shader);
+        glAttachShader(p.program, shader);
+        p.shaders.push_back(shader);
+    }
+    if (binary_supported && program_parameteri != nullptr)
+        program_parameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(p.program);
+}
+
+void shader_library::finish()
+{
+    for (pending_program& p : pending)
+    {
+        if (p.shaders.empty()) {
+            GLint is_linked = 0;
+            glGetProgramiv(p.program, GL_LINK_STATUS, &is_linked);
+            if (is_linked == GL_TRUE)
+                used[p.key] = cache[p.key];
+            else
+                compile(p); // binary rejected by the driver
+        }
+
+        if (!p.shaders.empty()) {
+            for (size_t k = 0; k < p.shaders.size(); ++k)
+                check_compilation(p.shaders[k], p.sources[k]);
+            check_link(p.shaders.front(), p.shaders.back(), p.program);
+            for (GLuint shader : p.shaders)
+            {
+                glDetachShader(p.program, shader);
+                glDeleteShader(shader);
+            }
+
+            if (binary_supported) {
+                GLint length = 0;
+                glGetProgramiv(p.program, GL_PROGRAM_BINARY_LENGTH, &length);
+                binary b;
+                b.data.resize(size_t(length));
+                if (length > 0) {
+                    get_program_binary(p.program, length, nullptr, &b.format, b.data.data());
+                    cache[p.key] = b;
+                    used[p.key] = b;
+                    cache_modified = true;
+                }
+            }
+        }
+
+        // Locations of the uniforms, looked up once for all the draw calls
+        introspect_uniforms(p.program);
+        bind_uniform_block(p.program, "camera_data", camera_uniform_binding);
+    }
+    pending.clear();
+
+    if (binary_supported && (cache_modified || cache.size() != used.size())) {
+        write_cache();
+        cache = used;
+        cache_modified = false;
+    }
+}
+
+void shader_library::read_cache()
+{
+    std::ifstream file(cache_filename, std::ios::binary);
+    if (!file)
+        return;
+
+    char magic[8] = {0};
+    unsigned int count = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || std::memcmp(magic, cache_magic, sizeof(magic)) != 0)
+        return;
+
+    for (unsigned int k = 0; k < count; ++k)
+    {
+        unsigned long long key = 0;
+        unsigned int format = 0, size = 0;
+        file.read(reinterpret_cast<char*>(&key), sizeof(key));
+        file.read(reinterpret_cast<char*>(&format), sizeof(format));
+        file.read(reinterpret_cast<char*>(&size), sizeof(size));
+        if (!file || size > (1u << 28))
+            break;
+        binary b;
+        b.format = format;
+        b.data.resize(size);
+        file.read(b.data.data(), size);
+        if (!file)
+            break;
+        cache[key] = b;
+    }
+}
+
+void shader_library::write_cache() const
+{
+    std::ofstream file(cache_filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot write the shader cache to " << cache_filename << std::endl;
+        return;
+    }
+
+    const unsigned int count = static_cast<unsigned int>(used.size());
+    file.write(cache_magic, sizeof(cache_magic));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& entry : used)
+    {
+        const unsigned int format = entry.second.format;
+        const unsigned int size = static_cast<unsigned int>(entry.second.data.size());
+        file.write(reinterpret_cast<const char*>(&entry.first), sizeof(entry.first));
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file.write(entry.second.data.data(), size);
+    }
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "vcl/wrapper/glad/glad.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+
+namespace vcl
+{
+
+/** Creation of a set of shader programs, with a cache of the linked binaries.
+ * add() only issues the work: the binary of the program is loaded from the cache when its sources and the driver
+ * are unchanged, otherwise its shaders are compiled and linked without waiting for the result. The statuses are
+ * checked in finish(), once every program has been submitted, so that drivers compiling in parallel
+ * (KHR_parallel_shader_compile) can overlap them. finish() writes the binaries of the programs compiled from source.
+ * Without program binary support (GL < 4.1 and no ARB_get_program_binary) every program is compiled. */
+struct shader_library
+{
+    // Empty to disable the cache
+    std::string cache_filename = "shader_cache.bin";
+
+    // After glad_init, proc_address is the loader of the window library (glfwGetProcAddress)
+    void init(GLADloadproc proc_address);
+
+    GLuint add(const std::string& vertex_shader_path, const std::string& fragment_shader_path);
+    GLuint add(const std::string& vertex_shader_path, const std::string& geometry_shader_path, const std::string& fragment_shader_path);
+
+    // Check the programs added since the last call (exit on failure, as create_shader_program) and update the cache
+    void finish();
+
+private:
+    struct binary
+    {
+        GLenum format;
+        std::vector<char> data;
+    };
+
+    struct pending_program
+    {
+        GLuint program;
+        unsigned long long key;
+        std::vector<std::string> sources; // vertex, [geometry,] fragment
+        std::vector<GLuint> shaders;      // empty when loaded from the cache
+    };
+
+    GLuint add(const std::vector<std::string>& paths);
+    void compile(pending_program& p);
+    void read_cache();
+    void write_cache() const;
+
+    std::string driver;
+    bool binary_supported = false;
+    bool cache_modified = false;
+    std::map<unsigned long long, binary> cache;
+    std::map<unsigned long long, binary> used; // entries written back: the stale ones are dropped
+    std::vector<pending_program> pending;
+};
+
+}
@@ -0,0 +1,148 @@
+#include "state.hpp"
+
+namespace vcl
+{
+
+// Values set through the functions of this file. known==false means that the value must be set again.
+namespace {
+
+struct cached_value
+{
+    bool known = false;
+    GLuint value = 0;
+
+    bool update(GLuint new_value)
+    {
+        if (known && value == new_value)
+            return false;
+        known = true;
+        value = new_value;
+        return true;
+    }
+};
+
+const size_t max_texture_units = 32;
+
+struct gl_state
+{
+    cached_value program;
+    cached_value vao;
+    cached_value framebuffer;
+    cached_value active_texture_unit;
+    cached_value texture[max_texture_units];
+    cached_value blend;
+    cached_value blend_source;
+    cached_value blend_destination;
+    cached_value depth_test;
+    cached_value depth_function;
+
+    bool viewport_known = false;
+    GLint viewport[4] = {0, 0, 0, 0};
+};
+
+gl_state state;
+GLuint default_framebuffer = 0; // not part of the cached state: kept by invalidate_gl_state
+
+}
+
+void use_program(GLuint program)
+{
+    if (state.program.update(program))
+        glUseProgram(program);
+}
+
+GLuint current_program()
+{
+    if (!state.program.known) {
+        GLint program = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        state.program.update(GLuint(program));
+    }
+    return state.program.value;
+}
+
+void bind_vertex_array(GLuint vao)
+{
+    if (state.vao.update(vao))
+        glBindVertexArray(vao);
+}
+
+void bind_texture(GLuint texture, GLuint unit)
+{
+    if (state.active_texture_unit.update(unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+
+    if (unit >= max_texture_units) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        return;
+    }
+    if (state.texture[unit].update(texture))
+        glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void bind_framebuffer(GLuint framebuffer)
+{
+    if (framebuffer == 0)
+        framebuffer = default_framebuffer;
+    if (state.framebuffer.update(framebuffer))
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void set_default_framebuffer(GLuint framebuffer)
+{
+    default_framebuffer = framebuffer;
+    state.framebuffer.known = false;
+}
+
+void set_viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    const GLint viewport[4] = {x, y, width, height};
+    if (state.viewport_known && viewport[0] == state.viewport[0] && viewport[1] == state.viewport[1]
+            && viewport[2] == state.viewport[2] && viewport[3] == state.viewport[3])
+        return;
+    state.viewport_known = true;
+    for (int k = 0; k < 4; ++k)
+        state.viewport[k] = viewport[k];
+    glViewport(x, y, width, height);
+}
+
+void set_blend(bool enabled)
+{
+    if (!state.blend.update(enabled ? 1 : 0))
+        return;
+    if (enabled)
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+}
+
+void set_blend_function(GLenum source, GLenum destination)
+{
+    const bool source_changed = state.blend_source.update(source);
+    const bool destination_changed = state.blend_destination.update(destination);
+    if (source_changed || destination_changed)
+        glBlendFunc(source, destination);
+}
+
+void set_depth_test(bool enabled)
+{
+    if (!state.depth_test.update(enabled ? 1 : 0))
+        return;
+    if (enabled)
+        glEnable(GL_DEPTH_TEST);
+    else
+        glDisable(GL_DEPTH_TEST);
+}
+
+void set_depth_function(GLenum function)
+{
+    if (state.depth_function.update(function))
+        glDepthFunc(function);
+}
+
+void invalidate_gl_state()
+{
+    state = gl_state();
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "vcl/wrapper/glad/glad.hpp"
+
+namespace vcl
+{
+
+/** Cached OpenGL state.
+ * Each function below only calls OpenGL when the requested value differs from the last one set through it:
+ * the draw helpers can set the full state they need at each draw without redundant driver calls, and without
+ * querying it back (glGet* calls are synchronous).
+ * Code changing the same state directly (or deleting a bound object) must call invalidate_gl_state() afterwards,
+ * so that the next request is issued again. */
+
+void use_program(GLuint program);
+/** Program in use (only queried from OpenGL if it is not known) */
+GLuint current_program();
+
+/** The element buffer is part of the vertex array state: it doesn't need to be bound again at each draw */
+void bind_vertex_array(GLuint vao);
+/** Bind a GL_TEXTURE_2D texture to a texture unit (also makes unit the active one) */
+void bind_texture(GLuint texture, GLuint unit = 0);
+/** Framebuffer 0 stands for the default framebuffer set below */
+void bind_framebuffer(GLuint framebuffer);
+/** Framebuffer bound in place of the window one (0), for offscreen rendering */
+void set_default_framebuffer(GLuint framebuffer);
+
+void set_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void set_blend(bool enabled);
+void set_blend_function(GLenum source, GLenum destination);
+void set_depth_test(bool enabled);
+void set_depth_function(GLenum function);
+
+/** Forget the cached state (for instance once per frame, after external libraries have rendered) */
+void invalidate_gl_state();
+
+}
@@ -0,0 +1,121 @@
+#include "timer_gpu.hpp"
+
+namespace vcl
+{
+
+timer_gpu::scope::scope(timer_gpu& timer_arg, const std::string& name)
+    :timer(timer_arg), marker(timer_arg.begin(name))
+{}
+
+timer_gpu::scope::~scope()
+{
+    timer.end(marker);
+}
+
+void timer_gpu::begin_frame()
+{
+    recording = nullptr;
+    if (!enabled)
+        return;
+
+    pool& p = pools[frame_index % 2];
+    if (p.pending) {
+        read_back(p);
+        if (p.pending) {
+            ++dropped_frames;
+            p.pending = false;
+        }
+    }
+
+    p.nb_markers = 0;
+    p.index = frame_index;
+    glGetInteger64v(GL_TIMESTAMP, &p.reference);
+    recording = &p;
+}
+
+void timer_gpu::end_frame()
+{
+    if (recording != nullptr)
+        recording->pending = recording->nb_markers > 0;
+    recording = nullptr;
+
+    // Previous frame, most likely executed by now
+    pool& previous = pools[(frame_index + 1) % 2];
+    if (previous.pending)
+        read_back(previous);
+    ++frame_index;
+}
+
+size_t timer_gpu::begin(const std::string& name)
+{
+    if (recording == nullptr)
+        return size_t(-1);
+
+    pool& p = *recording;
+    const size_t marker = p.nb_markers++;
+    if (p.queries.size() < 2 * p.nb_markers) {
+        p.queries.resize(2 * p.nb_markers);
+        glGenQueries(2, &p.queries[2 * marker]);
+    }
+    if (p.names.size() < p.nb_markers)
+        p.names.resize(p.nb_markers);
+    p.names[marker] = name;
+
+    glQueryCounter(p.queries[2 * marker], GL_TIMESTAMP);
+    return marker;
+}
+
+void timer_gpu::end(size_t marker)
+{
+    if (recording == nullptr || marker >= recording->nb_markers)
+        return;
+    glQueryCounter(recording->queries[2 * marker + 1], GL_TIMESTAMP);
+}
+
+void timer_gpu::read_back(pool& p)
+{
+    const size_t nb_queries = 2 * p.nb_markers;
+    for (size_t k = 0; k < nb_queries; ++k)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(p.queries[k], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+    }
+
+    result.index = p.index;
+    result.reference = p.reference;
+    result.intervals.resize(p.nb_markers);
+    for (size_t k = 0; k < p.nb_markers; ++k)
+    {
+        interval& i = result.intervals[k];
+        i.name = p.names[k];
+        glGetQueryObjectui64v(p.queries[2 * k], GL_QUERY_RESULT, &i.start);
+        glGetQueryObjectui64v(p.queries[2 * k + 1], GL_QUERY_RESULT, &i.end);
+    }
+    has_result = true;
+    p.pending = false;
+}
+
+bool timer_gpu::pop_result(frame& result_arg)
+{
+    if (!has_result)
+        return false;
+    result_arg = result;
+    has_result = false;
+    return true;
+}
+
+void timer_gpu::clear()
+{
+    for (pool& p : pools)
+    {
+        if (!p.queries.empty())
+            glDeleteQueries(GLsizei(p.queries.size()), p.queries.data());
+        p = pool();
+    }
+    recording = nullptr;
+    has_result = false;
+}
+
+}
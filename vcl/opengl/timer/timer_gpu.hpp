@@ -0,0 +1,78 @@
+#pragma once
+
+#include "vcl/wrapper/glad/glad.hpp"
+
+#include <string>
+#include <vector>
+
+namespace vcl
+{
+
+/** GPU duration of the passes of a frame, measured with GL_TIMESTAMP queries.
+ * Each marker records a timestamp query at its beginning and at its end (timestamps, unlike GL_TIME_ELAPSED queries,
+ * can be nested). The queries of a frame are read back at the end of the next frame, only if they are available:
+ * the two query pools are used alternately so that reading the results never waits for the GPU. A frame whose
+ * results are still not available when its pool is reused is dropped. */
+struct timer_gpu
+{
+    // Times in nanoseconds on the GPU clock
+    struct interval
+    {
+        std::string name;
+        GLuint64 start;
+        GLuint64 end;
+    };
+
+    struct frame
+    {
+        size_t index;        // value of frame_index during the recording
+        GLint64 reference;   // GPU time at begin_frame, to align the intervals with a CPU clock
+        std::vector<interval> intervals;
+    };
+
+    // Time the enclosing block on the GPU
+    struct scope
+    {
+        scope(timer_gpu& timer, const std::string& name);
+        ~scope();
+
+        timer_gpu& timer;
+        size_t marker;
+    };
+
+    bool enabled = true;
+    size_t frame_index = 0;
+    size_t dropped_frames = 0;
+
+    void begin_frame();
+    void end_frame();
+
+    // Marker of the recording frame, ended by end(marker)
+    size_t begin(const std::string& name);
+    void end(size_t marker);
+
+    // Most recent frame read back (returns false until one is available). Each frame is returned once.
+    bool pop_result(frame& result);
+
+    void clear();
+
+private:
+    struct pool
+    {
+        std::vector<GLuint> queries; // 2 per marker
+        std::vector<std::string> names;
+        size_t nb_markers = 0;
+        size_t index = 0;
+        GLint64 reference = 0;
+        bool pending = false; // recorded, not read back yet
+    };
+
+    void read_back(pool& p);
+
+    pool pools[2];
+    pool* recording = nullptr;
+    bool has_result = false;
+    frame result;
+};
+
+}
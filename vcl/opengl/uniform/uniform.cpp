@@ -1,55 +1,172 @@
 #include "uniform.hpp"
 
+#include <unordered_map>
+#include <vector>
+
 namespace vcl
 {
 
+// Locations of the active uniforms, per program
+static std::unordered_map<GLuint, std::unordered_map<std::string, GLint> >& uniform_cache()
+{
+    static std::unordered_map<GLuint, std::unordered_map<std::string, GLint> > cache;
+    return cache;
+}
+
+void introspect_uniforms(GLuint shader)
+{
+    std::unordered_map<std::string, GLint>& locations = uniform_cache()[shader];
+    locations.clear();
+
+    GLint nb_uniforms = 0, max_length = 0;
+    glGetProgramiv(shader, GL_ACTIVE_UNIFORMS, &nb_uniforms);
+    glGetProgramiv(shader, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<GLchar> buffer(size_t(max_length) + 1);
+    for (GLint k = 0; k < nb_uniforms; ++k)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(shader, GLuint(k), GLsizei(buffer.size()), &length, &size, &type, &buffer[0]);
+        const std::string name(&buffer[0], size_t(length));
+        const GLint location = glGetUniformLocation(shader, name.c_str());
+        locations[name] = location;
+
+        // Arrays are reported as name[0], but can also be accessed as name
+        const size_t bracket = name.find('[');
+        if (bracket != std::string::npos && name.compare(bracket, std::string::npos, "[0]") == 0)
+            locations[name.substr(0, bracket)] = location;
+    }
+}
+
+void clear_uniform_cache(GLuint shader)
+{
+    uniform_cache().erase(shader);
+}
+
+GLint uniform_location(GLuint shader, const std::string& name)
+{
+    auto program = uniform_cache().find(shader);
+    if (program == uniform_cache().end()) {
+        introspect_uniforms(shader);
+        program = uniform_cache().find(shader);
+    }
+
+    std::unordered_map<std::string, GLint>& locations = program->second;
+    const auto it = locations.find(name);
+    if (it != locations.end())
+        return it->second;
+
+    // Other elements of arrays are not listed by the introspection: ask the driver once
+    const GLint location = name.find('[') != std::string::npos ? glGetUniformLocation(shader, name.c_str()) : -1;
+    locations[name] = location;
+    return location;
+}
+
+void bind_uniform_block(GLuint shader, const std::string& block_name, GLuint binding)
+{
+    const GLuint index = glGetUniformBlockIndex(shader, block_name.c_str());
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(shader, index, binding);
+}
+
+uniform_id::uniform_id()
+    :shader(0), location(-1)
+{}
+
+uniform_id::uniform_id(GLuint shader_arg, const std::string& name)
+    :shader(shader_arg), location(uniform_location(shader_arg, name))
+{}
+
+void uniform(const uniform_id& id, const int value)
+{
+    glUniform1i(id.location, value);
+}
+
+void uniform(const uniform_id& id, const float value)
+{
+    glUniform1f(id.location, value);
+}
+
+void uniform(const uniform_id& id, const vec2& value)
+{
+    glUniform2f(id.location, value.x, value.y);
+}
+
+void uniform(const uniform_id& id, const vec3& value)
+{
+    glUniform3f(id.location, value.x, value.y, value.z);
+}
+
+void uniform(const uniform_id& id, const vec4& value)
+{
+    glUniform4f(id.location, value.x, value.y, value.z, value.w);
+}
+
+void uniform(const uniform_id& id, const mat4& m)
+{
+    const float* ptr = &m[0];
+    glUniformMatrix4fv(id.location, 1, GL_TRUE, ptr);
+}
+
+void uniform(const uniform_id& id, const mat3& m)
+{
+    const float* ptr = &m[0];
+    glUniformMatrix3fv(id.location, 1, GL_TRUE, ptr);
+}
+
 void uniform(GLuint shader, const std::string& name, const int value)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     glUniform1i(location, value);
 }
 
 void uniform(GLuint shader, const std::string& name, float value)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     glUniform1f(location, value);
 }
 
+void uniform(GLuint shader, const std::string& name, const vec2& value)
+{
+    const GLint location = uniform_location(shader, name);
+    glUniform2f(location, value.x,value.y);
+}
 
 void uniform(GLuint shader, const std::string& name, const vec3& value)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     glUniform3f(location, value.x,value.y, value.z);
 }
 
 void uniform(GLuint shader, const std::string& name, const vec4& value)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     glUniform4f(location, value.x,value.y, value.z, value.w);
 }
 
 void uniform(GLuint shader, const std::string& name, float x, float y, float z)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     glUniform3f(location, x, y, z);
 }
 
 void uniform(GLuint shader, const std::string& name, float x, float y, float z, float w)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     glUniform4f(location, x, y, z, w);
 }
 
 void uniform(GLuint shader, const std::string& name, const mat4& m)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     const float* ptr = &m[0];
     glUniformMatrix4fv(location, 1, GL_TRUE, ptr);
 }
 
 void uniform(GLuint shader, const std::string& name, const mat3& m)
 {
-    const GLint location = glGetUniformLocation(shader, name.c_str());
+    const GLint location = uniform_location(shader, name);
     const float* ptr = &m[0];
     glUniformMatrix3fv(location, 1, GL_TRUE, ptr);
 }
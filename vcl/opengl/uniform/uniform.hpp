@@ -9,8 +9,43 @@
 namespace vcl
 {
 
+/** Location of a uniform variable in a shader program, to be looked up once and reused at each draw.
+ * The active uniforms of a program are introspected the first time one of its uniforms is requested
+ * (create_shader_program does it right after link), then the locations are read from a cache:
+ * the name-based uniform() functions below do not query the driver either. */
+struct uniform_id
+{
+    uniform_id();
+    uniform_id(GLuint shader, const std::string& name);
+
+    GLuint shader;
+    GLint location; // -1 if the uniform is not active in the program (the value is then ignored)
+};
+
+/** Binding point of the camera_data uniform block (see publish_camera) */
+static const GLuint camera_uniform_binding = 0;
+
+/** Connect the uniform block block_name of a program, if it has one, to a binding point */
+void bind_uniform_block(GLuint shader, const std::string& block_name, GLuint binding);
+
+/** Cached location of a uniform (-1 if it is not active) */
+GLint uniform_location(GLuint shader, const std::string& name);
+/** Store the locations of all the active uniforms of a linked program */
+void introspect_uniforms(GLuint shader);
+/** Forget the locations of a program (to call if it is deleted or relinked) */
+void clear_uniform_cache(GLuint shader);
+
+void uniform(const uniform_id& id, const int value);
+void uniform(const uniform_id& id, const float value);
+void uniform(const uniform_id& id, const vec2& value);
+void uniform(const uniform_id& id, const vec3& value);
+void uniform(const uniform_id& id, const vec4& value);
+void uniform(const uniform_id& id, const mat4& m);
+void uniform(const uniform_id& id, const mat3& m);
+
 void uniform(GLuint shader, const std::string& name, const int value);
 void uniform(GLuint shader, const std::string& name, const float value);
+void uniform(GLuint shader, const std::string& name, const vec2& value);
 void uniform(GLuint shader, const std::string& name, const vec3& value);
 void uniform(GLuint shader, const std::string& name, const vec4& value);
 void uniform(GLuint shader, const std::string& name, float x, float y, float z);
@@ -1,6 +1,7 @@
 #include "curve_drawable.hpp"
 
 #include "vcl/opengl/opengl.hpp"
+#include "vcl/interaction/camera/camera_uniform_block/camera_uniform_block.hpp"
 
 namespace vcl
 {
@@ -25,19 +26,15 @@ void draw(const curve_drawable& drawable, const camera_scene& camera, GLuint sha
 {
 
     // If shader is 0, use the current one
-    GLint current_shader = 0;
-    glGetIntegerv(GL_CURRENT_PROGRAM, &current_shader); opengl_debug();
     if(shader==0) {
-        shader = GLuint(current_shader);
+        shader = current_program();
     }
-    // Check that the shader is a valid one
-    if( glIsProgram(shader)==GL_FALSE ) {
+    if(shader==0) {
         std::cout<<"No valid shader set to display mesh: skip display"<<std::endl;
         return;
     }
     // Switch shader program only if necessary
-    if(shader!=GLuint(current_shader))
-        glUseProgram(shader); opengl_debug();
+    use_program(shader); opengl_debug();
 
 
     uniform(shader, "rotation", drawable.uniform.transform.rotation);        opengl_debug();
@@ -45,8 +42,7 @@ void draw(const curve_drawable& drawable, const camera_scene& camera, GLuint sha
     uniform(shader, "color", drawable.uniform.color);                        opengl_debug();
     uniform(shader, "scaling", drawable.uniform.transform.scaling);          opengl_debug();
 
-    uniform(shader,"perspective",camera.perspective.matrix());      opengl_debug();
-    uniform(shader,"view",camera.view_matrix());                    opengl_debug();
+    publish_camera(camera);                                                  opengl_debug();
 
     vcl::draw(drawable.data);                                                opengl_debug();
 }
@@ -2,6 +2,7 @@
 
 #include "vcl/base/base.hpp"
 #include "vcl/opengl/debug/opengl_debug.hpp"
+#include "vcl/opengl/state/state.hpp"
 
 namespace vcl
 {
@@ -22,7 +23,7 @@ curve_gpu::curve_gpu(const std::vector<vec3>& position)
     number_elements = static_cast<unsigned int>(position.size());
 
     glGenVertexArrays(1,&vao);
-    glBindVertexArray(vao);
+    bind_vertex_array(vao);
 
     // position at layout 0
     glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
@@ -30,7 +31,6 @@ curve_gpu::curve_gpu(const std::vector<vec3>& position)
     glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, nullptr );
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 
 }
 
@@ -44,9 +44,8 @@ void curve_gpu::update_position(const std::vector<vec3>& new_position)
 
 void draw(const curve_gpu& curve)
 {
-    glBindVertexArray(curve.vao); opengl_debug();
+    bind_vertex_array(curve.vao); opengl_debug();
     glDrawArrays(GL_LINE_STRIP, 0, GLsizei(curve.number_elements)); opengl_debug();
-    glBindVertexArray(0);
 }
 
 
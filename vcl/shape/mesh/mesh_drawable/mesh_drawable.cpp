@@ -1,6 +1,7 @@
 #include "mesh_drawable.hpp"
 
 #include "vcl/opengl/opengl.hpp"
+#include "vcl/interaction/camera/camera_uniform_block/camera_uniform_block.hpp"
 
 namespace vcl
 {
@@ -48,22 +49,12 @@ void draw(const mesh_drawable& drawable, const camera_scene& camera, GLuint shad
     if(shader==0)
         return ;
 
-    // Check that the shader is a valid one
-    if(glIsProgram(shader)==GL_FALSE ) {
-        std::cout<<"No valid shader set to display mesh: skip display"<<std::endl;
-        return;
-    }
-
     // Switch shader program only if necessary
-    GLint current_shader = 0;
-    glGetIntegerv(GL_CURRENT_PROGRAM, &current_shader); opengl_debug();
-    if(shader!=GLuint(current_shader))
-        glUseProgram(shader); opengl_debug();
+    use_program(shader); opengl_debug();
 
     // Bind texture only if id != 0
     if(texture_id!=0) {
-        assert(glIsTexture(texture_id));
-        glBindTexture(GL_TEXTURE_2D, texture_id);  opengl_debug();
+        bind_texture(texture_id);  opengl_debug();
     }
 
     // Send all uniform values to the shader
@@ -74,9 +65,7 @@ void draw(const mesh_drawable& drawable, const camera_scene& camera, GLuint shad
     uniform(shader, "scaling", drawable.uniform.transform.scaling);              opengl_debug();
     uniform(shader, "scaling_axis", drawable.uniform.transform.scaling_axis);    opengl_debug();
 
-    uniform(shader,"perspective",camera.perspective.matrix());         opengl_debug();
-    uniform(shader,"view",camera.view_matrix());                       opengl_debug();
-    uniform(shader,"camera_position",camera.camera_position());        opengl_debug();
+    publish_camera(camera);                                                      opengl_debug();
 
     uniform(shader, "ambiant", drawable.uniform.shading.ambiant);      opengl_debug();
     uniform(shader, "diffuse", drawable.uniform.shading.diffuse);      opengl_debug();
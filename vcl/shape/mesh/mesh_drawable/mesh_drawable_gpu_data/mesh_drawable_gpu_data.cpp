@@ -19,6 +19,10 @@ mesh_drawable_gpu_data::mesh_drawable_gpu_data(const mesh &mesh_cpu_arg)
     mesh mesh_cpu = mesh_cpu_arg;
     mesh_cpu.fill_empty_fields();
 
+    // The vertex array is bound first, so that it records the index buffer (and no other vertex array is modified)
+    glGenVertexArrays(1,&vao);
+    bind_vertex_array(vao);
+
     // Fill VBO for position
     glGenBuffers(1, &vbo_position);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
@@ -47,13 +51,9 @@ mesh_drawable_gpu_data::mesh_drawable_gpu_data(const mesh &mesh_cpu_arg)
     glGenBuffers(1, &vbo_index);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_index);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(mesh_cpu.connectivity.size()*sizeof(GLuint)*3), &mesh_cpu.connectivity[0], GL_DYNAMIC_DRAW );
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     number_triangles = static_cast<unsigned int>(mesh_cpu.connectivity.size());
 
-    glGenVertexArrays(1,&vao);
-    glBindVertexArray(vao);
-
     // position at layout 0
     glBindBuffer(GL_ARRAY_BUFFER, vbo_position);
     glEnableVertexAttribArray( 0 );
@@ -75,7 +75,6 @@ mesh_drawable_gpu_data::mesh_drawable_gpu_data(const mesh &mesh_cpu_arg)
     glVertexAttribPointer( 3, 2, GL_FLOAT, GL_FALSE, 0, nullptr );
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 
 }
 
@@ -114,13 +113,10 @@ void draw(const mesh_drawable_gpu_data& gpu_data )
         std::cout<<"Warning, try to draw data with 0 triangles"<<std::endl;
         return ;
     }
-    assert(glIsVertexArray(gpu_data.vao));
-    assert(glIsBuffer(gpu_data.vbo_index));
 
-    glBindVertexArray(gpu_data.vao); opengl_debug();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu_data.vbo_index); opengl_debug();
+    // The index buffer is recorded in the vertex array
+    bind_vertex_array(gpu_data.vao); opengl_debug();
     glDrawElements(GL_TRIANGLES, GLsizei(gpu_data.number_triangles*3), GL_UNSIGNED_INT, nullptr); opengl_debug();
-    glBindVertexArray(0);
 }
 
 
@@ -1,6 +1,7 @@
 #include "segment_drawable_immediate_mode.hpp"
 
 #include "vcl/opengl/opengl.hpp"
+#include "vcl/interaction/camera/camera_uniform_block/camera_uniform_block.hpp"
 
 namespace vcl
 {
@@ -27,18 +28,13 @@ void segment_drawable_immediate_mode::draw(GLuint shader, const camera_scene& ca
     }
 
                                                                     opengl_debug();
-    GLint current_shader = 0;                                       opengl_debug();
-    glGetIntegerv(GL_CURRENT_PROGRAM, &current_shader);             opengl_debug();
-
-    if(shader!=GLuint(current_shader))
-        glUseProgram(shader);                                       opengl_debug();
+    use_program(shader);                                            opengl_debug();
 
     uniform(shader, "color", uniform_parameter.color);              opengl_debug();
     uniform(shader, "p1", uniform_parameter.p1);                    opengl_debug();
     uniform(shader, "p2", uniform_parameter.p2);                    opengl_debug();
 
-    uniform(shader,"perspective",camera.perspective.matrix());      opengl_debug();
-    uniform(shader,"view",camera.view_matrix());                    opengl_debug();
+    publish_camera(camera);                                         opengl_debug();
 
     vcl::draw(data_gpu);                                            opengl_debug();
 }
@@ -1,6 +1,7 @@
 #include "segments_drawable.hpp"
 
 #include "vcl/opengl/opengl.hpp"
+#include "vcl/interaction/camera/camera_uniform_block/camera_uniform_block.hpp"
 
 namespace vcl
 {
@@ -23,17 +24,13 @@ void draw(const segments_drawable& shape, const camera_scene& camera)
 void draw(const segments_drawable& shape, const camera_scene& camera, GLuint shader)
 {
     // Check shader and only switch if necessary
-    if( glIsProgram(shader)==GL_FALSE ) {
+    if( shader==0 ) {
         std::cout<<"Try to display a mesh with invalid shader ("<<shader<<"): skip display"<<std::endl;
         return ;
     }
 
                                                                           opengl_debug();
-    GLint current_shader = 0;                                             opengl_debug();
-    glGetIntegerv(GL_CURRENT_PROGRAM, &current_shader);                   opengl_debug();
-
-    if(shader!=GLuint(current_shader))
-        glUseProgram(shader);                                             opengl_debug();
+    use_program(shader);                                                  opengl_debug();
 
     uniform(shader, "rotation", shape.uniform.transform.rotation);        opengl_debug();
     uniform(shader, "translation", shape.uniform.transform.translation);  opengl_debug();
@@ -42,8 +39,7 @@ void draw(const segments_drawable& shape, const camera_scene& camera, GLuint sha
     uniform(shader, "color", shape.uniform.color);                        opengl_debug();
 
 
-    uniform(shader,"perspective",camera.perspective.matrix());            opengl_debug();
-    uniform(shader,"view",camera.view_matrix());                          opengl_debug();
+    publish_camera(camera);                                               opengl_debug();
 
     vcl::draw(shape.data);                                                opengl_debug();
 }
@@ -1,6 +1,9 @@
 #include "window.hpp"
 
+#include "vcl/opengl/debug/opengl_debug.hpp"
+
 #include <iostream>
+#include <cstdlib>
 
 namespace vcl
 {
@@ -38,10 +41,19 @@ static void glfw_error_callback(int error, const char* description)
     std::cerr<<"\t Description - "<<description<<std::endl;
 }
 
-void glfw_init()
+void glfw_init(bool offscreen)
 {
     glfwSetErrorCallback(glfw_error_callback);
 
+#ifdef GLFW_PLATFORM_NULL
+    // No display server: the null platform of GLFW 3.4 creates the context without any window system
+    const bool has_display = std::getenv("DISPLAY") != nullptr || std::getenv("WAYLAND_DISPLAY") != nullptr;
+    if( offscreen && !has_display )
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+    (void)offscreen;
+#endif
+
     const int glfw_init_value = glfwInit();
     if( glfw_init_value != 1 ) {
         std::cerr<<"Failed to Init GLFW"<<std::endl;
@@ -56,13 +68,26 @@ GLFWwindow* glfw_create_window(int width, int height, const std::string& title,
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, opengl_version_major);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, opengl_version_minor);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, 1);
-    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, 1);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, VCL_OPENGL_DEBUG_LEVEL > 0);
     glfwWindowHint(GLFW_OPENGL_PROFILE,GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_SAMPLES, 8);
     glfwWindowHint(GLFW_FLOATING, 0);
 
 
-    GLFWwindow* window = glfwCreateWindow(width, height, title.c_str(), monitor, share);
+    GLFWwindow* window = nullptr;
+#ifdef GLFW_PLATFORM_NULL
+    // Surfaceless EGL context, or a software OSMesa one
+    if( glfwGetPlatform()==GLFW_PLATFORM_NULL ) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        window = glfwCreateWindow(width, height, title.c_str(), monitor, share);
+        if( window==nullptr ) {
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+            window = glfwCreateWindow(width, height, title.c_str(), monitor, share);
+        }
+    }
+    else
+#endif
+    window = glfwCreateWindow(width, height, title.c_str(), monitor, share);
     if( window==nullptr ) {
         std::cerr<<"Failed to create GLFW Window"<<std::endl;
         std::cerr<<"\t Possible error cause: Incompatible OpenGL version (requesting OpenGL "<<opengl_version_major<<"."<<opengl_version_minor<<")"<<std::endl;
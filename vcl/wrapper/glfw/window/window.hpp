@@ -12,8 +12,10 @@ namespace vcl
 
 /** Initialize GLFW.
  * Function should be called before any use of GLFW
+ * offscreen: the window will not be shown. Without display server (and GLFW 3.4), the contexts are then created
+ * on the null platform by EGL (surfaceless) or OSMesa.
  * Exit program if fails */
-void glfw_init();
+void glfw_init(bool offscreen=false);
 
 GLFWwindow* glfw_create_window(int width, int height, const std::string& title, int opengl_version_major, int opengl_version_minor, GLFWmonitor* monitor=nullptr, GLFWwindow* share=nullptr);
 
@@ -1,6 +1,12 @@
 #include "lodepng.hpp"
 
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
 
 namespace vcl
 {
@@ -61,4 +67,386 @@ void image_save_png(const std::string& filename, const image_raw& im)
 }
 
 
+std::string image_encoding_extension(image_encoding encoding)
+{
+    switch(encoding)
+    {
+    case image_encoding::qoi:
+        return ".qoi";
+    case image_encoding::ppm:
+        return ".ppm";
+    default:
+        return ".png";
+    }
+}
+
+static unsigned int image_channels(const image_raw& im)
+{
+    return im.color_type==image_color_type::rgba ? 4 : 3;
+}
+
+static void push_u32(std::vector<unsigned char>& out, unsigned int value)
+{
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)(value));
+}
+
+static LodePNGCompressSettings fast_compress_settings()
+{
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    settings.windowsize = 512;
+    settings.nicematch = 32;
+    settings.lazymatching = 0;
+    return settings;
+}
+
+static std::vector<unsigned char> encode_png(const image_raw& im, bool fast)
+{
+    lodepng::State state;
+    const LodePNGColorType color_type = im.color_type==image_color_type::rgba ? LCT_RGBA : LCT_RGB;
+    state.info_raw.colortype = color_type;
+    state.info_raw.bitdepth = 8;
+    if(fast)
+    {
+        state.encoder.auto_convert = 0;
+        state.info_png.color.colortype = color_type;
+        state.info_png.color.bitdepth = 8;
+        state.encoder.zlibsettings = fast_compress_settings();
+    }
+
+    std::vector<unsigned char> out;
+    const unsigned error = lodepng::encode(out, im.data, im.width, im.height, state);
+    if ( error )
+    {
+        std::cerr<<"Encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+        exit(1);
+    }
+    return out;
+}
+
+static unsigned char paeth_predictor(int a, int b, int c)
+{
+    const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    return (unsigned char)((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c));
+}
+
+// Filtered scanline (type byte followed by the filtered bytes), with the filter type of minimum sum as lodepng does.
+// previous is a line of zeros for the first row. candidates holds 5 lines of length bytes.
+static void filter_scanline(unsigned char* out, const unsigned char* line, const unsigned char* previous, size_t length, size_t bpp, unsigned char* candidates)
+{
+    unsigned char* f[5];
+    for(int type = 0; type < 5; ++type)
+        f[type] = candidates + type*length;
+
+    for(size_t i = 0; i < bpp; ++i)
+    {
+        f[0][i] = line[i];
+        f[1][i] = line[i];
+        f[2][i] = (unsigned char)(line[i] - previous[i]);
+        f[3][i] = (unsigned char)(line[i] - previous[i]/2);
+        f[4][i] = (unsigned char)(line[i] - previous[i]);
+    }
+    for(size_t i = bpp; i < length; ++i)
+    {
+        const int a = line[i-bpp], b = previous[i], c = previous[i-bpp];
+        f[0][i] = line[i];
+        f[1][i] = (unsigned char)(line[i] - a);
+        f[2][i] = (unsigned char)(line[i] - b);
+        f[3][i] = (unsigned char)(line[i] - (a + b)/2);
+        f[4][i] = (unsigned char)(line[i] - paeth_predictor(a, b, c));
+    }
+
+    size_t best_sum = size_t(-1);
+    int best_type = 0;
+    for(int type = 0; type < 5; ++type)
+    {
+        size_t sum = 0;
+        for(size_t i = 0; i < length; ++i)
+            sum += f[type][i] < 128 ? f[type][i] : 256 - f[type][i];
+        if(sum < best_sum)
+        {
+            best_sum = sum;
+            best_type = type;
+        }
+    }
+
+    out[0] = (unsigned char)best_type;
+    std::copy(f[best_type], f[best_type] + length, out + 1);
+}
+
+/** The deflate stream of each strip is made of a single block (at most 64KiB of filtered rows), its first bit is
+ * the BFINAL flag, cleared for all the strips but the last one. The stream of the next strip must then start after
+ * an empty stored block, whose 3 bits header either fits in the padding of the last byte (suffix 00 00 FF FF) or
+ * needs one more byte (suffix 00 00 00 FF FF): the right one is the suffix with which the strip inflates. */
+static bool encode_png_parallel(const image_raw& im, unsigned int nb_threads, std::vector<unsigned char>& out)
+{
+    const size_t channels = image_channels(im);
+    const size_t row = channels*im.width;
+    const size_t filtered_row = row + 1;
+    const size_t rows_per_strip = 65536 / filtered_row;
+    if(rows_per_strip==0 || im.height==0)
+        return false;
+    const size_t nb_strips = (im.height + rows_per_strip - 1) / rows_per_strip;
+
+    std::vector<unsigned char> filtered(filtered_row*im.height);
+    std::vector<std::vector<unsigned char>> strips(nb_strips);
+    std::atomic<size_t> next_strip(0);
+    std::atomic<bool> failed(false);
+    const LodePNGCompressSettings settings = fast_compress_settings();
+
+    const std::vector<unsigned char> zero_row(row, 0);
+    auto worker = [&](){
+        std::vector<unsigned char> candidates(5*row);
+        for(size_t k = next_strip++; k < nb_strips && !failed; k = next_strip++)
+        {
+            const size_t first = k*rows_per_strip, last = std::min(first + rows_per_strip, size_t(im.height));
+            for(size_t y = first; y < last; ++y)
+                filter_scanline(&filtered[y*filtered_row], &im.data[y*row], y > 0 ? &im.data[(y-1)*row] : zero_row.data(), row, channels, candidates.data());
+
+            const unsigned char* strip_data = &filtered[first*filtered_row];
+            const size_t strip_size = (last - first)*filtered_row;
+            unsigned char* deflated = nullptr;
+            size_t deflated_size = 0;
+            if(lodepng_deflate(&deflated, &deflated_size, strip_data, strip_size, &settings) || deflated_size==0)
+            {
+                std::free(deflated);
+                failed = true;
+                return;
+            }
+            std::vector<unsigned char>& strip = strips[k];
+            strip.assign(deflated, deflated + deflated_size);
+            std::free(deflated);
+            if(k + 1 == nb_strips)
+                continue;
+
+            strip[0] &= 0xFE; // BFINAL
+            // Final empty block, followed by one byte as the adler32 in the zlib stream (lodepng checks the bounds strictly)
+            const unsigned char final_block[] = {0x01, 0x00, 0x00, 0xFF, 0xFF, 0x00};
+            bool joined = false;
+            for(size_t extra = 0; extra < 2 && !joined; ++extra)
+            {
+                std::vector<unsigned char> test = strip;
+                test.insert(test.end(), extra, 0x00);
+                test.insert(test.end(), {0x00, 0x00, 0xFF, 0xFF});
+                test.insert(test.end(), final_block, final_block + 6);
+                unsigned char* inflated = nullptr;
+                size_t inflated_size = 0;
+                const unsigned error = lodepng_inflate(&inflated, &inflated_size, test.data(), test.size(), &lodepng_default_decompress_settings);
+                std::free(inflated);
+                if(!error && inflated_size==strip_size)
+                {
+                    strip.insert(strip.end(), extra, 0x00);
+                    strip.insert(strip.end(), {0x00, 0x00, 0xFF, 0xFF});
+                    joined = true;
+                }
+            }
+            if(!joined)
+                failed = true;
+        }
+    };
+
+    const unsigned int nb_workers = std::max(1u, nb_threads > 0 ? nb_threads : std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for(unsigned int t = 1; t < nb_workers; ++t)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(std::thread& t : threads)
+        t.join();
+    if(failed)
+        return false;
+
+    // zlib stream: header, deflate streams of the strips, adler32 of the filtered rows
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    for(const std::vector<unsigned char>& strip : strips)
+        zlib.insert(zlib.end(), strip.begin(), strip.end());
+    unsigned int s1 = 1, s2 = 0;
+    for(size_t i = 0; i < filtered.size(); )
+    {
+        const size_t end = std::min(i + 5552, filtered.size());
+        for(; i < end; ++i)
+        {
+            s1 += filtered[i];
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+    push_u32(zlib, (s2 << 16) | s1);
+
+    auto add_chunk = [&out](const char* type, const std::vector<unsigned char>& data){
+        push_u32(out, (unsigned int)data.size());
+        const size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        push_u32(out, lodepng_crc32(&out[start], out.size() - start));
+    };
+
+    out = {137, 80, 78, 71, 13, 10, 26, 10};
+    std::vector<unsigned char> header;
+    push_u32(header, im.width);
+    push_u32(header, im.height);
+    header.insert(header.end(), {8, (unsigned char)(channels==4 ? 6 : 2), 0, 0, 0});
+    add_chunk("IHDR", header);
+    add_chunk("IDAT", zlib);
+    add_chunk("IEND", {});
+    return true;
+}
+
+static std::vector<unsigned char> encode_qoi(const image_raw& im)
+{
+    const size_t channels = image_channels(im);
+    const size_t nb_pixels = size_t(im.width)*im.height;
+
+    std::vector<unsigned char> out = {'q', 'o', 'i', 'f'};
+    out.reserve(14 + nb_pixels*(channels+1) + 8);
+    push_u32(out, im.width);
+    push_u32(out, im.height);
+    out.push_back((unsigned char)channels);
+    out.push_back(0); // sRGB with linear alpha
+
+    unsigned char index[64][4] = {{0}};
+    unsigned char previous[4] = {0, 0, 0, 255};
+    int run = 0;
+    for(size_t k = 0; k < nb_pixels; ++k)
+    {
+        const unsigned char* p = &im.data[k*channels];
+        const unsigned char px[4] = {p[0], p[1], p[2], channels==4 ? p[3] : (unsigned char)255};
+        const bool same = px[0]==previous[0] && px[1]==previous[1] && px[2]==previous[2] && px[3]==previous[3];
+        if(same)
+        {
+            ++run;
+            if(run==62 || k+1==nb_pixels)
+            {
+                out.push_back((unsigned char)(0xC0 | (run-1)));
+                run = 0;
+            }
+            continue;
+        }
+        if(run > 0)
+        {
+            out.push_back((unsigned char)(0xC0 | (run-1)));
+            run = 0;
+        }
+
+        const int h = (px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64;
+        if(index[h][0]==px[0] && index[h][1]==px[1] && index[h][2]==px[2] && index[h][3]==px[3])
+            out.push_back((unsigned char)h);
+        else
+        {
+            std::copy(px, px+4, index[h]);
+            if(px[3]==previous[3])
+            {
+                const signed char vr = (signed char)(px[0] - previous[0]);
+                const signed char vg = (signed char)(px[1] - previous[1]);
+                const signed char vb = (signed char)(px[2] - previous[2]);
+                const int vg_r = vr - vg, vg_b = vb - vg;
+                if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                    out.push_back((unsigned char)(0x40 | (vr+2) << 4 | (vg+2) << 2 | (vb+2)));
+                else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                {
+                    out.push_back((unsigned char)(0x80 | (vg+32)));
+                    out.push_back((unsigned char)((vg_r+8) << 4 | (vg_b+8)));
+                }
+                else
+                    out.insert(out.end(), {0xFE, px[0], px[1], px[2]});
+            }
+            else
+                out.insert(out.end(), {0xFF, px[0], px[1], px[2], px[3]});
+        }
+        std::copy(px, px+4, previous);
+    }
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    return out;
+}
+
+static std::vector<unsigned char> encode_ppm(const image_raw& im)
+{
+    const size_t channels = image_channels(im);
+    const size_t nb_pixels = size_t(im.width)*im.height;
+    const std::string header = "P6\n" + std::to_string(im.width) + " " + std::to_string(im.height) + "\n255\n";
+
+    std::vector<unsigned char> out(header.begin(), header.end());
+    out.resize(header.size() + 3*nb_pixels);
+    unsigned char* rgb = &out[header.size()];
+    for(size_t k = 0; k < nb_pixels; ++k)
+    {
+        rgb[3*k]   = im.data[channels*k];
+        rgb[3*k+1] = im.data[channels*k+1];
+        rgb[3*k+2] = im.data[channels*k+2];
+    }
+    return out;
+}
+
+std::vector<unsigned char> image_encode(const image_raw& im, image_encoding encoding, unsigned int nb_threads)
+{
+    switch(encoding)
+    {
+    case image_encoding::png:
+        return encode_png(im, false);
+    case image_encoding::png_fast:
+        return encode_png(im, true);
+    case image_encoding::png_parallel:
+    {
+        std::vector<unsigned char> out;
+        if(encode_png_parallel(im, nb_threads, out))
+            return out;
+        return encode_png(im, true); // rows too long for a single block strip
+    }
+    case image_encoding::qoi:
+        return encode_qoi(im);
+    default:
+        return encode_ppm(im);
+    }
+}
+
+void image_save(const std::string& filename, const image_raw& im, image_encoding encoding, unsigned int nb_threads)
+{
+    const std::vector<unsigned char> data = image_encode(im, encoding, nb_threads);
+    std::ofstream file(filename, std::ios::binary);
+    if( !file )
+    {
+        std::cerr<<"Cannot write image file "<<filename<<std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+}
+
+void image_encoding_benchmark(unsigned int width, unsigned int height, int repetitions)
+{
+    // Rendering-like content: smooth gradients, flat areas and some noise
+    image_raw im(width, height, image_color_type::rgba, std::vector<unsigned char>(4*size_t(width)*height));
+    unsigned int seed = 12345;
+    for(unsigned int y = 0; y < height; ++y)
+    {
+        for(unsigned int x = 0; x < width; ++x)
+        {
+            unsigned char* p = &im.data[4*(size_t(y)*width + x)];
+            seed = seed*1103515245u + 12345u;
+            const bool flat = ((x/64 + y/64) % 3)==0;
+            const int noise = flat ? 0 : int((seed >> 16) % 5) - 2;
+            p[0] = (unsigned char)std::min(255, std::max(0, int(255*x/width) + noise));
+            p[1] = (unsigned char)std::min(255, std::max(0, int(255*y/height) + noise));
+            p[2] = flat ? 200 : (unsigned char)((x ^ y) & 0xFF);
+            p[3] = 255;
+        }
+    }
+
+    const image_encoding encodings[] = {image_encoding::png, image_encoding::png_fast, image_encoding::png_parallel, image_encoding::qoi, image_encoding::ppm};
+    const char* names[] = {"png", "png_fast", "png_parallel", "qoi", "ppm"};
+    std::cout<<"Image encoding of "<<width<<"x"<<height<<" rgba ("<<repetitions<<" repetitions)"<<std::endl;
+    for(int k = 0; k < 5; ++k)
+    {
+        size_t size = 0;
+        const auto start = std::chrono::high_resolution_clock::now();
+        for(int r = 0; r < repetitions; ++r)
+            size = image_encode(im, encodings[k]).size();
+        const auto end = std::chrono::high_resolution_clock::now();
+        const double ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0 / std::max(repetitions, 1);
+        std::cout<<"\t"<<names[k]<<": "<<ms<<" ms, "<<size/1024<<" KiB ("<<100.0*size/im.data.size()<<"%)"<<std::endl;
+    }
+}
+
 }
@@ -14,4 +14,23 @@ image_raw image_load_png(const std::string& filename, image_color_type color_typ
 
 void image_save_png(const std::string& filename, const image_raw& im);
 
+
+/** Image file encodings, from the smallest files to the fastest
+ * png          - lodepng default settings (automatic color type, minimum sum filters, lazy matching)
+ * png_fast     - same color type as the image, small LZ77 window without lazy matching
+ * png_parallel - png_fast settings, the rows are split in strips compressed on nb_threads threads, and the deflate
+ *                streams of the strips are joined into the single zlib stream of the png (larger files than png_fast)
+ * qoi          - "Quite OK Image" lossless format (qoiformat.org), a single pass over the pixels
+ * ppm          - uncompressed binary portable pixmap (the alpha channel is dropped) */
+enum class image_encoding {png, png_fast, png_parallel, qoi, ppm};
+
+// Extension of the files of an encoding (".png", ".qoi", ".ppm")
+std::string image_encoding_extension(image_encoding encoding);
+// Encoded file content. nb_threads is used by png_parallel (0: one per hardware thread).
+std::vector<unsigned char> image_encode(const image_raw& im, image_encoding encoding, unsigned int nb_threads = 0);
+void image_save(const std::string& filename, const image_raw& im, image_encoding encoding, unsigned int nb_threads = 0);
+
+// Print the encoding time and the size of each encoding for a synthetic image of size width x height
+void image_encoding_benchmark(unsigned int width, unsigned int height, int repetitions);
+
 }